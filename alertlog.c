@@ -0,0 +1,788 @@
+/*
+*      alertlog.c -- alert log, its query index and the legacy log importer
+*
+*      The alert log is one file of fixed-size records, a voted header each,
+*      parsed into its fields (originator, event, locations, purge time,
+*      issue time, station) and appended as alerts are decoded. Queries by
+*      event code or location go through a sorted index kept next to it
+*      (log.idx), rebuilt by "alertlog index" and at the end of a live run.
+*      An index covers the records that existed when it was built; records
+*      appended since are scanned, and a missing index means a full scan,
+*      so answers never depend on it.
+*
+*      Years of history only exist as decoder stdout. "alertlog import"
+*      maps those logs, cuts them into segments on line boundaries and
+*      parses the segments in forked workers, one per core, into a shared
+*      mapping; records are then appended in log order and the index is
+*      rebuilt, so imported alerts are queried like freshly decoded ones.
+*      Each "successfully received EAS message" line is an alert, and a
+*      "successfully processed" line, printed only for an EOM after a
+*      voted header, marks it ended. A "received EAS part" line means a new
+*      header is arriving, so a later end belongs to that one and not to
+*      the alert before it, the same rule live logging follows. Legacy
+*      lines carry no timestamps; imported records have time 0 and keep
+*      their position in the source as a sequence.
+*
+*      eas-decode alertlog import [-j jobs] -o log file.log ...
+*      eas-decode alertlog index log
+*      eas-decode alertlog query [-e EEE] [-f PSSCCC] [-n max] log
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define ALOG_MAGIC "EASALOG1"
+#define AIDX_MAGIC "EASAIDX1"
+#define ALOG_VERSION 1
+#define ALOG_SEGMENTS 4                   // segments per import job, for balance
+#define ALOG_MIN_LINE 40                  // shortest line that is an alert
+#define ALOG_LEAD_END 1                   // segment opens with an end line
+#define ALOG_LEAD_PART 2                  // segment opens with a header copy
+
+static const char alog_vote[] = "successfully received EAS message: ZCZC";
+static const char alog_end[] = "successfully processed EAS message: ";
+static const char alog_part[] = "received EAS part: ";
+
+struct alog_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int record_size;
+	unsigned long long count;
+};
+
+struct aidx_header
+{
+	char magic[8];
+	unsigned long long count;             // log records covered
+	unsigned long long nevent;
+	unsigned long long nfips;
+};
+
+struct aidx_event
+{
+	char event[4];
+	unsigned int rec;
+};
+
+struct aidx_fips
+{
+	unsigned int fips;
+	unsigned int rec;
+};
+
+struct eas_alertlog
+{
+	FILE *fp;                             // appending, or 0
+	const char *map;                      // reading
+	size_t map_len;
+	const struct eas_alert_rec *recs;
+	unsigned long long count;
+	const struct aidx_event *events;      // the index, if any
+	const struct aidx_fips *fips;
+	unsigned long long indexed;           // records the index covers
+	unsigned long long nevent;
+	unsigned long long nfips;
+	const char *idx_map;
+	size_t idx_len;
+};
+
+// "-ORG-EEE-PSSCCC-...-PSSCCC+TTTT-JJJHHMM-LLLLLLLL-", the body after ZCZC
+int eas_header_parse(const char *body, struct eas_alert_rec *r)
+{
+	const char *p = body;
+	int n, fips, ttt, day, hh, mm;
+
+	memset(r, 0, sizeof(*r));
+
+	if(sscanf(p, "-%3[A-Z]-%3[A-Z0-9]%n", r->org, r->event, &n) != 2)
+		return -1;
+
+	for(p += n; *p == '-' && r->nfips < EAS_MAX_FIPS; p += 7)
+	{
+		if(sscanf(p, "-%6d", &fips) != 1 || (p[7] != '-' && p[7] != '+'))
+			return -1;
+		r->fips[r->nfips++] = fips;
+	}
+
+	if(*p != '+' || sscanf(p, "+%4d-%3d%2d%2d-%8[^-]", &ttt, &day, &hh, &mm, r->station) != 5)
+		return -1;
+
+	r->purge = (unsigned short)(ttt / 100 * 60 + ttt % 100);
+	r->issue_day = (unsigned short)day;
+	r->issue_min = (unsigned short)(hh * 60 + mm);
+	return 0;
+}
+
+void eas_header_format(const struct eas_alert_rec *r, char *buf, int len)
+{
+	int i, n;
+
+	n = snprintf(buf, len, "-%s-%s", r->org, r->event);
+	for(i = 0; i < r->nfips && n < len; i++)
+		n += snprintf(buf + n, len - n, "-%06u", r->fips[i]);
+	if(n < len)
+		snprintf(buf + n, len - n, "+%02d%02d-%03d%02d%02d-%s-", r->purge / 60, r->purge % 60,
+			r->issue_day, r->issue_min / 60, r->issue_min % 60, r->station);
+}
+
+static char *idx_path(const char *path, char *buf, int len)
+{
+	snprintf(buf, len, "%s.idx", path);
+	return buf;
+}
+
+struct eas_alertlog *eas_alertlog_create(const char *path)
+{
+	struct eas_alertlog *l;
+	struct alog_header h;
+	char ipath[512];
+	FILE *fp;
+
+	// existing logs are appended to, new ones get a header
+	if(!(fp = fopen(path, "r+b")) && (errno != ENOENT || !(fp = fopen(path, "w+b"))))
+	{
+		perror(path);
+		return 0;
+	}
+
+	if(fread(&h, sizeof(h), 1, fp) != 1)
+	{
+		// an index left by an earlier log of this name would describe
+		// other records
+		unlink(idx_path(path, ipath, sizeof(ipath)));
+
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, ALOG_MAGIC, sizeof(h.magic));
+		h.version = ALOG_VERSION;
+		h.record_size = sizeof(struct eas_alert_rec);
+		rewind(fp);
+		fwrite(&h, sizeof(h), 1, fp);
+	}
+	else if(memcmp(h.magic, ALOG_MAGIC, sizeof(h.magic)) || h.version != ALOG_VERSION || h.record_size != sizeof(struct eas_alert_rec))
+	{
+		fprintf(stderr, "%s: not an alert log\n", path);
+		fclose(fp);
+		return 0;
+	}
+
+	if(!(l = calloc(1, sizeof(*l))))
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	l->fp = fp;
+	l->count = h.count;
+	return l;
+}
+
+// appends n records, then publishes the new count
+int eas_alertlog_append(struct eas_alertlog *l, const struct eas_alert_rec *r, int n)
+{
+	struct alog_header h;
+
+	if(!l->fp || fseek(l->fp, sizeof(h) + l->count * sizeof(*r), SEEK_SET) || fwrite(r, sizeof(*r), n, l->fp) != (size_t)n)
+		return -1;
+
+	l->count += n;
+	memcpy(h.magic, ALOG_MAGIC, sizeof(h.magic));
+	h.version = ALOG_VERSION;
+	h.record_size = sizeof(*r);
+	h.count = l->count;
+
+	if(fseek(l->fp, 0, SEEK_SET) || fwrite(&h, sizeof(h), 1, l->fp) != 1 || fflush(l->fp))
+		return -1;
+
+	return 0;
+}
+
+// marks record i ended, for an EOM after its header
+int eas_alertlog_end(struct eas_alertlog *l, unsigned long long i)
+{
+	struct eas_alert_rec r;
+	long off = sizeof(struct alog_header) + (long)i * sizeof(r);
+
+	if(!l->fp || i >= l->count || fseek(l->fp, off, SEEK_SET) || fread(&r, sizeof(r), 1, l->fp) != 1)
+		return -1;
+
+	r.ended = 1;
+	if(fseek(l->fp, off, SEEK_SET) || fwrite(&r, sizeof(r), 1, l->fp) != 1 || fflush(l->fp))
+		return -1;
+
+	return 0;
+}
+
+static const void *map_file(const char *path, size_t *len)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	p = fstat(fd, &st) < 0 || !st.st_size ? MAP_FAILED : mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+		return 0;
+
+	*len = st.st_size;
+	return p;
+}
+
+struct eas_alertlog *eas_alertlog_open(const char *path)
+{
+	struct eas_alertlog *l;
+	const struct alog_header *h;
+	const struct aidx_header *ih;
+	char ipath[512];
+
+	if(!(l = calloc(1, sizeof(*l))))
+		return 0;
+
+	if(!(l->map = map_file(path, &l->map_len)))
+	{
+		perror(path);
+		free(l);
+		return 0;
+	}
+
+	h = (const struct alog_header *)l->map;
+	if(l->map_len < sizeof(*h) || memcmp(h->magic, ALOG_MAGIC, sizeof(h->magic)) || h->version != ALOG_VERSION ||
+		h->record_size != sizeof(struct eas_alert_rec) || (l->map_len - sizeof(*h)) / sizeof(struct eas_alert_rec) < h->count)
+	{
+		fprintf(stderr, "%s: not an alert log\n", path);
+		eas_alertlog_close(l);
+		return 0;
+	}
+
+	l->recs = (const struct eas_alert_rec *)(l->map + sizeof(*h));
+	l->count = h->count;
+
+	// an index covers the log as it was when built; later appends are
+	// scanned by queries
+	if((l->idx_map = map_file(idx_path(path, ipath, sizeof(ipath)), &l->idx_len)))
+	{
+		ih = (const struct aidx_header *)l->idx_map;
+		if(l->idx_len >= sizeof(*ih) && !memcmp(ih->magic, AIDX_MAGIC, sizeof(ih->magic)) && ih->count <= l->count &&
+			l->idx_len == sizeof(*ih) + ih->nevent * sizeof(struct aidx_event) + ih->nfips * sizeof(struct aidx_fips))
+		{
+			l->events = (const struct aidx_event *)(l->idx_map + sizeof(*ih));
+			l->fips = (const struct aidx_fips *)(l->events + ih->nevent);
+			l->indexed = ih->count;
+			l->nevent = ih->nevent;
+			l->nfips = ih->nfips;
+		}
+	}
+
+	return l;
+}
+
+unsigned long long eas_alertlog_count(const struct eas_alertlog *l)
+{
+	return l->count;
+}
+
+const struct eas_alert_rec *eas_alertlog_get(const struct eas_alertlog *l, unsigned long long i)
+{
+	return l->recs && i < l->count ? &l->recs[i] : 0;
+}
+
+// records the index covers; 0 without one
+unsigned long long eas_alertlog_indexed(const struct eas_alertlog *l)
+{
+	return l->events ? l->indexed : 0;
+}
+
+void eas_alertlog_close(struct eas_alertlog *l)
+{
+	if(!l)
+		return;
+
+	if(l->fp)
+		fclose(l->fp);
+	if(l->map)
+		munmap((void *)l->map, l->map_len);
+	if(l->idx_map)
+		munmap((void *)l->idx_map, l->idx_len);
+	free(l);
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+	const struct aidx_event *x = a, *y = b;
+	int c = memcmp(x->event, y->event, sizeof(x->event));
+
+	return c ? c : x->rec < y->rec ? -1 : x->rec > y->rec;
+}
+
+static int cmp_fips(const void *a, const void *b)
+{
+	const struct aidx_fips *x = a, *y = b;
+
+	return x->fips != y->fips ? (x->fips < y->fips ? -1 : 1) : x->rec < y->rec ? -1 : x->rec > y->rec;
+}
+
+int eas_alertlog_index(const char *path)
+{
+	struct eas_alertlog *l;
+	struct aidx_header h;
+	struct aidx_event *ev;
+	struct aidx_fips *fp;
+	unsigned long long i, nfips = 0;
+	char ipath[512], tmp[520];
+	FILE *out;
+	int k, ret = -1;
+
+	if(!(l = eas_alertlog_open(path)))
+		return -1;
+
+	for(i = 0; i < l->count; i++)
+		nfips += l->recs[i].nfips;
+
+	ev = malloc((l->count + 1) * sizeof(*ev));
+	fp = malloc((nfips + 1) * sizeof(*fp));
+
+	for(nfips = i = 0; ev && fp && i < l->count; i++)
+	{
+		memcpy(ev[i].event, l->recs[i].event, sizeof(ev[i].event));
+		ev[i].rec = (unsigned int)i;
+
+		for(k = 0; k < l->recs[i].nfips; k++, nfips++)
+		{
+			fp[nfips].fips = l->recs[i].fips[k];
+			fp[nfips].rec = (unsigned int)i;
+		}
+	}
+
+	if(!ev || !fp)
+		goto done;
+
+	qsort(ev, l->count, sizeof(*ev), cmp_event);
+	qsort(fp, nfips, sizeof(*fp), cmp_fips);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, AIDX_MAGIC, sizeof(h.magic));
+	h.count = l->count;
+	h.nevent = l->count;
+	h.nfips = nfips;
+
+	// written aside and renamed, so readers see the old index or the new
+	snprintf(tmp, sizeof(tmp), "%s.tmp", idx_path(path, ipath, sizeof(ipath)));
+	if(!(out = fopen(tmp, "wb")))
+	{
+		perror(tmp);
+		goto done;
+	}
+
+	fwrite(&h, sizeof(h), 1, out);
+	fwrite(ev, sizeof(*ev), l->count, out);
+	fwrite(fp, sizeof(*fp), nfips, out);
+
+	if(fclose(out) || rename(tmp, ipath))
+		perror(ipath);
+	else
+		ret = 0;
+
+done:
+	free(ev);
+	free(fp);
+	eas_alertlog_close(l);
+	return ret;
+}
+
+static int rec_has_fips(const struct eas_alert_rec *r, unsigned int fips)
+{
+	int k;
+
+	for(k = 0; k < r->nfips; k++)
+	{
+		if(r->fips[k] == fips)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int rec_matches(const struct eas_alert_rec *r, const char *event, int fips)
+{
+	return (!event || !strncmp(r->event, event, sizeof(r->event))) && (fips < 0 || rec_has_fips(r, fips));
+}
+
+// first index entry not below key, by binary search
+static unsigned long long lower_event(const struct eas_alertlog *l, const char *event)
+{
+	unsigned long long lo = 0, hi = l->nevent, mid;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(strncmp(l->events[mid].event, event, sizeof(l->events[mid].event)) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static unsigned long long lower_fips(const struct eas_alertlog *l, unsigned int fips)
+{
+	unsigned long long lo = 0, hi = l->nfips, mid;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(l->fips[mid].fips < fips)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// calls fn for every record with the event code (0 = any) listing the
+// location (< 0 = any), in log order; returns the number of matches
+unsigned long eas_alertlog_query(const struct eas_alertlog *l, const char *event, int fips,
+	void (*fn)(const struct eas_alert_rec *r, unsigned long long i, void *ctx), void *ctx)
+{
+	unsigned long long i = 0, k;
+	unsigned long n = 0;
+
+	if(l->events && fips >= 0)
+	{
+		for(k = lower_fips(l, fips); k < l->nfips && l->fips[k].fips == (unsigned int)fips; k++)
+		{
+			// a record listing the location twice is reported once
+			if((k && l->fips[k - 1].fips == (unsigned int)fips && l->fips[k - 1].rec == l->fips[k].rec) ||
+				!rec_matches(&l->recs[l->fips[k].rec], event, fips))
+				continue;
+
+			fn(&l->recs[l->fips[k].rec], l->fips[k].rec, ctx);
+			n++;
+		}
+		i = l->indexed;
+	}
+	else if(l->events && event)
+	{
+		for(k = lower_event(l, event); k < l->nevent && !strncmp(l->events[k].event, event, sizeof(l->events[k].event)); k++)
+		{
+			fn(&l->recs[l->events[k].rec], l->events[k].rec, ctx);
+			n++;
+		}
+		i = l->indexed;
+	}
+
+	// records appended after the index was built, or all without one
+	for(; i < l->count; i++)
+	{
+		if(rec_matches(&l->recs[i], event, fips))
+		{
+			fn(&l->recs[i], i, ctx);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+// import
+
+struct alog_segment
+{
+	size_t start;                         // bytes into the source
+	size_t end;
+	unsigned long long first;             // first record slot in the shared output
+	unsigned long long count;             // records parsed
+	int lead;                             // first part or end line before any alert
+	int open;                             // the last alert can still be ended
+	unsigned long bad;                    // alert lines that did not parse
+};
+
+static const char *line_end(const char *p, const char *end)
+{
+	const char *q = memchr(p, '\n', end - p);
+
+	return q ? q : end;
+}
+
+static void alog_parse(const char *src, struct alog_segment *seg, struct eas_alert_rec *out, unsigned long long seq)
+{
+	const char *p = src + seg->start, *end = src + seg->end, *e;
+	char body[300];
+	int n;
+
+	for(; p < end; p = e + 1)
+	{
+		e = line_end(p, end);
+		n = (int)(e - p);
+
+		if(n > (int)sizeof(alog_vote) - 1 && !memcmp(p, alog_vote, sizeof(alog_vote) - 1))
+		{
+			n = MIN(n - (int)(sizeof(alog_vote) - 1), (int)sizeof(body) - 1);
+			memcpy(body, p + sizeof(alog_vote) - 1, n);
+			body[n] = 0;
+
+			if(eas_header_parse(body, &out[seg->first + seg->count]) < 0)
+			{
+				seg->bad++;
+				continue;
+			}
+
+			out[seg->first + seg->count].stream = -1;
+			out[seg->first + seg->count].seq = seq + (p - src);
+			seg->count++;
+			seg->open = 1;
+		}
+		else if(n >= (int)sizeof(alog_end) - 1 && !memcmp(p, alog_end, sizeof(alog_end) - 1))
+		{
+			if(seg->open)
+				out[seg->first + seg->count - 1].ended = 1;
+			else if(!seg->count && !seg->lead)
+				seg->lead = ALOG_LEAD_END;
+			seg->open = 0;
+		}
+		else if(n >= (int)sizeof(alog_part) - 1 && !memcmp(p, alog_part, sizeof(alog_part) - 1))
+		{
+			// a header copy that did not vote; the end it leads to is not ours
+			if(!seg->count && !seg->lead)
+				seg->lead = ALOG_LEAD_PART;
+			seg->open = 0;
+		}
+	}
+}
+
+static int alog_import_file(struct eas_alertlog *l, const char *path, int jobs, unsigned long long seq, unsigned long *bad)
+{
+	struct alog_segment *seg;
+	struct eas_alert_rec *out;
+	const char *src;
+	size_t len, bytes, cap;
+	unsigned long long total = 0;
+	int nseg, i, j, open, status, ret = 0;
+	pid_t *pids;
+
+	if(!(src = map_file(path, &len)))
+	{
+		perror(path);
+		return -1;
+	}
+
+	madvise((void *)src, len, MADV_SEQUENTIAL);
+
+	// segments end on line boundaries; the descriptors are shared so
+	// the workers' counts come back through them
+	nseg = MIN(jobs * ALOG_SEGMENTS, (int)(len / 65536) + 1);
+	seg = mmap(0, nseg * sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = calloc(jobs, sizeof(*pids));
+
+	if(seg == MAP_FAILED || !pids)
+	{
+		munmap((void *)src, len);
+		return -1;
+	}
+
+	for(i = 0, cap = 0; i < nseg; i++)
+	{
+		seg[i].start = i ? seg[i - 1].end : 0;
+		seg[i].end = i == nseg - 1 ? len : MIN(len, (size_t)(line_end(src + MIN(len, len / nseg * (i + 1)), src + len) - src) + 1);
+		seg[i].end = seg[i].end < seg[i].start ? seg[i].start : seg[i].end;
+
+		// room for the most alert lines the segment could hold
+		seg[i].first = cap;
+		bytes = seg[i].end - seg[i].start;
+		cap += bytes / ALOG_MIN_LINE + 1;
+	}
+
+	// workers fill disjoint slots of one shared mapping, touched only where used
+	out = mmap(0, cap * sizeof(*out), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(out == MAP_FAILED)
+	{
+		perror("mmap");
+		munmap(seg, nseg * sizeof(*seg));
+		munmap((void *)src, len);
+		free(pids);
+		return -1;
+	}
+
+	fflush(stdout);
+	for(j = 0; j < jobs; j++)
+	{
+		if((pids[j] = fork()) < 0)
+		{
+			perror("fork");
+			ret = -1;
+			break;
+		}
+
+		if(!pids[j])
+		{
+			for(i = j; i < nseg; i += jobs)
+				alog_parse(src, &seg[i], out, seq);
+			_exit(0);
+		}
+	}
+
+	for(i = 0; i < j; i++)
+	{
+		if(waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+
+	// stitch in log order: an end line opening a segment ends the last
+	// alert of the segments before it, unless a part line came between
+	for(i = 0, open = 0; !ret && i < nseg; i++)
+	{
+		if(seg[i].lead == ALOG_LEAD_END && open)
+			eas_alertlog_end(l, eas_alertlog_count(l) - 1);
+		if(seg[i].lead)
+			open = 0;
+		if(seg[i].count)
+			open = seg[i].open;
+
+		if(seg[i].count && eas_alertlog_append(l, out + seg[i].first, (int)seg[i].count) < 0)
+			ret = -1;
+
+		total += seg[i].count;
+		*bad += seg[i].bad;
+	}
+
+	munmap(out, cap * sizeof(*out));
+	munmap(seg, nseg * sizeof(*seg));
+	munmap((void *)src, len);
+	free(pids);
+
+	return ret < 0 ? -1 : (int)MIN(total, 0x7fffffff);
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void query_print(const struct eas_alert_rec *r, unsigned long long i, void *ctx)
+{
+	unsigned long *left = ctx;
+	char buf[300], when[32];
+	time_t t = (time_t)r->time;
+
+	if(!*left)
+		return;
+	(*left)--;
+
+	eas_header_format(r, buf, sizeof(buf));
+	if(r->time > 0)
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	else
+		snprintf(when, sizeof(when), "imported @%llu", r->seq);
+
+	printf("%8llu  %-24s %s ZCZC%s\n", i, when, r->ended ? "ended " : "      ", buf);
+}
+
+int alertlog_main(int argc, char **argv)
+{
+	struct eas_alertlog *l;
+	const char *out = 0, *event = 0, *cmd;
+	unsigned long bad = 0, left = 50, n;
+	unsigned long long seq = 0;
+	double t;
+	int opt, i, jobs = (int)sysconf(_SC_NPROCESSORS_ONLN), fips = -1, got;
+
+	if(argc < 2)
+		goto usage;
+
+	cmd = argv[1];
+	argc--;
+	argv++;
+
+	while((opt = getopt(argc, argv, "o:j:e:f:n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'o': out = optarg; break;
+		case 'j': jobs = atoi(optarg); break;
+		case 'e': event = optarg; break;
+		case 'f': fips = atoi(optarg); break;
+		case 'n': left = strtoul(optarg, 0, 10); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if(!strcmp(cmd, "import") && out && optind < argc && jobs > 0)
+	{
+		if(!(l = eas_alertlog_create(out)))
+			return 1;
+
+		t = now_sec();
+		for(n = 0, i = optind; i < argc; i++, seq += 1ULL << 40)
+		{
+			// sequences keep files apart: file number, then byte offset
+			if((got = alog_import_file(l, argv[i], jobs, seq, &bad)) < 0)
+			{
+				eas_alertlog_close(l);
+				return 1;
+			}
+			n += got;
+		}
+		t = now_sec() - t;
+
+		printf("%lu alerts imported from %d logs in %.3f s on %d jobs (%lu unparsable), log holds %llu\n",
+			n, argc - optind, t, jobs, bad, eas_alertlog_count(l));
+		eas_alertlog_close(l);
+
+		t = now_sec();
+		if(eas_alertlog_index(out) < 0)
+			return 1;
+		printf("index rebuilt in %.3f s\n", now_sec() - t);
+		return 0;
+	}
+
+	if(!strcmp(cmd, "index") && optind + 1 == argc)
+		return eas_alertlog_index(argv[optind]) < 0;
+
+	if(!strcmp(cmd, "query") && optind + 1 == argc)
+	{
+		if(!(l = eas_alertlog_open(argv[optind])))
+			return 1;
+
+		t = now_sec();
+		n = eas_alertlog_query(l, event, fips, query_print, &left);
+		t = now_sec() - t;
+
+		printf("%lu matches of %llu alerts in %.3f ms ", n, eas_alertlog_count(l), t * 1000.0);
+		if(!eas_alertlog_indexed(l))
+			printf("(scanned, no index)\n");
+		else if(eas_alertlog_indexed(l) < eas_alertlog_count(l))
+			printf("(indexed, %llu appended since scanned)\n", eas_alertlog_count(l) - eas_alertlog_indexed(l));
+		else
+			printf("(indexed)\n");
+		eas_alertlog_close(l);
+		return 0;
+	}
+
+usage:
+	fprintf(stderr, "usage: alertlog import [-j jobs] -o log file.log ...\n"
+		"       alertlog index log\n"
+		"       alertlog query [-e EEE] [-f PSSCCC] [-n max] log\n");
+	return 1;
+}
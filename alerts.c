@@ -0,0 +1,262 @@
+/*
+*      alerts.c -- active-alert table and relay dedup cache
+*
+*      The same alert reaches a host through many stations, each relaying
+*      it with its own station id in the last header field. Voted headers
+*      are keyed on everything up to the issue time (ORG-EEE-PSSCCC...
+*      +TTTT-JJJHHMM-) so relays of one alert collapse to one entry, which
+*      stays active until its purge time or the dedup window runs out.
+*
+*      The table is open addressing with linear probing, sized at create
+*      time. Keys, bodies and location sets are interned (intern.c): a
+*      probe compares key pointers, every alert for the same area shares
+*      one location set, and observing a relay of a known alert never
+*      allocates. Only a new alert interns its strings.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include "easproc.h"
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+struct eas_alert_table
+{
+	struct eas_alert *slots;
+	unsigned int mask;                    // capacity - 1, capacity a power of 2
+	int count;
+	double window;                        // minimum time an alert stays active
+	struct eas_alert_stats stats;
+};
+
+int eas_alert_key_len(const char *body)
+{
+	const char *p, *q;
+
+	// "-ORG-EEE-PSSCCC-...+TTTT-JJJHHMM-LLLLLLLL-": keep through JJJHHMM-
+	if(!(p = strchr(body, '+')) || !(p = strchr(p, '-')) || !(q = strchr(p + 1, '-')))
+		return (int)strlen(body);
+
+	return (int)(q - body + 1);
+}
+
+static double purge_seconds(const char *body)
+{
+	const char *p;
+	int hh, mm;
+
+	if(!(p = strchr(body, '+')) || sscanf(p + 1, "%2d%2d", &hh, &mm) != 2)
+		return 0;
+
+	return hh * 3600.0 + mm * 60.0;
+}
+
+struct eas_alert_table *eas_alerts_create(int capacity, double window)
+{
+	struct eas_alert_table *t;
+	unsigned int cap = 16;
+
+	while(cap < (unsigned int)capacity * 2)
+		cap <<= 1;
+
+	if(!(t = eas_malloc(NULL, sizeof(*t))))
+		return 0;
+
+	memset(t, 0, sizeof(*t));
+
+	if(!(t->slots = eas_malloc(NULL, cap * sizeof(t->slots[0]))))
+	{
+		eas_free(NULL, t);
+		return 0;
+	}
+
+	memset(t->slots, 0, cap * sizeof(t->slots[0]));
+	t->mask = cap - 1;
+	t->window = window;
+
+	return t;
+}
+
+static void alert_release(struct eas_alert *a)
+{
+	eas_intern_release(a->key);
+	eas_intern_release(a->body);
+	eas_intern_release(a->locations);
+}
+
+void eas_alerts_destroy(struct eas_alert_table *t)
+{
+	unsigned int i;
+
+	if(!t)
+		return;
+
+	for(i = 0; i <= t->mask; i++)
+	{
+		if(t->slots[i].used)
+			alert_release(&t->slots[i]);
+	}
+
+	eas_free(NULL, t->slots);
+	eas_free(NULL, t);
+}
+
+// the slot holding key, or the empty slot ending its probe chain; keys
+// in the table are interned, so equal keys are the same pointer
+static struct eas_alert *alert_find(struct eas_alert_table *t, const char *key, unsigned int h)
+{
+	struct eas_alert *a;
+	unsigned int i;
+
+	for(i = h & t->mask; ; i = (i + 1) & t->mask)
+	{
+		a = &t->slots[i];
+
+		if(!a->used || a->key == key)
+			return a;
+	}
+}
+
+// a key that was never interned belongs to no alert
+static struct eas_alert *alert_lookup(struct eas_alert_table *t, const char *body, const char **key)
+{
+	static struct eas_alert none;
+
+	if(!(*key = eas_intern_find(body, eas_alert_key_len(body))))
+		return &none;
+
+	return alert_find(t, *key, eas_intern_hash(*key));
+}
+
+const struct eas_alert *eas_alerts_observe(struct eas_alert_table *t, const char *body, int stream, double now, int *is_new)
+{
+	struct eas_alert *a;
+	const char *key;
+
+	t->stats.observed++;
+	a = alert_lookup(t, body, &key);
+
+	if(a->used)
+	{
+		t->stats.duplicates++;
+		a->relays++;
+		a->last_seen = now;
+		a->last_stream = stream;
+		*is_new = 0;
+		return a;
+	}
+
+	// keep the load factor at or below one half
+	if((unsigned int)(t->count + 1) * 2 > t->mask + 1)
+	{
+		t->stats.overflows++;
+		*is_new = 1;
+		return 0;
+	}
+
+	if(!(key = eas_intern(body, eas_alert_key_len(body))))
+	{
+		t->stats.overflows++;
+		*is_new = 1;
+		return 0;
+	}
+
+	a = alert_find(t, key, eas_intern_hash(key));
+	memset(a, 0, sizeof(*a));
+	a->used = 1;
+	a->hash = eas_intern_hash(key);
+	a->key_len = eas_intern_len(key);
+	a->key = key;
+	a->body = eas_intern(body, (int)strlen(body));
+	a->locations = eas_intern_locations(body);
+	a->first_seen = a->last_seen = now;
+	a->expires = now + MAX(t->window, purge_seconds(body));
+	a->relays = 1;
+	a->first_stream = a->last_stream = stream;
+
+	t->count++;
+	t->stats.inserted++;
+	*is_new = 1;
+	return a;
+}
+
+void eas_alerts_end(struct eas_alert_table *t, const char *body, double now)
+{
+	struct eas_alert *a;
+	const char *key;
+
+	a = alert_lookup(t, body, &key);
+	if(a->used && !a->ended)
+	{
+		a->ended = 1;
+		a->ended_at = now;
+	}
+}
+
+static void alert_remove(struct eas_alert_table *t, unsigned int i)
+{
+	unsigned int j, k;
+
+	// backward-shift deletion keeps probe chains intact without tombstones
+	alert_release(&t->slots[i]);
+	t->slots[i].used = 0;
+	t->count--;
+
+	for(j = (i + 1) & t->mask; t->slots[j].used; j = (j + 1) & t->mask)
+	{
+		k = t->slots[j].hash & t->mask;
+
+		if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			t->slots[i] = t->slots[j];
+			t->slots[j].used = 0;
+			i = j;
+		}
+	}
+}
+
+int eas_alerts_expire(struct eas_alert_table *t, double now)
+{
+	unsigned int i = 0;
+	int n = 0;
+
+	while(i <= t->mask)
+	{
+		if(t->slots[i].used && t->slots[i].expires <= now)
+		{
+			// the slot may be refilled by a shifted entry; look at it again
+			alert_remove(t, i);
+			t->stats.expired++;
+			n++;
+			continue;
+		}
+
+		i++;
+	}
+
+	return n;
+}
+
+int eas_alerts_count(const struct eas_alert_table *t)
+{
+	return t->count;
+}
+
+void eas_alerts_foreach(const struct eas_alert_table *t, void (*fn)(const struct eas_alert *a, void *ctx), void *ctx)
+{
+	unsigned int i;
+
+	for(i = 0; i <= t->mask; i++)
+	{
+		if(t->slots[i].used)
+			fn(&t->slots[i], ctx);
+	}
+}
+
+void eas_alerts_stats(const struct eas_alert_table *t, struct eas_alert_stats *st)
+{
+	*st = t->stats;
+}
@@ -0,0 +1,181 @@
+/*
+*      batch.c -- per-stream eas_push() vs eas_push_batch() benchmark
+*
+*      Many low-rate streams each receive a tiny block per round. The
+*      per-stream path makes one eas_push() call per stream per round; the
+*      batched path hands one or more rounds of every stream to a single
+*      eas_push_batch() call. Both decode the same audio and must vote the
+*      same alerts.
+*
+*      eas-decode batch [-n streams] [-b block_samples] [-r rounds_per_batch]
+*                       [-t seconds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <time.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+struct batch_bench
+{
+	int nstreams;
+	int block;
+	int rounds;
+	short *audio;                         // one transmission, wrapped by block samples
+	int audio_len;
+	unsigned long votes;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void batch_event(const struct eas_event *ev, void *ctx)
+{
+	struct batch_bench *bb = ctx;
+
+	if(ev->type == EAS_EVENT_START)
+		bb->votes++;
+}
+
+static const short *batch_block(const struct batch_bench *bb, int stream, int round)
+{
+	// streams start at scattered points of the same transmission
+	return bb->audio + ((long long)stream * 7919 + (long long)round * bb->block) % bb->audio_len;
+}
+
+static double batch_run(struct batch_bench *bb, int per_batch)
+{
+	eas_stream **s;
+	struct eas_block *blocks;
+	double t;
+	int i, r, k, n;
+
+	s = malloc(bb->nstreams * sizeof(*s));
+	blocks = malloc((size_t)bb->nstreams * MAX(per_batch, 1) * sizeof(*blocks));
+
+	for(i = 0; i < bb->nstreams; i++)
+	{
+		s[i] = eas_open(i);
+		eas_set_event_handler(s[i], batch_event, bb);
+	}
+
+	bb->votes = 0;
+	t = now_sec();
+
+	if(!per_batch)
+	{
+		for(r = 0; r < bb->rounds; r++)
+		{
+			for(i = 0; i < bb->nstreams; i++)
+				eas_push(s[i], batch_block(bb, i, r), bb->block);
+		}
+	}
+	else
+	{
+		for(r = 0; r < bb->rounds; r += per_batch)
+		{
+			// arrival order: round by round, stream by stream
+			for(n = 0, k = r; k < r + per_batch && k < bb->rounds; k++)
+			{
+				for(i = 0; i < bb->nstreams; i++, n++)
+				{
+					blocks[n].s = s[i];
+					blocks[n].samples = batch_block(bb, i, k);
+					blocks[n].count = bb->block;
+				}
+			}
+
+			eas_push_batch(blocks, n);
+		}
+	}
+
+	t = now_sec() - t;
+
+	for(i = 0; i < bb->nstreams; i++)
+		eas_close(s[i]);
+
+	free(blocks);
+	free(s);
+	return t;
+}
+
+int batch_main(int argc, char **argv)
+{
+	struct batch_bench bb;
+	double seconds = 15.0, base, t, samples;
+	unsigned long base_votes;
+	short *tx;
+	int opt, per_batch = 0, count, i, nsweep = 3;
+	int sweep[3] = { 1, 4, 16 };
+
+	memset(&bb, 0, sizeof(bb));
+	bb.nstreams = 1000;
+	bb.block = 16;
+
+	while((opt = getopt(argc, argv, "n:b:r:t:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n': bb.nstreams = atoi(optarg); break;
+		case 'b': bb.block = atoi(optarg); break;
+		case 'r': per_batch = atoi(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: batch [-n streams] [-b block_samples] [-r rounds_per_batch] [-t seconds]\n");
+			return 1;
+		}
+	}
+
+	if(bb.nstreams < 1 || bb.block < 1 || per_batch < 0 || seconds <= 0)
+		return 1;
+
+	if(per_batch)
+	{
+		sweep[0] = per_batch;
+		nsweep = 1;
+	}
+
+	count = encode_samples("ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-", &tx);
+	if(bb.block > count)
+		return 1;
+
+	// blocks may run past the end; repeat the start there
+	bb.audio_len = count;
+	bb.audio = malloc((count + bb.block) * sizeof(short));
+	memcpy(bb.audio, tx, count * sizeof(short));
+	memcpy(bb.audio + count, tx, bb.block * sizeof(short));
+	free(tx);
+
+	bb.rounds = (int)(seconds * FREQ_SAMP / bb.block);
+	samples = (double)bb.rounds * bb.block * bb.nstreams;
+
+	printf("%d streams, %d-sample blocks, %d rounds (%.1f s per stream)\n",
+		bb.nstreams, bb.block, bb.rounds, (double)bb.rounds * bb.block / FREQ_SAMP);
+
+	base = batch_run(&bb, 0);
+	base_votes = bb.votes;
+	printf("per-stream        %8.3f s  %6.2f ns/sample  %lu votes\n", base, base * 1e9 / samples, base_votes);
+
+	for(i = 0; i < nsweep; i++)
+	{
+		t = batch_run(&bb, sweep[i]);
+		printf("batch %3d rounds  %8.3f s  %6.2f ns/sample  %lu votes  %.2fx%s\n",
+			sweep[i], t, t * 1e9 / samples, bb.votes, base / t, bb.votes == base_votes ? "" : "  MISMATCH");
+	}
+
+	free(bb.audio);
+	return 0;
+}
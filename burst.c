@@ -0,0 +1,451 @@
+/*
+*      burst.c -- archive burst decoding with the copies on separate cores
+*
+*      Every SAME transmission sends its header, and later its end of
+*      message, three times with a one-second gap between copies. In an
+*      archive the whole clip is at hand, so once the copies are located
+*      they need not be demodulated one after another.
+*
+*      Copies are located by the decoder itself: one pass over the clip on
+*      a cheap engine (gated by default, which skips most of the audio
+*      that carries no FSK) reports where each header or EOM copy framed.
+*      A copy spans the encoder's frame, 2 preamble bytes, ZCZC or NNNN and
+*      the body at 520.83 baud (an EOM copy is 6 bytes, about 92 ms), and
+*      ends about a byte before the decoder reports it. A quarter second
+*      on each side is decoded with it, enough for the one-bit engine to
+*      find its sync in noise. Copies one gap apart form a burst.
+*      Program audio, noise and attention tones rarely frame. A stray copy
+*      that does is dropped unless it decodes again as the kind it was
+*      located as, and one outside any burst's spacing is a burst of its
+*      own, which two copies can never agree on.
+*
+*      The copies of every burst are then demodulated again, each on a
+*      fresh stream with the chosen engine, by a pool of workers forked
+*      before the clock starts: a round hands out the copies through a
+*      shared counter and waits for every worker to report back over a
+*      pipe. A copy that does not decode is dropped, and each burst is
+*      voted from the copies that did, character by character (two must
+*      agree). For comparison the copies are also decoded one after another
+*      in process, and the clip is streamed through one decoder as usual;
+*      the burst votes must match the streamed ones.
+*
+*      Break-even: a round costs the pool under 0.1 ms of wakeups and
+*      pipe traffic on top of the decode (measured with -r 200 on one
+*      core), while a header copy with its padding takes about 1 ms on
+*      the full engine and an EOM copy about 0.5 ms. On k cores a round
+*      of d ms takes about d / k + 0.1, which wins once d exceeds
+*      0.1 * k / (k - 1) ms: 0.2 ms on two cores, so even a single burst
+*      is worth spreading. On one core the pool can only lose that 0.1 ms.
+*
+*      eas-decode burst [-e engine] [-l locate_engine] [-j jobs] [-r repeats] file.raw
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define BURST_BAUD 520.83                 // encoder symbol rate, in Hz
+#define BURST_BYTE (8 * FREQ_SAMP / BURST_BAUD)  // samples per byte
+#define BURST_LEAD 6                      // preamble bytes and ZCZC or NNNN
+#define BURST_LATE 2                      // bytes framing may run past a copy
+#define BURST_PAD (FREQ_SAMP / 4)        // decoded on each side of a copy
+#define BURST_GAP FREQ_SAMP               // silence between copies
+#define BURST_JITTER (FREQ_SAMP / 4)      // allowed error in the copy spacing
+#define BURST_BLOCK (FREQ_SAMP / 50)      // samples per push
+#define BURST_COPIES 3
+#define BURST_MAX_COPIES 768
+#define BURST_MAX_JOBS 64
+#define BURST_MSG 300
+
+enum
+{
+	BURST_HEADER = 1,
+	BURST_EOM = 2,
+};
+
+struct burst_copy
+{
+	size_t start;                         // samples, padding included
+	size_t end;
+	size_t framed;                        // where the locating pass framed it
+	size_t len;                           // the copy's frame, samples
+	int kind;                             // located as BURST_HEADER or BURST_EOM
+	int got;                              // decoded as BURST_HEADER or BURST_EOM, 0 = not
+	char message[BURST_MSG];
+};
+
+// shared with the workers
+struct burst_work
+{
+	unsigned int next;                    // next copy to take
+	unsigned int ncopies;
+	struct burst_copy copies[BURST_MAX_COPIES];
+};
+
+struct burst_pool
+{
+	int jobs;
+	int go[2];                            // one byte per worker starts a round
+	int done[2];                          // one byte back when it runs dry
+	pid_t pids[BURST_MAX_JOBS];
+};
+
+struct burst_vote
+{
+	int n;
+	char body[BURST_MAX_COPIES / BURST_COPIES + 1][BURST_MSG];
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int burst_engine(const char *name)
+{
+	int engine;
+
+	for(engine = 0; engine < EAS_ENGINE_COUNT && strcmp(name, eas_engine_name(engine)); engine++)
+		;
+
+	return engine;
+}
+
+static void burst_stream(const short *audio, size_t count, int engine, eas_event_fn fn, void *ctx)
+{
+	eas_stream *s;
+	size_t pos;
+
+	if(!(s = eas_open(0)))
+		return;
+
+	eas_set_engine(s, engine);
+	eas_set_event_handler(s, fn, ctx);
+
+	for(pos = 0; pos < count; pos += BURST_BLOCK)
+		eas_push(s, audio + pos, (int)MIN(BURST_BLOCK, count - pos));
+
+	eas_close(s);
+}
+
+// the locating pass: a copy for every header or EOM copy that frames
+static void locate_event(const struct eas_event *ev, void *ctx)
+{
+	struct burst_work *w = ctx;
+	struct burst_copy *c;
+
+	if((ev->type != EAS_EVENT_PART || !ev->message) && ev->type != EAS_EVENT_EOM)
+		return;
+
+	if(w->ncopies >= BURST_MAX_COPIES)
+		return;
+
+	c = &w->copies[w->ncopies++];
+	memset(c, 0, sizeof(*c));
+	c->kind = ev->type == EAS_EVENT_PART ? BURST_HEADER : BURST_EOM;
+	c->framed = ev->offset;
+
+	c->len = (size_t)((BURST_LEAD + (ev->message ? strlen(ev->message) : 0)) * BURST_BYTE);
+
+	c->start = c->framed - MIN(c->framed, c->len + (size_t)(BURST_LATE * BURST_BYTE) + BURST_PAD);
+	c->end = c->framed + BURST_PAD;
+}
+
+static void copy_event(const struct eas_event *ev, void *ctx)
+{
+	struct burst_copy *c = ctx;
+
+	// the first complete copy in the segment is the one
+	if(c->got)
+		return;
+
+	if(ev->type == EAS_EVENT_PART && ev->message)
+	{
+		snprintf(c->message, sizeof(c->message), "ZCZC%s", ev->message);
+		c->got = BURST_HEADER;
+	}
+	else if(ev->type == EAS_EVENT_EOM)
+	{
+		snprintf(c->message, sizeof(c->message), "NNNN");
+		c->got = BURST_EOM;
+	}
+}
+
+static void copy_decode(const short *audio, size_t count, struct burst_copy *c, int engine)
+{
+	c->got = 0;
+	burst_stream(audio + c->start, MIN(c->end, count) - c->start, engine, copy_event, c);
+
+	// a segment that decodes as something else is no copy of its burst
+	if(c->got != c->kind)
+		c->got = 0;
+}
+
+static void pool_work(struct burst_pool *p, struct burst_work *w, const short *audio, size_t count, int engine)
+{
+	unsigned int i;
+	char cmd;
+
+	close(p->go[1]);
+	close(p->done[0]);
+
+	while(read(p->go[0], &cmd, 1) == 1 && cmd == 'g')
+	{
+		while((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_ACQ_REL)) < w->ncopies)
+			copy_decode(audio, count, &w->copies[i], engine);
+
+		if(write(p->done[1], "d", 1) != 1)
+			break;
+	}
+
+	_exit(0);
+}
+
+static int pool_start(struct burst_pool *p, struct burst_work *w, const short *audio, size_t count, int engine)
+{
+	int j;
+
+	if(pipe(p->go) < 0 || pipe(p->done) < 0)
+	{
+		perror("pipe");
+		return -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for(j = 0; j < p->jobs; j++)
+	{
+		if((p->pids[j] = fork()) < 0)
+		{
+			perror("fork");
+			return -1;
+		}
+
+		if(!p->pids[j])
+			pool_work(p, w, audio, count, engine);
+	}
+
+	close(p->go[0]);
+	close(p->done[1]);
+	return 0;
+}
+
+// every copy decoded once by whichever worker takes it
+static int pool_round(struct burst_pool *p, struct burst_work *w)
+{
+	char buf[BURST_MAX_JOBS];
+	int j, n;
+
+	__atomic_store_n(&w->next, 0, __ATOMIC_RELEASE);
+
+	memset(buf, 'g', p->jobs);
+	if(write(p->go[1], buf, p->jobs) != p->jobs)
+		return -1;
+
+	for(j = 0; j < p->jobs; j += n)
+	{
+		if((n = read(p->done[0], buf, p->jobs - j)) <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void pool_stop(struct burst_pool *p)
+{
+	int j;
+
+	// workers see end of file on the go pipe
+	close(p->go[1]);
+	close(p->done[0]);
+
+	for(j = 0; j < p->jobs; j++)
+		waitpid(p->pids[j], 0, 0);
+}
+
+// two decoded copies must agree on every character, the end included,
+// as the stream's own vote requires
+static int burst_vote(struct burst_copy *c, int n, char *out)
+{
+	int i, k, len, agree;
+	char ch;
+
+	for(len = 0; len < BURST_MSG; len++)
+	{
+		for(k = 0; k < n; k++)
+		{
+			if(!c[k].got)
+				continue;
+
+			ch = len < (int)strlen(c[k].message) ? c[k].message[len] : 0;
+			for(agree = 0, i = 0; i < n; i++)
+				agree += c[i].got && (len < (int)strlen(c[i].message) ? c[i].message[len] : 0) == ch;
+
+			if(agree >= 2)
+				break;
+		}
+
+		if(k == n)
+			return -1;
+
+		if(!(out[len] = ch))
+			return 0;
+	}
+
+	return -1;
+}
+
+static void burst_stream_event(const struct eas_event *ev, void *ctx)
+{
+	struct burst_vote *v = ctx;
+
+	if(ev->type == EAS_EVENT_START && v->n < (int)(sizeof(v->body) / sizeof(v->body[0])))
+		snprintf(v->body[v->n++], BURST_MSG, "ZCZC%s", ev->message);
+}
+
+int burst_main(int argc, char **argv)
+{
+	static struct burst_vote voted, streamed;
+	struct burst_pool pool;
+	struct burst_work *w;
+	struct burst_copy *c;
+	struct stat st;
+	const short *audio;
+	char vote[BURST_MSG];
+	double t, t_locate, t_seq = 0, t_pool = 0, t_stream;
+	size_t count, period;
+	unsigned int i;
+	int opt, fd, g, n, k, r, decoded, repeats = 5, engine = EAS_ENGINE_FULL, locator = EAS_ENGINE_GATED, mismatch;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.jobs = (int)MIN(sysconf(_SC_NPROCESSORS_ONLN), BURST_COPIES);
+
+	while((opt = getopt(argc, argv, "e:l:j:r:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'e': engine = burst_engine(optarg); break;
+		case 'l': locator = burst_engine(optarg); break;
+		case 'j': pool.jobs = atoi(optarg); break;
+		case 'r': repeats = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if(optind + 1 != argc || engine >= EAS_ENGINE_COUNT || locator >= EAS_ENGINE_COUNT || repeats < 1 ||
+		pool.jobs < 1 || pool.jobs > BURST_MAX_JOBS)
+		goto usage;
+
+	if((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(short) ||
+		(audio = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	close(fd);
+	count = st.st_size / sizeof(short);
+
+	// copies and results are shared with the workers
+	w = mmap(0, sizeof(*w), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(w == MAP_FAILED)
+		return 1;
+
+	t_locate = now_sec();
+	burst_stream(audio, count, locator, locate_event, w);
+	t_locate = now_sec() - t_locate;
+
+	// the decoder tables are built by now, so the workers share them
+	if(pool_start(&pool, w, audio, count, engine) < 0)
+		return 1;
+
+	for(r = 0; r < repeats; r++)
+	{
+		// one after another, in process
+		t = now_sec();
+		for(i = 0; i < w->ncopies; i++)
+			copy_decode(audio, count, &w->copies[i], engine);
+		t_seq += now_sec() - t;
+
+		// all at once, on the pool
+		t = now_sec();
+		if(pool_round(&pool, w) < 0)
+		{
+			perror("burst pool");
+			pool_stop(&pool);
+			return 1;
+		}
+		t_pool += now_sec() - t;
+	}
+
+	pool_stop(&pool);
+
+	for(g = 0; g < (int)w->ncopies; g += n)
+	{
+		// copies of one kind within three copies and two gaps of the
+		// first are a burst; a weak signal may frame a copy late, so the
+		// spacing inside it is not relied on
+		c = &w->copies[g];
+		period = c->len + BURST_GAP;
+		for(n = 1; g + n < (int)w->ncopies && n < BURST_COPIES; n++)
+		{
+			if(w->copies[g + n].kind != c->kind || w->copies[g + n].framed > c->framed + (BURST_COPIES - 1) * period + BURST_JITTER)
+				break;
+		}
+
+		for(decoded = k = 0; k < n; k++)
+			decoded += w->copies[g + k].got != 0;
+
+		if(burst_vote(&w->copies[g], n, vote) < 0)
+		{
+			printf("%8.2f s  %d of %d copies decoded  no vote\n", (double)w->copies[g].framed / FREQ_SAMP, decoded, n);
+			continue;
+		}
+
+		printf("%8.2f s  %d of %d copies decoded  %s\n", (double)w->copies[g].framed / FREQ_SAMP, decoded, n, vote);
+		if(w->copies[g].kind == BURST_HEADER && voted.n < (int)(sizeof(voted.body) / sizeof(voted.body[0])))
+			strcpy(voted.body[voted.n++], vote);
+	}
+
+	// the reference: the whole clip through one stream
+	t_stream = now_sec();
+	burst_stream(audio, count, engine, burst_stream_event, &streamed);
+	t_stream = now_sec() - t_stream;
+
+	mismatch = voted.n != streamed.n;
+	for(k = 0; !mismatch && k < voted.n; k++)
+		mismatch = strcmp(voted.body[k], streamed.body[k]) != 0;
+
+	printf("%u copies located (%s, %.3f ms); %d headers voted, streamed decode voted %d%s\n", w->ncopies,
+		eas_engine_name(locator), t_locate * 1000.0, voted.n, streamed.n, mismatch ? "  MISMATCH" : "");
+	printf("copies decoded (%s): %.3f ms one after another, %.3f ms on %d workers (%ld cpus); whole clip streamed %.3f ms\n",
+		eas_engine_name(engine), t_seq * 1000.0 / repeats, t_pool * 1000.0 / repeats, pool.jobs,
+		sysconf(_SC_NPROCESSORS_ONLN), t_stream * 1000.0);
+
+	munmap(w, sizeof(*w));
+	munmap((void *)audio, st.st_size);
+	return mismatch ? 2 : 0;
+
+usage:
+	fprintf(stderr, "usage: burst [-e engine] [-l locate_engine] [-j jobs] [-r repeats] file.raw\n"
+		"  engines: full, gated, decimated, onebit\n");
+	return 1;
+}
@@ -0,0 +1,325 @@
+/*
+*      coldstart.c -- process start to first sample and first alert
+*
+*      Short archive jobs pay process startup and decoder setup every
+*      time. This forks and execs a fresh copy of eas-decode per run, and
+*      the child stamps each phase on the shared monotonic clock:
+*
+*        exec    fork() in the parent to main() in the child
+*        init    first eas_open(), which builds the shared tables
+*        open    the remaining streams
+*        sample  first block pushed through every stream
+*        alert   first START event, input fed round-robin as fast as
+*                the decoder takes it
+*        exit    the child reaped by the parent
+*
+*      Every phase is measured from the fork. The input is a short lead-in
+*      of program noise and one transmission, mapped from a scratch file as
+*      an archive job would read it. Medians and worst cases over the runs
+*      are printed per stream count and engine. The decoder takes 22050 Hz
+*      input only, so configurations vary streams and engines, not rates.
+*
+*      eas-decode coldstart [-n streams[,streams...]] [-e engine|all]
+*                           [-r runs] [-b block_samples]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define COLD_LEAD (FREQ_SAMP / 2)         // program noise before the alert, samples
+#define COLD_MAX_CONFIGS 8
+#define COLD_MAX_RUNS 100
+
+enum
+{
+	COLD_EXEC,
+	COLD_INIT,
+	COLD_OPEN,
+	COLD_SAMPLE,
+	COLD_ALERT,
+	COLD_EXIT,
+	COLD_PHASES,
+};
+
+static const char *cold_names[COLD_PHASES] = { "exec", "init", "open", "sample", "alert", "exit" };
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void cold_event(const struct eas_event *ev, void *ctx)
+{
+	int *voted = ctx;
+
+	if(ev->type == EAS_EVENT_START)
+		*voted = 1;
+}
+
+// the measured process: stamps its phases and prints them for the parent
+static int cold_child(double t0, const char *path, int nstreams, int engine, int block)
+{
+	double t[COLD_PHASES] = { 0 };
+	eas_stream **s;
+	const short *audio = 0;
+	struct stat st;
+	int fd, i, count, pos, voted = 0;
+
+	t[COLD_EXEC] = now_sec();
+
+	// an empty clip maps nothing; its sample and alert phases never happen
+	if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ||
+		(st.st_size && (audio = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+		return 1;
+	close(fd);
+	count = st.st_size / sizeof(short);
+
+	if(!(s = calloc(nstreams, sizeof(*s))))
+		return 1;
+
+	for(i = 0; i < nstreams; i++)
+	{
+		if(!(s[i] = eas_open(i)))
+			return 1;
+
+		eas_set_engine(s[i], engine);
+		eas_set_event_handler(s[i], cold_event, &voted);
+
+		if(!i)
+			t[COLD_INIT] = now_sec();
+	}
+	t[COLD_OPEN] = now_sec();
+
+	for(pos = 0; !voted && pos < count; pos += block)
+	{
+		for(i = 0; i < nstreams; i++)
+			eas_push(s[i], audio + pos, MIN(block, count - pos));
+
+		if(!pos)
+			t[COLD_SAMPLE] = now_sec();
+	}
+	t[COLD_ALERT] = voted ? now_sec() : 0;
+
+	// a phase that never happened (no samples, no alert) reports -1
+	for(i = COLD_EXEC; i <= COLD_ALERT; i++)
+		t[i] = t[i] > 0 ? t[i] - t0 : -1.0;
+
+	// no teardown: a job that is done just exits
+	printf("%.9f %.9f %.9f %.9f %.9f\n", t[COLD_EXEC], t[COLD_INIT], t[COLD_OPEN], t[COLD_SAMPLE], t[COLD_ALERT]);
+	return 0;
+}
+
+static int cold_run(const char *path, int nstreams, int engine, int block, double *t)
+{
+	char a_t0[32], a_n[16], a_e[16], a_b[16], line[256];
+	char *args[] = { "eas-decode", "coldstart", "-C", a_t0, "-n", a_n, "-e", a_e, "-b", a_b, (char *)path, 0 };
+	int fds[2], status, n, got = 0;
+	double t0;
+	pid_t pid;
+
+	snprintf(a_n, sizeof(a_n), "%d", nstreams);
+	snprintf(a_e, sizeof(a_e), "%s", eas_engine_name(engine));
+	snprintf(a_b, sizeof(a_b), "%d", block);
+
+	if(pipe(fds) < 0)
+		return -1;
+
+	fflush(stdout);
+	t0 = now_sec();
+	snprintf(a_t0, sizeof(a_t0), "%.9f", t0);
+
+	if((pid = fork()) < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if(!pid)
+	{
+		dup2(fds[1], 1);
+		close(fds[0]);
+		close(fds[1]);
+		execv("/proc/self/exe", args);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	while((n = read(fds[0], line + got, sizeof(line) - 1 - got)) > 0)
+		got += n;
+	close(fds[0]);
+
+	waitpid(pid, &status, 0);
+	t[COLD_EXIT] = now_sec() - t0;
+	line[got] = 0;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) ||
+		sscanf(line, "%lf %lf %lf %lf %lf", &t[COLD_EXEC], &t[COLD_INIT], &t[COLD_OPEN], &t[COLD_SAMPLE], &t[COLD_ALERT]) != 5)
+	{
+		fprintf(stderr, "coldstart: child failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// lead-in of program noise, then one transmission
+static int cold_input(char *path)
+{
+	short *tx, *audio;
+	int fd, n, i;
+
+	if((fd = mkstemp(path)) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+
+	n = encode_samples("ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-", &tx);
+	if(!(audio = malloc((COLD_LEAD + n) * sizeof(short))))
+		return -1;
+
+	srand(1);
+	for(i = 0; i < COLD_LEAD; i++)
+		audio[i] = (short)(rand() % 2001 - 1000);
+	memcpy(audio + COLD_LEAD, tx, n * sizeof(short));
+
+	n = write(fd, audio, (COLD_LEAD + n) * sizeof(short)) < 0 ? -1 : 0;
+	close(fd);
+	free(audio);
+	free(tx);
+	return n;
+}
+
+static int cold_engine(const char *name)
+{
+	int engine;
+
+	for(engine = 0; engine < EAS_ENGINE_COUNT && strcmp(name, eas_engine_name(engine)); engine++)
+		;
+
+	return engine;
+}
+
+int coldstart_main(int argc, char **argv)
+{
+	char path[] = "/tmp/eas-coldstart-XXXXXX", *p;
+	double t[COLD_MAX_RUNS][COLD_PHASES], v[COLD_MAX_RUNS], t0 = -1;
+	const char *engines = "full";
+	int nconfigs = 0, streams[COLD_MAX_CONFIGS];
+	int opt, runs = 5, block = FREQ_SAMP / 50, engine, c, r, k, ret = 0;
+
+	while((opt = getopt(argc, argv, "n:e:r:b:C:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			for(nconfigs = 0, p = optarg; p && nconfigs < COLD_MAX_CONFIGS; p = strchr(p, ','), p = p ? p + 1 : 0)
+				streams[nconfigs++] = atoi(p);
+			break;
+		case 'e': engines = optarg; break;
+		case 'r': runs = atoi(optarg); break;
+		case 'b': block = atoi(optarg); break;
+		case 'C': t0 = atof(optarg); break;   // internal: we are the measured child
+		default:
+			fprintf(stderr, "usage: coldstart [-n streams[,streams...]] [-e full|gated|decimated|onebit|all] "
+				"[-r runs] [-b block_samples]\n");
+			return 1;
+		}
+	}
+
+	if(!nconfigs)
+	{
+		streams[0] = 1;
+		streams[1] = 100;
+		streams[2] = 1000;
+		nconfigs = 3;
+	}
+
+	if(block < 1 || runs < 1 || runs > COLD_MAX_RUNS)
+		return 1;
+
+	for(c = 0; c < nconfigs; c++)
+	{
+		if(streams[c] < 1)
+			return 1;
+	}
+
+	if(t0 >= 0)
+		return optind < argc ? cold_child(t0, argv[optind], streams[0], cold_engine(engines), block) : 1;
+
+	if(strcmp(engines, "all") && cold_engine(engines) >= EAS_ENGINE_COUNT)
+		return 1;
+
+	if(cold_input(path) < 0)
+		return 1;
+
+	printf("%d runs per configuration, %d-sample blocks; ms from fork, median (worst)\n", runs, block);
+	printf("streams  engine    ");
+	for(k = 0; k < COLD_PHASES; k++)
+		printf("  %-17s", cold_names[k]);
+	printf("\n");
+
+	for(engine = 0; engine < EAS_ENGINE_COUNT && !ret; engine++)
+	{
+		if(strcmp(engines, "all") && engine != cold_engine(engines))
+			continue;
+
+		for(c = 0; c < nconfigs && !ret; c++)
+		{
+			for(r = 0; r < runs; r++)
+			{
+				if(cold_run(path, streams[c], engine, block, t[r]) < 0)
+				{
+					ret = 1;
+					break;
+				}
+			}
+
+			if(ret)
+				break;
+
+			printf("%7d  %-9s ", streams[c], eas_engine_name(engine));
+			for(k = 0; k < COLD_PHASES; k++)
+			{
+				for(r = 0; r < runs; r++)
+					v[r] = t[r][k];
+				qsort(v, runs, sizeof(double), cmp_double);
+
+				if(v[0] < 0)
+					printf("  %-17s", k == COLD_ALERT ? "no alert" : "never");
+				else
+					printf("  %7.2f (%7.2f)", v[runs / 2] * 1000.0, v[runs - 1] * 1000.0);
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	unlink(path);
+	return ret;
+}
@@ -0,0 +1,519 @@
+/*
+*      corpus.c -- indexed clip corpus in one memory-mapped file
+*
+*      Regression and benchmark runs over thousands of short recordings
+*      spend more time in open() and read() than in the decoder. A corpus
+*      packs the clips into one file that is mapped once and iterated in
+*      place: a header, the int16 sample blobs (each aligned to a cache
+*      line), then an index entry per clip and a string table holding clip
+*      names and ground-truth headers. Everything is in host byte order.
+*
+*      Ground truth is the header bodies (after "ZCZC") a clip must vote,
+*      in order. pack takes them from a truth file of "name ZCZC-..." lines
+*      or, without one, from what the full engine votes today, which makes
+*      the corpus a regression baseline for the other engines and for
+*      decoder changes.
+*
+*      eas-decode corpus pack [-t truth] -o out.eac file.raw ...
+*      eas-decode corpus list in.eac
+*      eas-decode corpus check [-e engine] [-b block_samples] in.eac
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define CORPUS_MAGIC "EASCORP1"
+#define CORPUS_VERSION 1
+#define CORPUS_ALIGN 64                   // sample blob alignment, bytes
+#define CORPUS_MAX_TRUTH 16               // headers per clip
+#define CORPUS_MAX_BODY 272
+
+struct corpus_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int rate;
+	unsigned int nclips;
+	unsigned int pad;
+	unsigned long long index;             // offset of the entries
+	unsigned long long strings;           // offset of the string table
+	unsigned long long size;              // file size
+};
+
+struct corpus_entry
+{
+	unsigned long long offset;            // of the samples
+	unsigned long long count;             // samples
+	unsigned int name;                    // offsets in the string table
+	unsigned int truth;                   // ntruth NUL-terminated header bodies
+	unsigned int ntruth;
+	unsigned int pad;
+};
+
+struct eas_corpus
+{
+	const char *map;
+	size_t size;
+	const struct corpus_header *hdr;
+	const struct corpus_entry *entries;
+	const char *strings;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int eas_corpus_probe(const char *path)
+{
+	char magic[8];
+	int fd, n;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	n = read(fd, magic, sizeof(magic));
+	close(fd);
+
+	return n == sizeof(magic) && !memcmp(magic, CORPUS_MAGIC, sizeof(magic));
+}
+
+// every offset is checked once here so iteration needs no checks at all
+static int corpus_valid(const struct eas_corpus *c)
+{
+	const struct corpus_header *h = c->hdr;
+	const struct corpus_entry *e;
+	unsigned long long nstr;
+	unsigned int i, k, off;
+
+	if(c->size < sizeof(*h) || memcmp(h->magic, CORPUS_MAGIC, sizeof(h->magic)) || h->version != CORPUS_VERSION ||
+		h->size != c->size || h->index % 8 || h->index > c->size || h->strings > c->size ||
+		(c->size - h->index) / sizeof(*e) < h->nclips || h->strings < h->index + (unsigned long long)h->nclips * sizeof(*e))
+		return 0;
+
+	nstr = c->size - h->strings;
+	if(nstr && c->strings[nstr - 1])
+		return 0;
+
+	for(i = 0; i < h->nclips; i++)
+	{
+		e = &c->entries[i];
+		if(e->offset % CORPUS_ALIGN || e->offset > h->index || (h->index - e->offset) / sizeof(short) < e->count ||
+			e->name >= nstr || e->truth > nstr)
+			return 0;
+
+		for(k = 0, off = e->truth; k < e->ntruth; k++, off += strlen(c->strings + off) + 1)
+		{
+			if(off >= nstr)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+struct eas_corpus *eas_corpus_open(const char *path)
+{
+	struct eas_corpus *c;
+	struct stat st;
+	void *p;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(path);
+		if(fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	p = st.st_size ? mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	if(p == MAP_FAILED || !(c = calloc(1, sizeof(*c))))
+	{
+		fprintf(stderr, "%s: cannot map\n", path);
+		if(p != MAP_FAILED)
+			munmap(p, st.st_size);
+		return 0;
+	}
+
+	c->map = p;
+	c->size = st.st_size;
+	c->hdr = p;
+	c->entries = (const struct corpus_entry *)(c->map + MIN(c->hdr->index, c->size));
+	c->strings = c->map + MIN(c->hdr->strings, c->size);
+
+	if(!corpus_valid(c))
+	{
+		fprintf(stderr, "%s: not a valid corpus\n", path);
+		eas_corpus_close(c);
+		return 0;
+	}
+
+	// clips are normally walked front to back
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	return c;
+}
+
+int eas_corpus_count(const struct eas_corpus *c)
+{
+	return (int)c->hdr->nclips;
+}
+
+int eas_corpus_clip(const struct eas_corpus *c, int i, struct eas_clip *clip)
+{
+	const struct corpus_entry *e;
+
+	if(i < 0 || i >= (int)c->hdr->nclips)
+		return -1;
+
+	e = &c->entries[i];
+	clip->name = c->strings + e->name;
+	clip->samples = (const short *)(c->map + e->offset);
+	clip->count = e->count;
+	clip->ntruth = e->ntruth;
+	clip->truth = c->strings + e->truth;
+	return 0;
+}
+
+void eas_corpus_close(struct eas_corpus *c)
+{
+	if(!c)
+		return;
+
+	munmap((void *)c->map, c->size);
+	free(c);
+}
+
+// packing
+
+struct corpus_votes
+{
+	int n;
+	char body[CORPUS_MAX_TRUTH][CORPUS_MAX_BODY];
+	int extra;                            // votes past CORPUS_MAX_TRUTH
+};
+
+static void corpus_event(const struct eas_event *ev, void *ctx)
+{
+	struct corpus_votes *v = ctx;
+
+	if(ev->type != EAS_EVENT_START)
+		return;
+
+	if(v->n < CORPUS_MAX_TRUTH)
+		snprintf(v->body[v->n++], CORPUS_MAX_BODY, "%s", ev->message);
+	else
+		v->extra++;
+}
+
+static void corpus_decode(const short *samples, unsigned long long count, int engine, int block, struct corpus_votes *v)
+{
+	eas_stream *s;
+	unsigned long long pos;
+
+	memset(v, 0, sizeof(*v));
+	if(!(s = eas_open(0)))
+		return;
+
+	eas_set_engine(s, engine);
+	eas_set_event_handler(s, corpus_event, v);
+
+	for(pos = 0; pos < count; pos += block)
+		eas_push(s, samples + pos, (int)MIN((unsigned long long)block, count - pos));
+
+	eas_close(s);
+}
+
+static const char *base_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+// truth lines: "name ZCZC-..." (or the body without ZCZC), in vote order;
+// a body too long to store is an error, not a silently shorter truth
+static int corpus_truth(const char *truth, const char *name, struct corpus_votes *v)
+{
+	FILE *fp;
+	char line[1024], clip[256], *header;
+	int at, len, lineno = 0;
+
+	memset(v, 0, sizeof(*v));
+	if(!(fp = fopen(truth, "r")))
+		return -1;
+
+	while(fgets(line, sizeof(line), fp) && v->n < CORPUS_MAX_TRUTH)
+	{
+		lineno++;
+		if(sscanf(line, "%255s %n", clip, &at) != 1 || strcmp(clip, name))
+			continue;
+
+		header = line + at;
+		if(!strncmp(header, "ZCZC", 4))
+			header += 4;
+
+		if(!(len = (int)strcspn(header, " \t\r\n")))
+			continue;
+
+		if(len >= CORPUS_MAX_BODY)
+		{
+			fprintf(stderr, "%s:%d: header longer than %d characters\n", truth, lineno, CORPUS_MAX_BODY - 1);
+			fclose(fp);
+			errno = EINVAL;
+			return -1;
+		}
+
+		memcpy(v->body[v->n], header, len);
+		v->body[v->n++][len] = 0;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static int corpus_pack(const char *out, const char *truth, char **files, int nfiles)
+{
+	static const char pad[CORPUS_ALIGN];
+	struct corpus_header hdr;
+	struct corpus_entry *entries;
+	struct corpus_votes v;
+	struct stat st;
+	char *strings = 0;
+	short *samples = 0;
+	size_t nstr = 0, cap = 0, len;
+	unsigned long long off, total = 0;
+	FILE *fp;
+	int fd, i, k, ret = 1;
+
+	if(!(fp = fopen(out, "wb")) || !(entries = calloc(nfiles, sizeof(*entries))))
+	{
+		perror(out);
+		return 1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	off = sizeof(hdr);
+
+	for(i = 0; i < nfiles; i++)
+	{
+		if((fd = open(files[i], O_RDONLY)) < 0 || fstat(fd, &st) < 0 ||
+			!(samples = realloc(samples, st.st_size + sizeof(short))) ||
+			read(fd, samples, st.st_size) != st.st_size)
+		{
+			perror(files[i]);
+			goto done;
+		}
+		close(fd);
+
+		// blobs start on a cache line
+		fwrite(pad, 1, (CORPUS_ALIGN - off % CORPUS_ALIGN) % CORPUS_ALIGN, fp);
+		off += (CORPUS_ALIGN - off % CORPUS_ALIGN) % CORPUS_ALIGN;
+
+		entries[i].offset = off;
+		entries[i].count = st.st_size / sizeof(short);
+		fwrite(samples, sizeof(short), entries[i].count, fp);
+		off += entries[i].count * sizeof(short);
+		total += entries[i].count;
+
+		if(truth ? corpus_truth(truth, base_name(files[i]), &v) < 0 :
+			(corpus_decode(samples, entries[i].count, EAS_ENGINE_FULL, FREQ_SAMP, &v), 0))
+		{
+			perror(truth);
+			goto done;
+		}
+
+		// name, then the truth bodies
+		len = strlen(base_name(files[i])) + 1;
+		for(k = 0; k < v.n; k++)
+			len += strlen(v.body[k]) + 1;
+
+		if(nstr + len > cap)
+		{
+			cap = (nstr + len) * 2;
+			if(!(strings = realloc(strings, cap)))
+				goto done;
+		}
+
+		entries[i].name = (unsigned int)nstr;
+		strcpy(strings + nstr, base_name(files[i]));
+		nstr += strlen(base_name(files[i])) + 1;
+
+		entries[i].truth = (unsigned int)nstr;
+		entries[i].ntruth = v.n;
+		for(k = 0; k < v.n; k++)
+		{
+			strcpy(strings + nstr, v.body[k]);
+			nstr += strlen(v.body[k]) + 1;
+		}
+	}
+
+	fwrite(pad, 1, (8 - off % 8) % 8, fp);
+	off += (8 - off % 8) % 8;
+
+	memcpy(hdr.magic, CORPUS_MAGIC, sizeof(hdr.magic));
+	hdr.version = CORPUS_VERSION;
+	hdr.rate = FREQ_SAMP;
+	hdr.nclips = nfiles;
+	hdr.index = off;
+	hdr.strings = off + (unsigned long long)nfiles * sizeof(*entries);
+	hdr.size = hdr.strings + nstr;
+
+	fwrite(entries, sizeof(*entries), nfiles, fp);
+	fwrite(strings, 1, nstr, fp);
+
+	// the header goes in last so a torn write is never a valid corpus
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	if(fflush(fp) || ferror(fp))
+	{
+		perror(out);
+		goto done;
+	}
+
+	printf("%s: %d clips, %.1f s audio, %.1f MB\n", out, nfiles, (double)total / FREQ_SAMP, hdr.size / 1e6);
+	ret = 0;
+
+done:
+	fclose(fp);
+	free(entries);
+	free(strings);
+	free(samples);
+	return ret;
+}
+
+static int corpus_list(const char *path)
+{
+	struct eas_corpus *c;
+	struct eas_clip clip;
+	const char *t;
+	int i, k;
+
+	if(!(c = eas_corpus_open(path)))
+		return 1;
+
+	for(i = 0; i < eas_corpus_count(c); i++)
+	{
+		eas_corpus_clip(c, i, &clip);
+		printf("%-32s %8.2f s  %d header%s\n", clip.name, (double)clip.count / FREQ_SAMP, clip.ntruth, clip.ntruth == 1 ? "" : "s");
+
+		for(k = 0, t = clip.truth; k < clip.ntruth; k++, t += strlen(t) + 1)
+			printf("    ZCZC%s\n", t);
+	}
+
+	eas_corpus_close(c);
+	return 0;
+}
+
+// decode every clip in place and compare its votes with the ground truth
+static int corpus_check(const char *path, int engine, int block)
+{
+	struct eas_corpus *c;
+	struct eas_clip clip;
+	struct corpus_votes v;
+	unsigned long long samples = 0;
+	unsigned long headers = 0, missed = 0, extra = 0, bad = 0;
+	double t_open, t_decode;
+	const char *t;
+	int i, k, ok;
+
+	t_open = now_sec();
+	if(!(c = eas_corpus_open(path)))
+		return 1;
+	t_open = now_sec() - t_open;
+
+	t_decode = now_sec();
+	for(i = 0; i < eas_corpus_count(c); i++)
+	{
+		eas_corpus_clip(c, i, &clip);
+		corpus_decode(clip.samples, clip.count, engine, block, &v);
+		samples += clip.count;
+		headers += clip.ntruth;
+
+		// votes must come out as listed; anything else is a miss plus an extra
+		for(ok = v.n == clip.ntruth && !v.extra, k = 0, t = clip.truth; ok && k < clip.ntruth; k++, t += strlen(t) + 1)
+			ok = !strcmp(t, v.body[k]);
+
+		if(ok)
+			continue;
+
+		for(k = 0, t = clip.truth; k < clip.ntruth; k++, t += strlen(t) + 1)
+			missed += k >= v.n || strcmp(t, v.body[k]);
+		extra += v.extra + (v.n > clip.ntruth ? v.n - clip.ntruth : 0);
+
+		bad++;
+		printf("%s: voted %d header%s, %d listed\n", clip.name, v.n + v.extra, v.n + v.extra == 1 ? "" : "s", clip.ntruth);
+	}
+	t_decode = now_sec() - t_decode;
+
+	printf("%d clips (%.1f s audio), engine %s: %lu of %lu headers missed, %lu extra, %lu clips differ\n",
+		eas_corpus_count(c), (double)samples / FREQ_SAMP, eas_engine_name(engine), missed, headers, extra, bad);
+	printf("open %.3f ms, decode %.3f s (%.0fx real time)\n",
+		t_open * 1000.0, t_decode, t_decode > 0 ? samples / (double)FREQ_SAMP / t_decode : 0);
+
+	eas_corpus_close(c);
+	return bad ? 2 : 0;
+}
+
+int corpus_main(int argc, char **argv)
+{
+	const char *out = 0, *truth = 0, *cmd;
+	int opt, engine = EAS_ENGINE_FULL, block = FREQ_SAMP;
+
+	if(argc < 2)
+		goto usage;
+
+	cmd = argv[1];
+	argc--;
+	argv++;
+
+	while((opt = getopt(argc, argv, "o:t:e:b:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'o': out = optarg; break;
+		case 't': truth = optarg; break;
+		case 'e':
+			for(engine = 0; engine < EAS_ENGINE_COUNT && strcmp(optarg, eas_engine_name(engine)); engine++)
+				;
+			break;
+		case 'b': block = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if(!strcmp(cmd, "pack") && out && optind < argc)
+		return corpus_pack(out, truth, argv + optind, argc - optind);
+	if(!strcmp(cmd, "list") && optind + 1 == argc)
+		return corpus_list(argv[optind]);
+	if(!strcmp(cmd, "check") && optind + 1 == argc && engine < EAS_ENGINE_COUNT && block > 0)
+		return corpus_check(argv[optind], engine, block);
+
+usage:
+	fprintf(stderr, "usage: corpus pack [-t truth] -o out.eac file.raw ...\n"
+		"       corpus list in.eac\n"
+		"       corpus check [-e full|gated|decimated|onebit] [-b block_samples] in.eac\n");
+	return 1;
+}
@@ -0,0 +1,253 @@
+/*
+*      cost.c -- decoder cost model for admission control
+*
+*      CPU seconds spent per second of audio, per decoder engine and input
+*      sample rate. The model is calibrated by decoding synthetic program
+*      audio and alerts in the block size live inputs deliver, timed with
+*      the thread CPU clock, and can be saved so a host calibrates once.
+*
+*      The decoder only takes 22050 Hz input today, so that is the one
+*      rate calibrated; other rates report as unknown.
+*
+*      eas-decode calibrate [-t seconds] [-o model]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <time.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define COST_BLOCK (FREQ_SAMP / 50)       // samples per push, as a live read
+#define COST_PROGRAM 4                    // seconds of program audio per alert
+#define COST_SECONDS 0.5                  // default audio per engine when calibrating on demand
+
+static const int cost_rates[] = { FREQ_SAMP };
+
+#define COST_NRATES (sizeof(cost_rates)/sizeof(cost_rates[0]))
+
+static const char *engine_names[EAS_ENGINE_COUNT] = { "full", "gated", "decimated", "onebit" };
+
+static double cost_model[EAS_ENGINE_COUNT][COST_NRATES];  // 0 = not calibrated
+
+const char *eas_engine_name(int engine)
+{
+	return engine >= 0 && engine < EAS_ENGINE_COUNT ? engine_names[engine] : "?";
+}
+
+static int cost_rate_index(int rate)
+{
+	int i;
+
+	for(i = 0; i < (int)COST_NRATES; i++)
+	{
+		if(cost_rates[i] == rate)
+			return i;
+	}
+
+	return -1;
+}
+
+static double cpu_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// program audio (noise at about -30 dBFS) with an alert every few seconds;
+// no digital silence, which the decoder would skip for free
+static short *cost_audio(int *count)
+{
+	short *tx, *audio;
+	int n, len, i;
+
+	n = encode_samples("ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-", &tx);
+	len = n + COST_PROGRAM * FREQ_SAMP;
+
+	if(!(audio = malloc(len * sizeof(short))))
+	{
+		free(tx);
+		return 0;
+	}
+
+	srand(1);
+	for(i = 0; i < COST_PROGRAM * FREQ_SAMP; i++)
+		audio[i] = (short)(rand() % 2001 - 1000);
+
+	memcpy(audio + COST_PROGRAM * FREQ_SAMP, tx, n * sizeof(short));
+	free(tx);
+
+	*count = len;
+	return audio;
+}
+
+// events are not the point here; a NULL handler would print them
+static void cost_event(const struct eas_event *ev, void *ctx)
+{
+	(void)ev;
+	(void)ctx;
+}
+
+static double cost_measure(int engine, const short *audio, int count, double seconds)
+{
+	eas_stream *s;
+	long long total = (long long)(seconds * FREQ_SAMP), done = 0;
+	double t;
+	int pos = 0, n;
+
+	if(!(s = eas_open(0)))
+		return -1;
+
+	eas_set_event_handler(s, cost_event, 0);
+	eas_set_engine(s, engine);
+
+	t = cpu_sec();
+	while(done < total)
+	{
+		n = MIN(COST_BLOCK, count - pos);
+		eas_push(s, audio + pos, n);
+
+		pos = (pos + n) % count;
+		done += n;
+	}
+	t = cpu_sec() - t;
+
+	eas_close(s);
+	return t / ((double)done / FREQ_SAMP);
+}
+
+int eas_cost_calibrate(double seconds)
+{
+	short *audio;
+	int engine, count;
+
+	if(seconds <= 0)
+		seconds = COST_SECONDS;
+
+	if(!(audio = cost_audio(&count)))
+		return -1;
+
+	for(engine = 0; engine < EAS_ENGINE_COUNT; engine++)
+		cost_model[engine][cost_rate_index(FREQ_SAMP)] = cost_measure(engine, audio, count, seconds);
+
+	free(audio);
+	return 0;
+}
+
+double eas_cost(int engine, int rate)
+{
+	int r = cost_rate_index(rate);
+
+	if(engine < 0 || engine >= EAS_ENGINE_COUNT || r < 0 || cost_model[engine][r] <= 0)
+		return -1;
+
+	return cost_model[engine][r];
+}
+
+int eas_cost_save(const char *path)
+{
+	FILE *fp;
+	int engine, r;
+
+	if(!(fp = fopen(path, "w")))
+		return -1;
+
+	fprintf(fp, "# engine rate cpu_seconds_per_audio_second\n");
+	for(engine = 0; engine < EAS_ENGINE_COUNT; engine++)
+	{
+		for(r = 0; r < (int)COST_NRATES; r++)
+		{
+			if(cost_model[engine][r] > 0)
+				fprintf(fp, "%s %d %.6g\n", engine_names[engine], cost_rates[r], cost_model[engine][r]);
+		}
+	}
+
+	return fclose(fp);
+}
+
+int eas_cost_load(const char *path)
+{
+	FILE *fp;
+	char line[128], name[32];
+	double cpu;
+	int engine, rate, r, n = 0;
+
+	if(!(fp = fopen(path, "r")))
+		return -1;
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(line[0] == '#' || sscanf(line, "%31s %d %lf", name, &rate, &cpu) != 3 || cpu <= 0)
+			continue;
+
+		for(engine = 0; engine < EAS_ENGINE_COUNT; engine++)
+		{
+			if(!strcmp(name, engine_names[engine]) && (r = cost_rate_index(rate)) >= 0)
+			{
+				cost_model[engine][r] = cpu;
+				n++;
+			}
+		}
+	}
+
+	fclose(fp);
+	return n;
+}
+
+void eas_cost_print(FILE *fp)
+{
+	int engine, r;
+
+	for(engine = 0; engine < EAS_ENGINE_COUNT; engine++)
+	{
+		for(r = 0; r < (int)COST_NRATES; r++)
+		{
+			if(cost_model[engine][r] <= 0)
+				continue;
+
+			fprintf(fp, "%-8s %5d Hz  %8.5f cpu-s per audio-s  (%.0f real-time streams per core)\n",
+				engine_names[engine], cost_rates[r], cost_model[engine][r], 1.0 / cost_model[engine][r]);
+		}
+	}
+}
+
+int calibrate_main(int argc, char **argv)
+{
+	const char *out = 0;
+	double seconds = 10.0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:o:")) != -1)
+	{
+		switch(opt)
+		{
+		case 't': seconds = atof(optarg); break;
+		case 'o': out = optarg; break;
+		default:
+			fprintf(stderr, "usage: calibrate [-t seconds] [-o model]\n");
+			return 1;
+		}
+	}
+
+	if(seconds <= 0 || eas_cost_calibrate(seconds) < 0)
+		return 1;
+
+	eas_cost_print(stdout);
+
+	if(out && eas_cost_save(out))
+	{
+		perror(out);
+		return 1;
+	}
+
+	return 0;
+}
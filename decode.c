@@ -44,6 +44,14 @@
 #include <time.h>
 #ifndef _MSC_VER
 #include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include "easproc.h"
+#include "probes.h"
+#include "spectro.h"
+
+#ifdef _MSC_VER
+#define snprintf _snprintf
 #endif
 
 /*
@@ -99,43 +107,864 @@ enum EAS_L2_State
 #define CORRLEN ((int)(FREQ_SAMP/BAUD))
 #define SPHASEINC (0x10000u*BAUD/FREQ_SAMP)
 
+#define FBUF_LEN 16384                    // float samples buffered per stream
+#define BATCH_PEND 32                     // blocks grouped per stream in a batch
+#define ZERO_RUN_MIN (FREQ_SAMP/10)       // digital silence worth skipping, samples
+#define ZERO_GUARD (CORRLEN*12)           // silence demodulated before a skip
+#define ZERO_CHUNK 1024
+#define FSK_WINDOW (FREQ_SAMP/50)         // samples per tone energy check
+#define FSK_RATIO 8.0f                    // tone/broadband energy ratio of FSK (noise is ~2)
+#define FSK_HOLD FREQ_SAMP                // samples FSK stays active after it was seen
+#define GATE_STEP 4                       // gated engine: idle correlator stride
+#define GATE_KEEP (2*FSK_WINDOW+CORRLEN)  // gated engine: lookback kept while idle
+#define DECIM_STEP 3                      // decimated engine: correlator stride
+#define ADAPT_VOTES 2                     // clean votes before a cheaper engine is tried
+#define ADAPT_RETRY 8                     // clean votes before an engine that failed is tried again
+
+// Input health options
+#define HEALTH_BLOCK (FREQ_SAMP/10)       // samples per health block
+#define CLIP_LEVEL 32767                  // |sample| counted as clipped
+#define CLIP_RATIO 1000                   // block clips if 1 in CLIP_RATIO samples do
+#define DEAD_RMS 0.001f                   // block is dead air below -60 dBFS
+#define DC_LEVEL 0.05f                    // block has DC offset above this mean
+#define DEAD_BLOCKS 100                   // blocks to raise/clear dead air
+#define CLIP_BLOCKS 20                    // blocks to raise/clear clipping
+#define DC_BLOCKS 50                      // blocks to raise/clear DC offset
+
 static float eascorr_mark_i[CORRLEN];
 static float eascorr_mark_q[CORRLEN];
 static float eascorr_space_i[CORRLEN];
 static float eascorr_space_q[CORRLEN];
+static unsigned long long corr1_mark[2];  // i, q sign patterns, bit i set if negative
+static unsigned long long corr1_space[2];
+
+// mean header quality an adaptive stream must show, measured one rung
+// up, before it tries an engine; about 3 dB above where that engine
+// starts to lose votes
+static const float adapt_quality[EAS_ENGINE_COUNT] = { 0, 0, 0.80f, 0.84f };
+
+// engines adaptive streams step through, most to least expensive
+static int adapt_ladder[EAS_ENGINE_COUNT] = { EAS_ENGINE_FULL, EAS_ENGINE_GATED, EAS_ENGINE_DECIMATED, EAS_ENGINE_ONEBIT };
+
+struct eas_stream
+{
+	int id;
+	int stage;                            // EAS_Stage currently executing
+	int warm;                             // set once the first block has been processed
+	unsigned long allocs[EAS_STAGE_COUNT];
+
+	// ingestion
+	float *fbuf;
+	unsigned int fbuf_cnt;
+	unsigned long long fbuf_pos;          // sample offset of fbuf[0]
+	const struct eas_block *pend[BATCH_PEND]; // blocks waiting in eas_push_batch()
+	int npend;
+	struct eas_spectro *spectro;          // optional spectrogram side output
+
+	// input health
+	struct eas_health health;
+	unsigned int hb_cnt;                  // samples in the current health block
+	long long hb_sum;
+	long long hb_sumsq;
+	int hb_peak;
+	unsigned long hb_clips;
+	int dead_blocks;                      // debounce counters per fault
+	int clip_blocks;
+	int dc_blocks;
+
+	// demodulator
+	unsigned int shift_reg;
+	unsigned int sphase;
+	unsigned char current_kar;
+	unsigned char bit_counter;
+	int dcd_integrator;
+	int decoder_synced;
+	unsigned long long sample_pos;        // sample offset of the last bit decision
+	int engine;                           // EAS_Engine
+	int step_cnt;                         // samples since the last strided correlation
+	unsigned int gate_pos;                // gated engine: fbuf samples already searched
+	float held_f;                         // last correlator output, for strided engines
+	float tone_sum;                       // correlator energy in the current FSK window
+	float power_sum;                      // input energy in the current FSK window
+	int tone_cnt;
+	unsigned long long fsk_pos;           // sample offset after FSK was last seen, 0 if never
+	float q_sum;                          // correlator discrimination summed over this header copy
+	unsigned long q_cnt;
+	float quality;                        // of the last header copy
+	float q_copy[MAX_STORE_MSG];          // of each header copy in msg_buf
+	int adaptive;                         // engine follows signal quality
+	int adapt_rung;                       // position on adapt_ladder
+	int adapt_limit;                      // cheapest rung known to decode this stream
+	int adapt_clean;                      // clean votes in a row on this engine
+	int adapt_frames;                     // frames since FSK showed up, -1 once it is gone
+
+	// framing
+	char msg_buf[MAX_STORE_MSG][MAX_MSG_LEN + 1];
+	char head_buf[4];
+	unsigned long headlen;
+	unsigned long msglen;
+	unsigned long msgno;
+	int frame_state;
+	int processing_good_message;
+	char good_message[MAX_MSG_LEN + 1];
+
+	// events
+	eas_event_fn event_fn;
+	void *event_ctx;
+};
 
 static void eas_init();
-static void eas_demod(float *buffer, int length);
+static void eas_demod(eas_stream *s, float *buffer, int length);
+static void tone_check(eas_stream *s, float tone, float power, int step, unsigned long long pos);
+
+static void *(*alloc_hook)(size_t) = malloc;
+static void (*free_hook)(void *) = free;
+static unsigned long global_allocs[EAS_STAGE_COUNT];
+static int alloc_strict;
+static const char *spectro_pattern;
+
+// the stream whose samples are being decoded, and set while the decoder
+// itself allocates, so the malloc below charges a call once
+static eas_stream *alloc_stream;
+static int alloc_busy;
+
+static const char *stage_names[EAS_STAGE_COUNT] = { "setup", "ingest", "demod", "framing", "event" };
+
+void eas_set_allocator(void *(*alloc_fn)(size_t), void (*free_fn)(void *))
+{
+	alloc_hook = alloc_fn ? alloc_fn : malloc;
+	free_hook = free_fn ? free_fn : free;
+}
+
+void eas_alloc_strict(int enable)
+{
+#ifndef _MSC_VER
+	static char outbuf[BUFSIZ];
+
+	// stdio allocates stdout's buffer on the first printed event, which
+	// strict mode would take for a leak; hand it one up front instead
+	if(enable && !alloc_strict)
+		setvbuf(stdout, outbuf, isatty(1) ? _IOLBF : _IOFBF, sizeof(outbuf));
+#endif
+
+	// in strict mode any allocation charged to a warmed-up stream outside of
+	// setup is a bug in the steady-state path
+	alloc_strict = enable;
+}
+
+static void alloc_trap(eas_stream *s, const char *what, size_t size)
+{
+	if(!alloc_strict || !s->warm || s->stage == EAS_STAGE_SETUP)
+		return;
+
+	alloc_busy = 1;
+	if(size)
+		fprintf(stderr, "stream %d: %s of %lu bytes in %s stage after warmup\n",
+			s->id, what, (unsigned long)size, stage_names[s->stage]);
+	else
+		fprintf(stderr, "stream %d: %s in %s stage after warmup\n", s->id, what, stage_names[s->stage]);
+	abort();
+}
+
+#ifdef __GLIBC__
+// Every malloc in the process comes through here, the C library's own
+// (stdio buffers, qsort scratch) included, so a steady-state stage that
+// allocates is charged and trapped whether or not it asked eas_malloc().
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void alloc_charge(const char *what, size_t size)
+{
+	eas_stream *s = alloc_stream;
+
+	if(!s || alloc_busy || s->stage == EAS_STAGE_SETUP)
+		return;
+
+	if(size)
+		s->allocs[s->stage]++;
+	alloc_trap(s, what, size);
+}
+
+void *malloc(size_t size)
+{
+	alloc_charge("allocation", size ? size : 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	alloc_charge("allocation", n && size ? n * size : 1);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_charge("reallocation", size ? size : 1);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if(ptr)
+		alloc_charge("free", 0);
+	__libc_free(ptr);
+}
+#endif
 
-static char msg_buf[MAX_STORE_MSG][MAX_MSG_LEN + 1];
-static char head_buf[4];
-static unsigned long headlen;
-static unsigned long msglen;
-static unsigned long msgno;
-static int frame_state;
+void *eas_malloc(eas_stream *s, size_t size)
+{
+	void *p;
+
+	if(!s)
+	{
+		global_allocs[EAS_STAGE_SETUP]++;
+		return alloc_hook(size);
+	}
+
+	s->allocs[s->stage]++;
+	alloc_trap(s, "allocation", size);
+
+	alloc_busy++;
+	p = alloc_hook(size);
+	alloc_busy--;
+
+	return p;
+}
+
+void eas_free(eas_stream *s, void *ptr)
+{
+	if(s)
+		alloc_trap(s, "free", 0);
+
+	alloc_busy++;
+	free_hook(ptr);
+	alloc_busy--;
+}
+
+unsigned long eas_alloc_count(const eas_stream *s, int stage)
+{
+	if(stage < 0 || stage >= EAS_STAGE_COUNT)
+		return 0;
+
+	return s ? s->allocs[stage] : global_allocs[stage];
+}
+
+int eas_spectrogram(const char *pattern)
+{
+	const char *p;
+
+	// one "%d" takes the stream id, e.g. "/dev/shm/eas-%d.spec"; the name
+	// is never handed to printf, so any other '%' is refused
+	p = pattern ? strchr(pattern, '%') : 0;
+	if(p && (p[1] != 'd' || strchr(p + 2, '%')))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	spectro_pattern = pattern;
+	return 0;
+}
+
+static int spectro_name(char *fname, size_t size, int id)
+{
+	const char *d = strstr(spectro_pattern, "%d");
+	int n;
+
+	// without "%d" stream 0 writes the name itself and the rest append
+	// their id, so live streams never truncate each other's file
+	if(d)
+		n = snprintf(fname, size, "%.*s%d%s", (int)(d - spectro_pattern), spectro_pattern, id, d + 2);
+	else if(id)
+		n = snprintf(fname, size, "%s.%d", spectro_pattern, id);
+	else
+		n = snprintf(fname, size, "%s", spectro_pattern);
+
+	return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+eas_stream *eas_open(int id)
+{
+	static int initialized = 0;
+	eas_stream *s;
+	char fname[256];
+
+	if(!initialized)
+	{
+		eas_init();
+		initialized = 1;
+	}
+
+	if(!(s = eas_malloc(NULL, sizeof(*s))))
+		return 0;
+
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	s->stage = EAS_STAGE_SETUP;
+
+	if(!(s->fbuf = eas_malloc(s, FBUF_LEN * sizeof(s->fbuf[0]))))
+	{
+		eas_free(NULL, s);
+		return 0;
+	}
+
+	if(spectro_pattern)
+	{
+		if(spectro_name(fname, sizeof(fname), id) < 0)
+			fprintf(stderr, "stream %d: spectrogram file name too long\n", id);
+		else
+			s->spectro = spectro_open(s, fname);
+	}
+
+	return s;
+}
+
+void eas_close(eas_stream *s)
+{
+	if(!s)
+		return;
+
+	s->stage = EAS_STAGE_SETUP;
+	spectro_close(s, s->spectro);
+	eas_free(s, s->fbuf);
+	eas_free(NULL, s);
+}
 
-void decode(const char *fname)
+void eas_set_event_handler(eas_stream *s, eas_event_fn fn, void *ctx)
+{
+	s->event_fn = fn;
+	s->event_ctx = ctx;
+}
+
+void eas_get_stats(const eas_stream *s, struct eas_stats *st)
+{
+	st->samples = s->fbuf_pos + s->fbuf_cnt;
+	st->health = s->health;
+	st->quality = s->quality;
+	st->engine = s->engine;
+}
+
+void eas_set_engine(eas_stream *s, int engine)
+{
+	if(engine >= 0 && engine < EAS_ENGINE_COUNT)
+		s->engine = engine;
+}
+
+int eas_get_engine(const eas_stream *s)
+{
+	return s->engine;
+}
+
+void eas_set_adaptive(eas_stream *s, int enable)
+{
+	int i;
+
+	if(enable && !s->adaptive)
+	{
+		// carry on from the engine in use
+		for(i = 0; i < EAS_ENGINE_COUNT; i++)
+		{
+			if(adapt_ladder[i] == s->engine)
+				s->adapt_rung = i;
+		}
+
+		s->adapt_limit = EAS_ENGINE_COUNT - 1;
+		s->adapt_clean = 0;
+	}
+
+	s->adaptive = enable;
+}
+
+void eas_set_adaptive_ladder(const int *engines)
+{
+	// full first; streams already adaptive keep their rung
+	memcpy(adapt_ladder, engines, sizeof(adapt_ladder));
+}
+
+int eas_fsk_active(const eas_stream *s)
+{
+	// a frame in progress counts even through a fade
+	return s->frame_state != EAS_L2_IDLE || (s->fsk_pos && s->fbuf_pos < s->fsk_pos + FSK_HOLD);
+}
+
+void eas_print_event(const struct eas_event *ev)
+{
+	static const char *fault_names[] = { "", "dead air", "clipping", "", "DC offset" };
+
+	switch(ev->type)
+	{
+	case EAS_EVENT_PART:
+		printf("received EAS part: %s%s\n", HEADER_BEGIN, ev->message);
+		break;
+	case EAS_EVENT_START:
+		printf("successfully received EAS message: %s%s\n", HEADER_BEGIN, ev->message);
+		printf("begin audio message processing\n");
+		break;
+	case EAS_EVENT_END:
+		printf("complete audio message processing\n");
+		printf("successfully processed EAS message: %s%s\n", HEADER_BEGIN, ev->message);
+		break;
+	case EAS_EVENT_EOM:
+		printf("received EAS end of message: %s\n", EOM);
+		break;
+	case EAS_EVENT_FAULT:
+		fprintf(stderr, "stream %d: input fault at sample %llu: %s\n",
+			ev->stream, ev->offset, fault_names[ev->fault]);
+		break;
+	case EAS_EVENT_FAULT_CLEAR:
+		fprintf(stderr, "stream %d: input fault cleared at sample %llu: %s\n",
+			ev->stream, ev->offset, fault_names[ev->fault]);
+		break;
+	}
+}
+
+static void emit_event(eas_stream *s, int type, unsigned long long offset, int fault, const char *message)
+{
+	struct eas_event ev;
+	int stage = s->stage;
+
+	s->stage = EAS_STAGE_EVENT;
+
+	ev.type = type;
+	ev.stream = s->id;
+	ev.offset = offset;
+	ev.fault = fault;
+	ev.message = message;
+
+	if(s->event_fn)
+		s->event_fn(&ev, s->event_ctx);
+	else
+		eas_print_event(&ev);
+
+	s->stage = stage;
+}
+
+static void health_check(eas_stream *s, int fault, int bad, int *count, int limit)
+{
+	// a fault is raised after limit consecutive bad blocks and cleared
+	// after limit consecutive good ones
+	if(bad != !!(s->health.faults & fault))
+		(*count)++;
+	else
+		*count = 0;
+
+	if(*count < limit)
+		return;
+
+	*count = 0;
+	s->health.faults ^= fault;
+	emit_event(s, bad ? EAS_EVENT_FAULT : EAS_EVENT_FAULT_CLEAR,
+		s->fbuf_pos + s->fbuf_cnt, fault, 0);
+}
+
+static void health_block(eas_stream *s)
+{
+	struct eas_health *h = &s->health;
+	float mean_sq;
+
+	mean_sq = (float)s->hb_sumsq / s->hb_cnt;
+	h->rms = (float)sqrt(mean_sq) * (1.0f/32768.0f);
+	h->dc = (float)s->hb_sum / s->hb_cnt * (1.0f/32768.0f);
+	h->peak = s->hb_peak * (1.0f/32768.0f);
+	h->clips = s->hb_clips;
+	h->clips_total += s->hb_clips;
+
+	health_check(s, EAS_FAULT_DEAD_AIR, h->rms < DEAD_RMS, &s->dead_blocks, DEAD_BLOCKS);
+	health_check(s, EAS_FAULT_CLIPPING, s->hb_clips * CLIP_RATIO > s->hb_cnt, &s->clip_blocks, CLIP_BLOCKS);
+	health_check(s, EAS_FAULT_DC, fabs(h->dc) > DC_LEVEL, &s->dc_blocks, DC_BLOCKS);
+
+	s->hb_cnt = 0;
+	s->hb_sum = 0;
+	s->hb_sumsq = 0;
+	s->hb_peak = 0;
+	s->hb_clips = 0;
+}
+
+// convert and health-check as much of the input as fits; returns samples taken
+static int stream_ingest(eas_stream *s, const short *samples, int count)
+{
+	int i, n, v, a, last_nz;
+	long long sum, sumsq;
+	int peak;
+	unsigned long clips;
+
+	n = MIN(count, (int)(FBUF_LEN - s->fbuf_cnt));
+	n = MIN(n, (int)(HEALTH_BLOCK - s->hb_cnt));
+
+	s->stage = EAS_STAGE_INGEST;
+
+	// health statistics ride along with the conversion
+	sum = 0;
+	sumsq = 0;
+	peak = s->hb_peak;
+	clips = 0;
+	last_nz = -1;
+
+	for(i = 0; i < n; i++)
+	{
+		v = samples[i];
+		s->fbuf[s->fbuf_cnt + i] = v * (1.0f/32768.0f);
+
+		a = v < 0 ? -v : v;
+		sum += v;
+		sumsq += v * v;
+		peak = MAX(peak, a);
+		clips += (a >= CLIP_LEVEL);
+		last_nz = v ? i : last_nz;
+	}
+
+	s->fbuf_cnt += n;
+	s->hb_cnt += n;
+	s->hb_sum += sum;
+	s->hb_sumsq += sumsq;
+	s->hb_peak = peak;
+	s->hb_clips += clips;
+	s->health.silence_run = last_nz < 0 ? s->health.silence_run + n : (unsigned long long)(n - 1 - last_nz);
+
+	if(s->hb_cnt == HEALTH_BLOCK)
+		health_block(s);
+
+	if(s->spectro)
+		spectro_feed(s->spectro, s->fbuf + s->fbuf_cnt - n, n);
+
+	return n;
+}
+
+// gated engine: with nothing on the air, search the new samples for tone
+// energy every few samples and drop all but a lookback long enough to
+// hold the start of any FSK found later; returns 1 to demodulate
+static int stream_gate(eas_stream *s)
+{
+	unsigned int i, drop;
+	unsigned long long seen = s->fsk_pos;
+	float mark, space;
+
+	if(s->decoder_synced || s->frame_state != EAS_L2_IDLE || (s->fsk_pos && s->fbuf_pos < s->fsk_pos + FSK_HOLD))
+		return 1;
+
+	for(i = s->gate_pos; i + CORRLEN <= s->fbuf_cnt; i += GATE_STEP)
+	{
+		mark = fsqr(mac(s->fbuf + i, eascorr_mark_i, CORRLEN)) +
+			fsqr(mac(s->fbuf + i, eascorr_mark_q, CORRLEN));
+		space = fsqr(mac(s->fbuf + i, eascorr_space_i, CORRLEN)) +
+			fsqr(mac(s->fbuf + i, eascorr_space_q, CORRLEN));
+		tone_check(s, mark + space, s->fbuf[i] * s->fbuf[i], GATE_STEP, s->fbuf_pos + i);
+	}
+
+	s->gate_pos = i;
+	if(s->fsk_pos != seen)
+	{
+		// demodulate from the start of the lookback
+		s->gate_pos = 0;
+		return 1;
+	}
+
+	if(s->fbuf_cnt > GATE_KEEP)
+	{
+		drop = s->fbuf_cnt - GATE_KEEP;
+		memmove(s->fbuf, s->fbuf + drop, GATE_KEEP * sizeof(s->fbuf[0]));
+		s->fbuf_pos += drop;
+		s->fbuf_cnt = GATE_KEEP;
+		s->gate_pos -= MIN(drop, s->gate_pos);
+	}
+
+	return 0;
+}
+
+static void stream_demod(eas_stream *s)
+{
+	if(s->engine == EAS_ENGINE_GATED && !stream_gate(s))
+		return;
+
+	if(s->fbuf_cnt >= CORRLEN)
+	{
+		// eas_demod() evaluates every complete window, so only the
+		// CORRLEN-1 samples of incomplete windows carry over; the result
+		// does not depend on how the input was split into blocks
+		s->stage = EAS_STAGE_DEMOD;
+		eas_demod(s, s->fbuf, s->fbuf_cnt-CORRLEN);
+		memmove(s->fbuf, s->fbuf+s->fbuf_cnt-CORRLEN+1, (CORRLEN-1)*sizeof(s->fbuf[0]));
+		s->fbuf_pos += s->fbuf_cnt-CORRLEN+1;
+		s->fbuf_cnt = CORRLEN-1;
+		s->gate_pos = 0;
+	}
+}
+
+static void stream_push(eas_stream *s, const short *samples, int count)
+{
+	int n;
+
+	while(count > 0)
+	{
+		n = stream_ingest(s, samples, count);
+		samples += n;
+		count -= n;
+
+		stream_demod(s);
+	}
+}
+
+// start of the first run of at least min zero samples, or n
+static int zero_run_start(const short *x, int n, int min)
+{
+	__m128i zero = _mm_setzero_si128();
+	int i, k, mask, run = 0;
+
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)&x[i]), zero));
+
+		if(mask == 0xffff)
+			run += 8;
+		else if(!mask)
+			run = 0;
+		else
+		{
+			for(k = 0; k < 8; k++)
+				run = x[i + k] ? 0 : run + 1;
+		}
+
+		if(run >= min)
+			return i + 8 - run;
+	}
+
+	for(; i < n; i++)
+	{
+		run = x[i] ? 0 : run + 1;
+		if(run >= min)
+			return i + 1 - run;
+	}
+
+	return n;
+}
+
+static int zero_run_len(const short *x, int n)
+{
+	__m128i zero = _mm_setzero_si128();
+	int i;
+
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)&x[i]), zero)) != 0xffff)
+			break;
+	}
+
+	while(i < n && !x[i])
+		i++;
+
+	return i;
+}
+
+static void stream_skip(eas_stream *s, unsigned long long count)
+{
+	static const short zeros[ZERO_CHUNK];
+	static const float fzeros[ZERO_CHUNK];
+	unsigned long long first, rest, bits;
+	unsigned int inc = (unsigned int)SPHASEINC, period;
+	int n;
+
+	// demodulate the start of the silence for real: once every correlator
+	// window is all zero and a few bit periods have passed, the decoder has
+	// lost sync and its state only advances with time
+	while(count > 0 && (s->health.silence_run < ZERO_GUARD || s->decoder_synced))
+	{
+		n = (int)MIN(count, ZERO_CHUNK);
+		stream_push(s, zeros, n);
+		count -= n;
+	}
+
+	if(!count)
+		return;
+
+	// input health sees the silence block by block
+	for(rest = count; rest > 0; rest -= n)
+	{
+		n = (int)MIN(rest, (unsigned long long)(HEALTH_BLOCK - s->hb_cnt));
+		s->hb_cnt += n;
+		s->health.silence_run += n;
+
+		if(s->hb_cnt == HEALTH_BLOCK)
+			health_block(s);
+	}
+
+	for(rest = count; s->spectro && rest > 0; rest -= n)
+	{
+		n = (int)MIN(rest, ZERO_CHUNK);
+		spectro_feed(s->spectro, fzeros, n);
+	}
+
+	// advance the bit clock as eas_demod() would over all-zero windows:
+	// no transitions, so no DLL correction, and a decision every period
+	first = (0x10000u - s->sphase + inc - 1) / inc;
+	period = (0x10000u - 1 + inc - 1) / inc;
+
+	if(count < first)
+		s->sphase += (unsigned int)count * inc;
+	else
+	{
+		bits = (count - first) / period;
+		s->sample_pos = s->fbuf_pos + first - 1 + bits * period;
+		s->sphase = 1 + (unsigned int)((count - first) % period) * inc;
+	}
+
+	// the carried-over samples are zeros already and stay so
+	s->shift_reg = 0;
+	s->fbuf_pos += count;
+}
+
+void eas_skip(eas_stream *s, unsigned long long count)
+{
+	eas_stream *outer = alloc_stream;
+
+	alloc_stream = s;
+	stream_skip(s, count);
+	alloc_stream = outer;
+}
+
+void eas_push(eas_stream *s, const short *samples, int count)
+{
+	eas_stream *outer = alloc_stream;
+	int n;
+
+	alloc_stream = s;
+
+	// long runs of digital silence are skipped rather than demodulated
+	while(count > 0)
+	{
+		n = zero_run_start(samples, count, ZERO_RUN_MIN);
+		stream_push(s, samples, n);
+		samples += n;
+		count -= n;
+
+		if(count > 0)
+		{
+			n = zero_run_len(samples, count);
+			stream_skip(s, n);
+			samples += n;
+			count -= n;
+		}
+	}
+
+	// the first block brings the stream up; everything after is steady state
+	s->stage = EAS_STAGE_SETUP;
+	s->warm = 1;
+	alloc_stream = outer;
+}
+
+static void stream_flush_batch(eas_stream *s)
+{
+	eas_stream *outer = alloc_stream;
+	const short *samples;
+	int i, n, count;
+
+	alloc_stream = s;
+
+	// convert all the stream's blocks, then demodulate them in one go
+	for(i = 0; i < s->npend; i++)
+	{
+		samples = s->pend[i]->samples;
+		count = s->pend[i]->count;
+
+		while(count > 0)
+		{
+			if(s->fbuf_cnt == FBUF_LEN)
+				stream_demod(s);
+
+			n = stream_ingest(s, samples, count);
+			samples += n;
+			count -= n;
+		}
+	}
+
+	stream_demod(s);
+	s->npend = 0;
+	s->stage = EAS_STAGE_SETUP;
+	s->warm = 1;
+	alloc_stream = outer;
+}
+
+void eas_push_batch(const struct eas_block *blocks, int nblocks)
+{
+	eas_stream *s;
+	int i;
+
+	// group the blocks by stream, keeping their order within a stream, so
+	// each stream's state is loaded once per batch and its blocks are
+	// demodulated together; the correlator tables stay hot across streams
+	for(i = 0; i < nblocks; i++)
+	{
+		s = blocks[i].s;
+		if(s->npend == BATCH_PEND)
+			stream_flush_batch(s);
+
+		s->pend[s->npend++] = &blocks[i];
+	}
+
+	for(i = 0; i < nblocks; i++)
+	{
+		if(blocks[i].s->npend)
+			stream_flush_batch(blocks[i].s);
+	}
+}
+
+int decode(const char *fname)
 {
 	int fd;
 	int i;
 	short buffer[8192];
-	float fbuf[16384];
-	unsigned int fbuf_cnt = 0;
-	short *sp;
-
-	eas_init();
+	eas_stream *s;
+#ifdef SEEK_DATA
+	struct stat st;
+	long long pos = 0, data, end = 0;
+	int sparse;
+#endif
 
 #ifdef _MSC_VER
 	if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0) {
 #else
 	if ((fd = open(fname, O_RDONLY)) < 0) {
 #endif
-		return;
+		return -1;
+	}
+
+	if(!(s = eas_open(0)))
+	{
+		close(fd);
+		return -1;
 	}
 
+#ifdef SEEK_DATA
+	// holes in sparse recordings are silence; skip them without reading
+	sparse = !fstat(fd, &st) && S_ISREG(st.st_mode);
+#endif
+
 	for(;;)
 	{
-		i = read(fd, sp = buffer, sizeof(buffer));
+#ifdef SEEK_DATA
+		if(sparse && pos >= end)
+		{
+			if((data = lseek(fd, pos, SEEK_DATA)) < 0)
+				data = errno == ENXIO ? st.st_size : pos;
+			if((end = lseek(fd, data, SEEK_HOLE)) < 0)
+				end = st.st_size;
+
+			if(data > pos)
+				eas_skip(s, (data - pos) / sizeof(buffer[0]));
+
+			pos = data;
+			if(lseek(fd, pos, SEEK_SET) < 0)
+				sparse = 0;
+		}
+
+		i = read(fd, buffer, sparse ? (size_t)MIN((long long)sizeof(buffer), end - pos) : sizeof(buffer));
+		if(i > 0)
+			pos += i;
+#else
+		i = read(fd, buffer, sizeof(buffer));
+#endif
 
 		if(i < 0 && errno != EAGAIN) {
 			perror("read");
@@ -147,22 +976,16 @@ void decode(const char *fname)
 
 		if(i > 0)
 		{
-			for(; i >= sizeof(buffer[0]); i -= sizeof(buffer[0]), sp++)
-				fbuf[fbuf_cnt++] = (*sp) * (1.0f/32768.0f);
-
-			if(i)
+			if(i % sizeof(buffer[0]))
 				fprintf(stderr, "warning: noninteger number of samples read\n");
 
-			if(fbuf_cnt > CORRLEN)
-			{
-				eas_demod(fbuf, fbuf_cnt-CORRLEN);
-				memmove(fbuf, fbuf+fbuf_cnt-CORRLEN, CORRLEN*sizeof(fbuf[0]));
-				fbuf_cnt = CORRLEN;
-			}
+			eas_push(s, buffer, i / sizeof(buffer[0]));
 		}
 	}
 
+	eas_close(s);
 	close(fd);
+	return 0;
 }
 
 static void eas_init()
@@ -180,18 +1003,32 @@ static void eas_init()
 		eascorr_space_q[i] = (float)sin(f);
 		f += (float)(2.0*3.14159265359*FREQ_SPACE/FREQ_SAMP);
 	}
+	for(i = 0; i < CORRLEN; i++) {
+		corr1_mark[0] |= (unsigned long long)(eascorr_mark_i[i] < 0) << i;
+		corr1_mark[1] |= (unsigned long long)(eascorr_mark_q[i] < 0) << i;
+		corr1_space[0] |= (unsigned long long)(eascorr_space_i[i] < 0) << i;
+		corr1_space[1] |= (unsigned long long)(eascorr_space_q[i] < 0) << i;
+	}
 }
 
-static void process_start_message(const char *message)
+static void process_part_message(eas_stream *s, const char *message)
 {
-	printf("successfully received EAS message: %s%s\n", HEADER_BEGIN, message);
-	printf("begin audio message processing\n");
+	emit_event(s, EAS_EVENT_PART, s->sample_pos, 0, message);
 }
 
-static void process_end_message(const char *message)
+static void process_start_message(eas_stream *s, const char *message)
 {
-	printf("complete audio message processing\n");
-	printf("successfully processed EAS message: %s%s\n", HEADER_BEGIN, message);
+	emit_event(s, EAS_EVENT_START, s->sample_pos, 0, message);
+}
+
+static void process_end_message(eas_stream *s, const char *message)
+{
+	emit_event(s, EAS_EVENT_END, s->sample_pos, 0, message);
+}
+
+static void process_eom(eas_stream *s)
+{
+	emit_event(s, EAS_EVENT_EOM, s->sample_pos, 0, 0);
 }
 
 static char eas_allowed(char data)
@@ -213,84 +1050,144 @@ static char eas_allowed(char data)
 	return 0;
 }
 
-static void process_frame_char(char data)
+// a vote failed or was not unanimous, or FSK came and went without a
+// frame: back to the full correlator, and the engine that missed is not
+// tried again for a while
+static void adapt_fail(eas_stream *s)
+{
+	if(s->adapt_rung)
+		s->adapt_limit = s->adapt_rung - 1;
+
+	s->adapt_rung = 0;
+	s->engine = adapt_ladder[0];
+	s->adapt_clean = 0;
+}
+
+// a clean vote has all copies agree; after enough of them, step to the
+// next cheaper engine the signal is strong enough for
+static void adapt_vote(eas_stream *s, int voted)
 {
-	static int processing_good_message;
-	static char good_message[MAX_MSG_LEN + 1];
+	int next, i;
+	float q = 0;
 
+	if(!s->adaptive)
+		return;
+
+	// an outvoted copy means this engine is at its margin
+	if(!voted || strcmp(s->msg_buf[0], s->msg_buf[1]) || strcmp(s->msg_buf[1], s->msg_buf[2]))
+	{
+		adapt_fail(s);
+		return;
+	}
+
+	for(i = 0; i < MAX_STORE_MSG; i++)
+		q += s->q_copy[i] / MAX_STORE_MSG;
+
+	for(next = s->adapt_rung + 1; next < EAS_ENGINE_COUNT && q < adapt_quality[adapt_ladder[next]]; next++)
+		;
+
+	s->adapt_clean++;
+	if(next < EAS_ENGINE_COUNT && q >= adapt_quality[adapt_ladder[next]] &&
+		s->adapt_clean >= (next > s->adapt_limit ? ADAPT_RETRY : ADAPT_VOTES))
+	{
+		s->adapt_limit = MAX(s->adapt_limit, next);
+		s->adapt_rung = next;
+		s->engine = adapt_ladder[next];
+		s->adapt_clean = 0;
+	}
+}
+
+static void process_frame_char(eas_stream *s, char data)
+{
 	int i, j = 0;
 	char *ptr = 0;
 	int have_complete_set_of_messages;
 	int got_good_message;
+
+	s->stage = EAS_STAGE_FRAMING;
 	
 	if(data)
 	{
 		// if we're idle, now we're looking for a header
-		if(frame_state == EAS_L2_IDLE)
-			frame_state = EAS_L2_HEADER_SEARCH;
+		if(s->frame_state == EAS_L2_IDLE)
+			s->frame_state = EAS_L2_HEADER_SEARCH;
 		
-		if(frame_state == EAS_L2_HEADER_SEARCH && headlen < MAX_HEADER_LEN)
+		if(s->frame_state == EAS_L2_HEADER_SEARCH && s->headlen < MAX_HEADER_LEN)
 		{
 			// put it in the header buffer if we have room
-			head_buf[headlen] = data;
-			headlen++;
+			s->head_buf[s->headlen] = data;
+			s->headlen++;
 		}
 		
-		if(frame_state == EAS_L2_HEADER_SEARCH && headlen >= MAX_HEADER_LEN)
+		if(s->frame_state == EAS_L2_HEADER_SEARCH && s->headlen >= MAX_HEADER_LEN)
 		{
 			// test first 4 bytes to see if they are a header
-			if(!strncmp(head_buf, HEADER_BEGIN, headlen))
+			if(!strncmp(s->head_buf, HEADER_BEGIN, s->headlen))
+			{
 				// have found header. keep reading
-				frame_state = EAS_L2_READING_MESSAGE;
-			else if(!strncmp(head_buf, EOM, headlen))
+				s->frame_state = EAS_L2_READING_MESSAGE;
+				s->q_sum = 0;
+				s->q_cnt = 0;
+				if(s->adapt_frames >= 0)
+					s->adapt_frames++;
+			}
+			else if(!strncmp(s->head_buf, EOM, s->headlen))
+			{
 				// have found EOM
-				frame_state = EAS_L2_READING_EOM;
+				s->frame_state = EAS_L2_READING_EOM;
+				if(s->adapt_frames >= 0)
+					s->adapt_frames++;
+			}
 			else
 			{
 				// not valid, abort and clear buffer
-				frame_state = EAS_L2_IDLE;
-				headlen = 0;
+				s->frame_state = EAS_L2_IDLE;
+				s->headlen = 0;
 			}
 		}
-		else if(frame_state == EAS_L2_READING_MESSAGE && msglen <= MAX_MSG_LEN)
+		else if(s->frame_state == EAS_L2_READING_MESSAGE && s->msglen <= MAX_MSG_LEN)
 		{
 			// space is available; store in message buffer
-			msg_buf[msgno][msglen] = data;
-			msglen++;
+			s->msg_buf[s->msgno][s->msglen] = data;
+			s->msglen++;
 		}
 	}
 	else
 	{
 		// the header has ended
 		// fill the rest of the buffer will NULs
-		memset(&msg_buf[msgno][msglen], '\0', MAX_MSG_LEN - msglen); 
-		//msg_buf[msgno][msglen] = '\0';
+		memset(&s->msg_buf[s->msgno][s->msglen], '\0', MAX_MSG_LEN - s->msglen); 
+		//s->msg_buf[s->msgno][s->msglen] = '\0';
 
-		if(frame_state == EAS_L2_READING_MESSAGE)
+		if(s->frame_state == EAS_L2_READING_MESSAGE)
 		{
 			// All EAS messages should end in a minus sign("-")
 			// trim any trailing characters
-			ptr = strrchr(&msg_buf[msgno], '-');
+			ptr = strrchr(&s->msg_buf[s->msgno], '-');
 			if(ptr)
 			{
 				// found. make the next character zero
 				*(ptr+1) = '\0';
 			}
 			
+			s->quality = s->q_cnt ? s->q_sum / s->q_cnt : 0;
+			s->q_copy[s->msgno] = s->quality;
+
 			// display message if verbosity permits
 			//verbprintf(7, "\n");
-			printf("received EAS part: %s%s\n", HEADER_BEGIN, msg_buf[msgno]);
+			process_part_message(s, s->msg_buf[s->msgno]);
+			EAS_PROBE4(header_copy, s->id, s->sample_pos, s->msgno, s->msg_buf[s->msgno]);
 			
 			// increment message number
-			msgno += 1;
-			if(msgno >= MAX_STORE_MSG)
-				msgno = 0;
+			s->msgno += 1;
+			if(s->msgno >= MAX_STORE_MSG)
+				s->msgno = 0;
 
 			have_complete_set_of_messages = 1;
 
 			for(i = 0; i < MAX_STORE_MSG; i++)
 			{
-				if(msg_buf[i][0] == '\0')
+				if(s->msg_buf[i][0] == '\0')
 				{
 					have_complete_set_of_messages = 0;
 					break;
@@ -300,23 +1197,23 @@ static void process_frame_char(char data)
 			if(have_complete_set_of_messages)
 			{
 				//not currently processing a good message, that is to be determined now...
-				processing_good_message = 0;
+				s->processing_good_message = 0;
 
 				//assume we got a good message
 				got_good_message = 1;
 
 				//clear it
-				memset(good_message, 0, MAX_MSG_LEN + 1);
+				memset(s->good_message, 0, MAX_MSG_LEN + 1);
 
 				//for each char in the message, we need to pick the best two out of three chars
-				for(i = 0; i < strlen(msg_buf[0]); i++)
+				for(i = 0; i < strlen(s->msg_buf[0]); i++)
 				{
-					if(msg_buf[0][i] == msg_buf[1][i])
-						good_message[i] = msg_buf[0][i];
-					else if(msg_buf[1][i] == msg_buf[2][i])
-						good_message[i] = msg_buf[1][i];
-					else if(msg_buf[2][i] == msg_buf[0][i])
-						good_message[i] = msg_buf[2][i];
+					if(s->msg_buf[0][i] == s->msg_buf[1][i])
+						s->good_message[i] = s->msg_buf[0][i];
+					else if(s->msg_buf[1][i] == s->msg_buf[2][i])
+						s->good_message[i] = s->msg_buf[1][i];
+					else if(s->msg_buf[2][i] == s->msg_buf[0][i])
+						s->good_message[i] = s->msg_buf[2][i];
 					else
 					{
 						got_good_message = 0;
@@ -326,143 +1223,285 @@ static void process_frame_char(char data)
 
 				if(got_good_message)
 				{
-					process_start_message(good_message);
-					processing_good_message = 1;
+					EAS_PROBE3(vote_ok, s->id, s->sample_pos, s->good_message);
+					process_start_message(s, s->good_message);
+					s->processing_good_message = 1;
 				}
 				else
 				{
+					EAS_PROBE3(vote_fail, s->id, s->sample_pos, i);
 				}
+
+				adapt_vote(s, got_good_message);
 			}
 		}
-		else if(frame_state == EAS_L2_READING_EOM)
+		else if(s->frame_state == EAS_L2_READING_EOM)
 		{
+			EAS_PROBE3(eom, s->id, s->sample_pos, s->processing_good_message);
+
 			//complete the successful EAS message
-			if(processing_good_message)
-				process_end_message(good_message);
+			if(s->processing_good_message)
+				process_end_message(s, s->good_message);
 
 			// raise the EOM
-			printf("received EAS end of message: %s\n", EOM);
-			msgno = 0;
+			process_eom(s);
+			s->msgno = 0;
 
 			for(i = 0; i < MAX_STORE_MSG; i++)
-				msg_buf[i][0] = '\0';
+				s->msg_buf[i][0] = '\0';
 
 			//we completed the entire EAS message
-			processing_good_message = 0;
+			s->processing_good_message = 0;
 		}
 
 		// go back to idle
-		frame_state = EAS_L2_IDLE;
-		msglen = 0;
-		headlen = 0;
+		s->frame_state = EAS_L2_IDLE;
+		s->msglen = 0;
+		s->headlen = 0;
 	}
+
+	s->stage = EAS_STAGE_DEMOD;
 }
 
-static void eas_demod(float *buffer, int length)
+// FSK puts most of the input energy into one of the correlators;
+// broadband audio spreads it (see eas_fsk_active())
+static void tone_check(eas_stream *s, float tone, float power, int step, unsigned long long pos)
 {
-	static unsigned int shift_reg;
-	static unsigned int sphase;
-	static unsigned char current_kar = 0;
-	static unsigned char bit_counter = 0;
-	static int dcd_integrator;
-	static int decoder_synced = 0;
+	s->tone_sum += tone;
+	s->power_sum += power;
+	s->tone_cnt += step;
 
-	float f;
-	float dll_gain;
+	if(s->tone_cnt >= FSK_WINDOW)
+	{
+		if(s->tone_sum > FSK_RATIO * CORRLEN * s->power_sum && s->power_sum > 0)
+		{
+			if(!s->fsk_pos || pos >= s->fsk_pos + FSK_HOLD)
+				s->adapt_frames = 0;
+			s->fsk_pos = pos + 1;
+		}
+		else if(s->fsk_pos && pos >= s->fsk_pos + FSK_HOLD && s->adapt_frames >= 0)
+		{
+			if(!s->adapt_frames && s->adaptive)
+				adapt_fail(s);
+			s->adapt_frames = -1;
+		}
 
-	for(; length >= 0; length--, buffer++)
+		s->tone_sum = 0;
+		s->power_sum = 0;
+		s->tone_cnt = 0;
+	}
+}
+
+// bit counts of both 64-bit lanes, SSE2 only (no popcnt instruction assumed)
+static __m128i popcount2x64(__m128i x)
+{
+	x = _mm_sub_epi64(x, _mm_and_si128(_mm_srli_epi64(x, 1), _mm_set1_epi8(0x55)));
+	x = _mm_add_epi64(_mm_and_si128(x, _mm_set1_epi8(0x33)), _mm_and_si128(_mm_srli_epi64(x, 2), _mm_set1_epi8(0x33)));
+	x = _mm_and_si128(_mm_add_epi64(x, _mm_srli_epi64(x, 4)), _mm_set1_epi8(0x0f));
+	return _mm_sad_epu8(x, _mm_setzero_si128());
+}
+
+// correlations of a window of signs with the four reference sign
+// patterns: agreements minus disagreements
+static void corr_1bit(unsigned long long window, int c[4])
+{
+	__m128i w, m, sp;
+
+	w = _mm_set_epi32((int)(window >> 32), (int)window, (int)(window >> 32), (int)window);
+	m = popcount2x64(_mm_xor_si128(w, _mm_loadu_si128((const __m128i *)corr1_mark)));
+	sp = popcount2x64(_mm_xor_si128(w, _mm_loadu_si128((const __m128i *)corr1_space)));
+
+	c[0] = CORRLEN - 2 * _mm_cvtsi128_si32(m);
+	c[1] = CORRLEN - 2 * _mm_cvtsi128_si32(_mm_srli_si128(m, 8));
+	c[2] = CORRLEN - 2 * _mm_cvtsi128_si32(sp);
+	c[3] = CORRLEN - 2 * _mm_cvtsi128_si32(_mm_srli_si128(sp, 8));
+}
+
+// how clearly the correlators tell mark from space while a header is
+// read: 1 for clean FSK, falling towards 0 as noise fills both
+static void quality_add(eas_stream *s, float f, float tone)
+{
+	if(s->frame_state == EAS_L2_READING_MESSAGE && tone > 0)
 	{
-		f = fsqr(mac(buffer, eascorr_mark_i, CORRLEN)) +
-			fsqr(mac(buffer, eascorr_mark_q, CORRLEN)) -
-			fsqr(mac(buffer, eascorr_space_i, CORRLEN)) -
-			fsqr(mac(buffer, eascorr_space_q, CORRLEN));
+		s->q_sum += fabsf(f) / tone;
+		s->q_cnt++;
+	}
+}
 
-		// f > 0 if a mark is detected
-		// keep the last few correlator samples in shift_reg
-		// when we've synchronized to the bit transitions, the shift_reg
-		// will have (nearly) a single value per symbol
-		shift_reg <<= 1;
-		shift_reg |= (f > 0);
+static void demod_bit(eas_stream *s, float f, unsigned long long pos);
 
-		// the integrator is positive for 1 bits, and negative for 0 bits
-		if(f > 0 && (dcd_integrator < INTEGRATOR_MAXVAL))
-		{
-			dcd_integrator += 1;
-		}
-		else if(f < 0 && dcd_integrator > -INTEGRATOR_MAXVAL)
+static void eas_demod(eas_stream *s, float *buffer, int length)
+{
+	float f = s->held_f, mark, space;
+	unsigned long long pos, window = 0;
+	int i, c[4], engine = s->engine;
+
+	// sign bits of the correlator window, bit i for buffer[i]; shifted
+	// along one sample at a time below
+	// framing may switch an adaptive stream's engine; that takes effect
+	// from the next block
+	if(engine == EAS_ENGINE_ONEBIT)
+	{
+		for(i = 0; i < CORRLEN - 1; i++)
+			window |= (unsigned long long)(buffer[i] < 0) << (i + 1);
+	}
+
+	for(; length >= 0; length--, buffer++)
+	{
+		pos = s->fbuf_pos + (buffer - s->fbuf);
+
+		switch(engine)
 		{
-			dcd_integrator -= 1;
+		case EAS_ENGINE_FULL:
+		case EAS_ENGINE_GATED:                // gating happens per block in stream_demod()
+			mark = fsqr(mac(buffer, eascorr_mark_i, CORRLEN)) +
+				fsqr(mac(buffer, eascorr_mark_q, CORRLEN));
+			space = fsqr(mac(buffer, eascorr_space_i, CORRLEN)) +
+				fsqr(mac(buffer, eascorr_space_q, CORRLEN));
+			f = mark - space;
+			tone_check(s, mark + space, buffer[0] * buffer[0], 1, pos);
+			quality_add(s, f, mark + space);
+			break;
+
+		case EAS_ENGINE_DECIMATED:
+			// correlate every few samples and hold the result in between;
+			// the bit clock sees transitions to within DECIM_STEP samples
+			if(++s->step_cnt >= DECIM_STEP)
+			{
+				s->step_cnt = 0;
+				mark = fsqr(mac(buffer, eascorr_mark_i, CORRLEN)) +
+					fsqr(mac(buffer, eascorr_mark_q, CORRLEN));
+				space = fsqr(mac(buffer, eascorr_space_i, CORRLEN)) +
+					fsqr(mac(buffer, eascorr_space_q, CORRLEN));
+				f = mark - space;
+				tone_check(s, mark + space, buffer[0] * buffer[0], DECIM_STEP, pos);
+				quality_add(s, f, mark + space);
+			}
+			break;
+
+		case EAS_ENGINE_ONEBIT:
+			// hard-limited input against sign references, as a limiter
+			// and XOR correlator would; a sign sample weighs like power 2
+			window = (window >> 1) | ((unsigned long long)(buffer[CORRLEN - 1] < 0) << (CORRLEN - 1));
+			corr_1bit(window, c);
+			mark = (float)(c[0] * c[0] + c[1] * c[1]);
+			space = (float)(c[2] * c[2] + c[3] * c[3]);
+			f = mark - space;
+			tone_check(s, mark + space, 2.0f, 1, pos);
+			quality_add(s, f, mark + space);
+			break;
 		}
-		
-		// check if transition occurred on time
-		if(frame_state != EAS_L2_IDLE)
-			dll_gain = DLL_GAIN_SYNC;
-		else
-			dll_gain = DLL_GAIN_UNSYNC;
 
-		// want transitions to take place near 0 phase
-		if((shift_reg ^ (shift_reg >> 1)) & 1)
+		demod_bit(s, f, pos);
+	}
+
+	s->held_f = f;
+}
+
+static void demod_bit(eas_stream *s, float f, unsigned long long pos)
+{
+	float dll_gain;
+
+	// f > 0 if a mark is detected
+	// keep the last few correlator samples in shift_reg
+	// when we've synchronized to the bit transitions, the shift_reg
+	// will have (nearly) a single value per symbol
+	s->shift_reg <<= 1;
+	s->shift_reg |= (f > 0);
+
+	// the integrator is positive for 1 bits, and negative for 0 bits
+	if(f > 0 && (s->dcd_integrator < INTEGRATOR_MAXVAL))
+	{
+		s->dcd_integrator += 1;
+	}
+	else if(f < 0 && s->dcd_integrator > -INTEGRATOR_MAXVAL)
+	{
+		s->dcd_integrator -= 1;
+	}
+	
+	// check if transition occurred on time
+	if(s->frame_state != EAS_L2_IDLE)
+		dll_gain = DLL_GAIN_SYNC;
+	else
+		dll_gain = DLL_GAIN_UNSYNC;
+
+	// want transitions to take place near 0 phase
+	if((s->shift_reg ^ (s->shift_reg >> 1)) & 1)
+	{
+		if(s->sphase < (0x8000u-(SPHASEINC/8)))
 		{
-			if(sphase < (0x8000u-(SPHASEINC/8)))
+			// before center; check for decrement
+			if(s->sphase > (SPHASEINC/2))
 			{
-				// before center; check for decrement
-				if(sphase > (SPHASEINC/2))
-				{
-					sphase -= MIN((int)((sphase)*dll_gain), DLL_MAX_INC);
-					//verbprintf(10,"|-%d|", MIN((int)((sphase)*dll_gain), DLL_MAX_INC));
-				}
+				s->sphase -= MIN((int)((s->sphase)*dll_gain), DLL_MAX_INC);
+				//verbprintf(10,"|-%d|", MIN((int)((sphase)*dll_gain), DLL_MAX_INC));
 			}
-			else
+		}
+		else
+		{
+			// after center; check for increment
+			if(s->sphase < (0x10000u - SPHASEINC/2))
 			{
-				// after center; check for increment
-				if(sphase < (0x10000u - SPHASEINC/2))
-				{
-					sphase += MIN((int)((0x10000u - sphase)* dll_gain), DLL_MAX_INC);
-					//verbprintf(10,"|+%d|", MIN((int)((0x10000u - sphase)* dll_gain), DLL_MAX_INC));
-				}
+				s->sphase += MIN((int)((0x10000u - s->sphase)* dll_gain), DLL_MAX_INC);
+				//verbprintf(10,"|+%d|", MIN((int)((0x10000u - sphase)* dll_gain), DLL_MAX_INC));
 			}
 		}
+	}
 
-		sphase += (unsigned int)SPHASEINC;
+	s->sphase += (unsigned int)SPHASEINC;
+	
+	// end of bit period?
+	if(s->sphase >= 0x10000u)
+	{
+		s->sphase = 1;
+		s->sample_pos = pos;
+		s->current_kar >>= 1;
 		
-		// end of bit period?
-		if(sphase >= 0x10000u)
+		// if at least half of the values in the integrator are 1, 
+		// declare a 1 received
+		s->current_kar |= ((s->dcd_integrator >= 0) << 7) & 0x80;
+		
+		// check for sync sequence
+		// do not resync when we're reading a message!
+		if(s->current_kar == PREAMBLE && s->frame_state != EAS_L2_READING_MESSAGE)
 		{
-			sphase = 1;
-			current_kar >>= 1;
-			
-			// if at least half of the values in the integrator are 1, 
-			// declare a 1 received
-			current_kar |= ((dcd_integrator >= 0) << 7) & 0x80;
-			
-			// check for sync sequence
-			// do not resync when we're reading a message!
-			if(current_kar == PREAMBLE && frame_state != EAS_L2_READING_MESSAGE)
+			// sync found; declare current offset as byte sync
+			if(!s->decoder_synced)
+				EAS_PROBE2(sync_acquire, s->id, s->sample_pos);
+
+			s->decoder_synced = 1;
+			s->bit_counter = 0;
+			//verbprintf(9, " sync");
+
+			// a preamble starts a new frame; characters collected while
+			// still locked to the previous burst's timing are noise
+			if(s->frame_state == EAS_L2_HEADER_SEARCH)
 			{
-				// sync found; declare current offset as byte sync
-				decoder_synced = 1;
-				bit_counter = 0;
-				//verbprintf(9, " sync");
+				s->frame_state = EAS_L2_IDLE;
+				s->headlen = 0;
 			}
-			else if(decoder_synced)
+		}
+		else if(s->decoder_synced)
+		{
+			s->bit_counter++;
+
+			if(s->bit_counter == 8)
 			{
-				bit_counter++;
+				EAS_PROBE4(char, s->id, s->sample_pos, s->current_kar, s->frame_state);
 
-				if(bit_counter == 8)
+				if(eas_allowed((char)s->current_kar))
 				{
-					if(eas_allowed((char)current_kar))
-					{
-						process_frame_char((char)current_kar);
-					}
-					else
-					{
-						//lose sync
-						decoder_synced = 0;
-						process_frame_char(0x00);
-					}
-
-					bit_counter = 0;
+					process_frame_char(s, (char)s->current_kar);
+				}
+				else
+				{
+					//lose sync
+					s->decoder_synced = 0;
+					EAS_PROBE3(sync_lost, s->id, s->sample_pos, s->frame_state);
+					process_frame_char(s, 0x00);
 				}
+
+				s->bit_counter = 0;
 			}
 		}
 	}
@@ -0,0 +1,393 @@
+/*
+*      easproc.h -- Emergency Alert System encoder/decoder interface
+*
+*      Copyright (C) 2013
+*          M. Weber <mweber@gatech.edu>
+*
+*      This program is free software; you can redistribute it and/or modify
+*      it under the terms of the GNU General Public License as published by
+*      the Free Software Foundation; either version 2 of the License, or
+*      (at your option) any later version.
+*/
+
+#ifndef EASPROC_H
+#define EASPROC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct eas_stream eas_stream;
+
+// stages an allocation can be charged to
+enum EAS_Stage
+{
+	EAS_STAGE_SETUP = 0,                  // stream open/close and configuration
+	EAS_STAGE_INGEST = 1,                 // int16 -> float conversion
+	EAS_STAGE_DEMOD = 2,                  // eas_demod()
+	EAS_STAGE_FRAMING = 3,                // process_frame_char()
+	EAS_STAGE_EVENT = 4,                  // message emission
+	EAS_STAGE_COUNT = 5,
+};
+
+// decoder events
+enum EAS_Event
+{
+	EAS_EVENT_PART = 0,                   // one header copy received
+	EAS_EVENT_START = 1,                  // header voted; message begins
+	EAS_EVENT_END = 2,                    // message completed by EOM
+	EAS_EVENT_EOM = 3,                    // end of message burst received
+	EAS_EVENT_FAULT = 4,                  // sustained input fault raised
+	EAS_EVENT_FAULT_CLEAR = 5,            // input fault cleared
+};
+
+// input health faults
+#define EAS_FAULT_DEAD_AIR 0x01           // silence or near-silence
+#define EAS_FAULT_CLIPPING 0x02           // samples at full scale
+#define EAS_FAULT_DC 0x04                 // DC offset
+
+struct eas_event
+{
+	int type;                             // EAS_Event
+	int stream;                           // stream id
+	unsigned long long offset;            // sample offset of the event
+	int fault;                            // EAS_FAULT_* for fault events
+	const char *message;                  // header body after "ZCZC", or 0
+};
+
+typedef void (*eas_event_fn)(const struct eas_event *ev, void *ctx);
+
+// per-block input health, updated during int16 -> float conversion
+struct eas_health
+{
+	float rms;                            // last block, full scale = 1.0
+	float peak;
+	float dc;
+	unsigned long clips;                  // samples at full scale in last block
+	unsigned long long clips_total;
+	unsigned long long silence_run;       // current run of exact zero samples
+	int faults;                           // EAS_FAULT_* currently raised
+};
+
+struct eas_stats
+{
+	unsigned long long samples;
+	struct eas_health health;
+	float quality;                        // bit quality of the last header copy, 1 = clean, 0 = coin toss
+	int engine;                           // EAS_Engine in use
+};
+
+// one block of input for eas_push_batch()
+struct eas_block
+{
+	eas_stream *s;
+	const short *samples;
+	int count;
+};
+
+// allocator hook; all decoder allocations go through eas_malloc()/eas_free().
+// On glibc any other malloc() made while a stream decodes (a handler's, or
+// stdio's) is charged to the stream's stage as well, and trapped by strict mode
+void eas_set_allocator(void *(*alloc_fn)(size_t), void (*free_fn)(void *));
+void eas_alloc_strict(int enable);
+void *eas_malloc(eas_stream *s, size_t size);
+void eas_free(eas_stream *s, void *ptr);
+unsigned long eas_alloc_count(const eas_stream *s, int stage);
+
+// streaming decoder
+eas_stream *eas_open(int id);
+void eas_close(eas_stream *s);
+void eas_push(eas_stream *s, const short *samples, int count);
+void eas_push_batch(const struct eas_block *blocks, int nblocks);
+void eas_skip(eas_stream *s, unsigned long long count);
+void eas_set_engine(eas_stream *s, int engine);
+int eas_get_engine(const eas_stream *s);
+// pick the cheapest engine recent bursts decoded cleanly on; vote failures fall back to full
+void eas_set_adaptive(eas_stream *s, int enable);
+void eas_set_adaptive_ladder(const int *engines);
+void eas_set_event_handler(eas_stream *s, eas_event_fn fn, void *ctx);
+void eas_get_stats(const eas_stream *s, struct eas_stats *st);
+int eas_fsk_active(const eas_stream *s);
+void eas_print_event(const struct eas_event *ev);
+
+// decoder engines, most to least expensive
+enum EAS_Engine
+{
+	EAS_ENGINE_FULL = 0,                  // correlate every sample
+	EAS_ENGINE_GATED = 1,                 // sparse tone search until FSK shows up
+	EAS_ENGINE_DECIMATED = 2,             // correlate every third sample
+	EAS_ENGINE_ONEBIT = 3,                // hard-limited input, XOR/popcount correlator
+	EAS_ENGINE_COUNT,
+};
+
+// diagnostics; set before eas_open(). -1 if the name has a '%' other than
+// one "%d" for the stream id
+int eas_spectrogram(const char *pattern);
+
+// attention signals
+enum EAS_Tone
+{
+	EAS_TONE_NONE = 0,
+	EAS_TONE_WXR = 1,                     // 1050 Hz, NOAA Weather Radio
+	EAS_TONE_EAS = 2,                     // 853 + 960 Hz
+};
+
+// encoder output formats
+enum EAS_Format
+{
+	EAS_FMT_S16 = 0,                      // raw int16, host order
+	EAS_FMT_F32 = 1,                      // raw float32, full scale = 1.0
+	EAS_FMT_WAV_S16 = 2,                  // WAV container, 16-bit PCM
+	EAS_FMT_WAV_F32 = 3,                  // WAV container, 32-bit float
+};
+
+// one complete transmission: headers x3, attention signal, voice, EOM x3
+struct eas_tx
+{
+	const char *header;                   // "ZCZC-..."
+	int tone;                             // EAS_Tone
+	double tone_sec;                      // attention signal length
+	const char *voice;                    // raw int16 voice file at rate, or 0
+	int rate;                             // 8000..48000 Hz, 0 = 22050
+	int format;                           // EAS_Format
+};
+
+int decode(const char *fname);
+void encode(const char *message, const char *fname);
+int eas_compose(const struct eas_tx *tx, const char *fname);
+int encode_samples(const char *message, short **samples);
+// three bursts of "ZCZC-..." or "NNNN" into buf; -1 if buf is too small
+int eas_render(const char *message, short *buf, int max);
+
+// interned immutable strings; equal strings are the same pointer
+struct eas_intern_stats
+{
+	unsigned long strings;                // distinct strings held
+	unsigned long bytes;                  // their bytes, NULs included
+	unsigned long hits;                   // interns that found the string held
+	unsigned long saved;                  // bytes those would have copied
+};
+
+const char *eas_intern(const char *s, int len);
+const char *eas_intern_find(const char *s, int len);
+const char *eas_intern_ref(const char *s);
+void eas_intern_release(const char *s);
+int eas_intern_len(const char *s);
+unsigned int eas_intern_hash(const char *s);
+const char *eas_intern_locations(const char *body);
+void eas_intern_stats(struct eas_intern_stats *st);
+
+// active-alert table; relays of one alert by different stations collapse
+struct eas_alert
+{
+	int used;
+	unsigned int hash;
+	int key_len;                          // bytes of body that identify the alert
+	const char *key;                      // interned, as are body and locations
+	const char *body;                     // header body of the first relay seen
+	const char *locations;                // "-PSSCCC-..." location codes, or 0
+	double first_seen;
+	double last_seen;
+	double expires;
+	int ended;                            // EOM seen
+	double ended_at;
+	unsigned long relays;
+	int first_stream;
+	int last_stream;
+};
+
+struct eas_alert_stats
+{
+	unsigned long observed;               // voted headers offered
+	unsigned long inserted;               // new alerts
+	unsigned long duplicates;             // relays of an active alert
+	unsigned long expired;
+	unsigned long overflows;              // new alerts dropped, table full
+};
+
+struct eas_alert_table;
+
+struct eas_alert_table *eas_alerts_create(int capacity, double window);
+void eas_alerts_destroy(struct eas_alert_table *t);
+int eas_alert_key_len(const char *body);
+const struct eas_alert *eas_alerts_observe(struct eas_alert_table *t, const char *body, int stream, double now, int *is_new);
+void eas_alerts_end(struct eas_alert_table *t, const char *body, double now);
+int eas_alerts_expire(struct eas_alert_table *t, double now);
+int eas_alerts_count(const struct eas_alert_table *t);
+void eas_alerts_foreach(const struct eas_alert_table *t, void (*fn)(const struct eas_alert *a, void *ctx), void *ctx);
+void eas_alerts_stats(const struct eas_alert_table *t, struct eas_alert_stats *st);
+
+#ifndef _MSC_VER
+// decoder cost model, cpu seconds per second of audio; < 0 if unknown
+const char *eas_engine_name(int engine);
+int eas_cost_calibrate(double seconds);
+double eas_cost(int engine, int rate);
+int eas_cost_save(const char *path);
+int eas_cost_load(const char *path);
+void eas_cost_print(FILE *fp);
+
+// round-robin per-stream metric history in one mapped file
+#define EAS_RRD_ARCHIVES 3                // 1 s, 1 min and 1 h rows
+
+struct eas_rrd;
+
+struct eas_rrd_row
+{
+	double time;                          // start of the interval, wall clock
+	float rate;                           // samples decoded per second
+	float lag;                            // mean seconds of input queued unread
+	float lag_max;
+	float rms;
+	float quality;
+	unsigned int faults;                  // EAS_FAULT_* raised during the interval
+	int engine;                           // EAS_Engine at the end of the interval
+	int pad;
+};
+
+struct eas_rrd *eas_rrd_open(const char *path, int nstreams);
+int eas_rrd_streams(const struct eas_rrd *r);
+double eas_rrd_step(int archive);
+void eas_rrd_update(struct eas_rrd *r, int stream, double t, const struct eas_rrd_row *v);
+int eas_rrd_fetch(const struct eas_rrd *r, int stream, int archive, struct eas_rrd_row *rows, int max);
+void eas_rrd_close(struct eas_rrd *r);
+
+// alert log of parsed voted headers, with an event/location index
+#define EAS_MAX_FIPS 31
+
+struct eas_alert_rec
+{
+	double time;                          // wall clock when voted; 0 if imported
+	unsigned long long seq;               // imported: file number << 40 | byte offset
+	int stream;                           // -1 if imported
+	char org[4];
+	char event[4];
+	char station[12];
+	unsigned short purge;                 // minutes
+	unsigned short issue_day;             // day of the year
+	unsigned short issue_min;             // minutes past midnight UTC
+	unsigned char nfips;
+	unsigned char ended;                  // EOM seen
+	unsigned int fips[EAS_MAX_FIPS];      // PSSCCC
+};
+
+struct eas_alertlog;
+
+int eas_header_parse(const char *body, struct eas_alert_rec *r);
+void eas_header_format(const struct eas_alert_rec *r, char *buf, int len);
+struct eas_alertlog *eas_alertlog_create(const char *path);
+int eas_alertlog_append(struct eas_alertlog *l, const struct eas_alert_rec *r, int n);
+int eas_alertlog_end(struct eas_alertlog *l, unsigned long long i);
+struct eas_alertlog *eas_alertlog_open(const char *path);
+unsigned long long eas_alertlog_count(const struct eas_alertlog *l);
+const struct eas_alert_rec *eas_alertlog_get(const struct eas_alertlog *l, unsigned long long i);
+unsigned long long eas_alertlog_indexed(const struct eas_alertlog *l);
+int eas_alertlog_index(const char *path);
+unsigned long eas_alertlog_query(const struct eas_alertlog *l, const char *event, int fips,
+	void (*fn)(const struct eas_alert_rec *r, unsigned long long i, void *ctx), void *ctx);
+void eas_alertlog_close(struct eas_alertlog *l);
+
+// multi-stream live decoder
+typedef struct eas_runtime eas_runtime;
+
+struct eas_runtime_stream_stats
+{
+	unsigned long long samples;           // samples read and decoded
+	unsigned long reads;
+	double lag;                           // seconds of audio queued unread
+	int engine;                           // EAS_Engine in use
+	int rung;                             // steps down the degradation ladder, 0 = not degraded
+	float rms;                            // input health of the last block
+	int faults;                           // EAS_FAULT_* currently raised
+	float quality;                        // of the last header copy
+};
+
+eas_runtime *eas_runtime_create(int max_streams);
+// add/add_fd return the stream id, -1 on error, -2 if the cpu budget is spent
+int eas_runtime_add(eas_runtime *rt, const char *path);
+int eas_runtime_add_fd(eas_runtime *rt, int fd, const char *name);
+void eas_runtime_set_event_handler(eas_runtime *rt, eas_event_fn fn, void *ctx);
+void eas_runtime_set_tick(eas_runtime *rt, double interval, void (*fn)(eas_runtime *rt, void *ctx), void *ctx);
+void eas_runtime_set_coalesce(eas_runtime *rt, double budget);
+void eas_runtime_set_cpu_budget(eas_runtime *rt, double cpus);
+double eas_runtime_capacity(const eas_runtime *rt, int *streams);
+void eas_runtime_set_degrade(eas_runtime *rt, double lag_high, double lag_low);
+int eas_runtime_set_priority(eas_runtime *rt, int id, int priority);
+void eas_runtime_set_adaptive(eas_runtime *rt, int enable);
+void eas_runtime_set_history(eas_runtime *rt, struct eas_rrd *rrd);
+int eas_runtime_stream_stats(const eas_runtime *rt, int id, struct eas_runtime_stream_stats *rs);
+int eas_runtime_run(eas_runtime *rt);
+void eas_runtime_stop(eas_runtime *rt);
+unsigned long eas_runtime_wakeups(const eas_runtime *rt);
+// virtual clock and inputs for scheduler simulation; set before adding streams
+void eas_runtime_set_virtual(eas_runtime *rt);
+int eas_runtime_is_virtual(const eas_runtime *rt);
+int eas_runtime_add_virtual(eas_runtime *rt, const char *name);
+int eas_runtime_write(eas_runtime *rt, int id, const short *samples, int count);
+int eas_runtime_close_input(eas_runtime *rt, int id);
+double eas_runtime_now(const eas_runtime *rt);
+double eas_runtime_busy(const eas_runtime *rt);
+void eas_runtime_report(const eas_runtime *rt, FILE *fp);
+void eas_runtime_destroy(eas_runtime *rt);
+
+// paced in-process input; fill returns samples produced, <= 0 at end
+typedef int (*eas_feed_fill)(void *ctx, int stream, short *buf, int max);
+struct eas_feed;
+
+struct eas_feed *eas_feed_create(eas_runtime *rt, int nstreams, double speed, eas_feed_fill fill, void *ctx);
+int eas_feed_pump(struct eas_feed *f, double now);
+int eas_feed_stream(const struct eas_feed *f, int runtime_id);
+double eas_feed_write_time(const struct eas_feed *f, int stream, unsigned long long offset);
+unsigned long long eas_feed_written(const struct eas_feed *f, int stream);
+unsigned long eas_feed_stalls(const struct eas_feed *f, int stream);
+void eas_feed_destroy(struct eas_feed *f);
+
+// single-producer single-consumer sample ring in shared memory
+struct eas_ring;
+
+struct eas_ring *eas_ring_create(const char *name, int samples);
+struct eas_ring *eas_ring_open(const char *name);
+int eas_ring_write(struct eas_ring *r, const short *samples, int count);
+int eas_ring_read(struct eas_ring *r, short *samples, int max);
+short *eas_ring_write_span(struct eas_ring *r, int *count);
+void eas_ring_commit(struct eas_ring *r, int count);
+const short *eas_ring_read_span(struct eas_ring *r, int *count);
+void eas_ring_consume(struct eas_ring *r, int count);
+void eas_ring_close_writer(struct eas_ring *r);
+void eas_ring_destroy(struct eas_ring *r);
+
+// indexed clip corpus, mapped read-only; clips point into the mapping
+struct eas_corpus;
+
+struct eas_clip
+{
+	const char *name;
+	const short *samples;
+	unsigned long long count;
+	int ntruth;                           // ground-truth headers the clip must vote
+	const char *truth;                    // ntruth NUL-terminated bodies after "ZCZC"
+};
+
+int eas_corpus_probe(const char *path);
+struct eas_corpus *eas_corpus_open(const char *path);
+int eas_corpus_count(const struct eas_corpus *c);
+int eas_corpus_clip(const struct eas_corpus *c, int i, struct eas_clip *clip);
+void eas_corpus_close(struct eas_corpus *c);
+
+// tools
+int replay_main(int argc, char **argv);
+int soak_main(int argc, char **argv);
+int fleet_main(int argc, char **argv);
+int relay_main(int argc, char **argv);
+int latency_main(int argc, char **argv);
+int batch_main(int argc, char **argv);
+int calibrate_main(int argc, char **argv);
+int corpus_main(int argc, char **argv);
+int coldstart_main(int argc, char **argv);
+int shard_main(int argc, char **argv);
+int history_main(int argc, char **argv);
+int alertlog_main(int argc, char **argv);
+int snr_main(int argc, char **argv);
+int burst_main(int argc, char **argv);
+int strict_main(int argc, char **argv);
+#endif
+
+#endif
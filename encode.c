@@ -1,3 +1,6 @@
+#ifndef _MSC_VER
+#define _GNU_SOURCE                       // copy_file_range(), splice()
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -10,7 +13,9 @@
 #include <time.h>
 #ifndef _MSC_VER
 #include <unistd.h>
+#include <sys/stat.h>
 #endif
+#include "easproc.h"
 
 /*
 * Bit Parameters
@@ -32,35 +37,370 @@
 
 #define FREQ_MARK  2083.3                 // binary 1 freq, in Hz
 #define FREQ_SPACE 1562.5                 // binary 0 freq, in Hz
-#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+#define FREQ_SAMP  22050                  // default output sampling rate, in Hz
+#define RATE_MIN   8000                   // output sampling rate range, in Hz
+#define RATE_MAX   48000
 #define BAUD       520.83                 // symbol rate, in Hz
 #define PREAMBLE   ((unsigned char)0xAB)  // preamble byte, MSB first
 #define HEADER_BEGIN "ZCZC"               // message begin
 #define EOM "NNNN"                        // message end
-#define CORRLEN ((int)(FREQ_SAMP/BAUD))
+#define MAX_SPB    94                     // samples per bit at RATE_MAX, rounded up
+#define FREQ_WXR   1050.0                 // NWS attention tone, in Hz
+#define FREQ_EAS_LO 853.0                 // EAS two-tone attention signal, in Hz
+#define FREQ_EAS_HI 960.0
+#define TONE_AMPL  16000.0                // attention tone amplitude
+#define VOICE_CHUNK (1 << 20)             // bytes per zero-copy call
+#define WAV_HEADER 44                     // canonical RIFF/WAVE header size
+#define CONV_LEN   1024                   // samples per int16 -> float32 batch
 
-static short silence[FREQ_SAMP] = { 0 };
-static void generate_byte(unsigned char data, unsigned short *stream);
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
 
-void encode(const char *message, const char *fname)
+static short silence[4096] = { 0 };
+
+// encoder output: a file descriptor, or a growing int16 buffer when fd < 0
+struct enc_out
 {
-	int fd, i, rep, ret;
-	short buffer[CORRLEN * 8];
-	unsigned char full_message[268 + 2 + 1];
-	unsigned char footer[7];
+	int fd;
+	short *buf;
+	int len;
+	int cap;
+	int fixed;                            // buf belongs to the caller; never grown
+	int overflow;                         // fixed buf was too small
+	int error;                            // a write to fd failed; errno is set
+
+	int rate;
+	int format;                           // EAS_Format
+	double spb;                           // samples per bit, fractional
+	unsigned long long bits;              // bits rendered so far
+	unsigned long long frames;            // samples rendered so far
+
+	// one bit period of each tone at this rate; a byte is eight copies
+	short mark[MAX_SPB];
+	short space[MAX_SPB];
+};
+
+static int enc_init(struct enc_out *o, int rate, int format)
+{
+	int i;
+
+	if(rate < RATE_MIN || rate > RATE_MAX || format < EAS_FMT_S16 || format > EAS_FMT_WAV_F32)
+		return -1;
+
+	o->rate = rate;
+	o->format = format;
+	o->spb = rate / BAUD;
+	o->bits = 0;
+	o->frames = 0;
+
+	for(i = 0; i < MAX_SPB; i++)
+	{
+		o->mark[i] = (short)(32767.0 * sin(2.0*3.14159265359*FREQ_MARK*i/rate));
+		o->space[i] = (short)(32767.0 * sin(2.0*3.14159265359*FREQ_SPACE*i/rate));
+	}
+
+	return 0;
+}
+
+static int enc_float(const struct enc_out *o)
+{
+	return o->format == EAS_FMT_F32 || o->format == EAS_FMT_WAV_F32;
+}
+
+static void s16_to_f32(const short *in, float *out, int n)
+{
+	__m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	__m128i v, lo, hi;
+	int i;
+
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		// sign-extend by unpacking into the high half and shifting back
+		v = _mm_loadu_si128((const __m128i *)&in[i]);
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(&out[i + 4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+
+	for(; i < n; i++)
+		out[i] = in[i] / 32768.0f;
+}
+
+// the whole buffer or nothing: short writes are retried, and a failure
+// sticks so the caller can report it once the transmission is done
+static void enc_write(struct enc_out *o, const void *data, size_t len)
+{
+	const char *p = data;
+	long n;
+
+	for(; len > 0 && !o->error; p += n, len -= n)
+	{
+		if((n = write(o->fd, p, len)) > 0)
+			continue;
+
+		if(n < 0 && errno == EINTR)
+		{
+			n = 0;
+			continue;
+		}
+
+		// a zero-length write means no room left
+		if(!n)
+			errno = ENOSPC;
+		o->error = 1;
+		return;
+	}
+}
+
+static void enc_put(struct enc_out *o, const short *data, int count)
+{
+	float conv[CONV_LEN];
+	short *p;
+	int cap, n;
+
+	o->frames += count;
+
+	if(o->fd >= 0 && enc_float(o))
+	{
+		for(; count > 0; data += n, count -= n)
+		{
+			n = MIN(count, CONV_LEN);
+			s16_to_f32(data, conv, n);
+			enc_write(o, conv, sizeof(float)*n);
+		}
+		return;
+	}
+
+	if(o->fd >= 0)
+	{
+		enc_write(o, data, sizeof(short)*count);
+		return;
+	}
+
+	if(o->len + count > o->cap && o->fixed)
+	{
+		o->overflow = 1;
+		return;
+	}
+
+	if(o->len + count > o->cap)
+	{
+		cap = MAX(o->cap * 2, o->len + count);
+		if(!(p = realloc(o->buf, sizeof(short)*cap)))
+			return;
+
+		o->buf = p;
+		o->cap = cap;
+	}
+
+	memcpy(&o->buf[o->len], data, sizeof(short)*count);
+	o->len += count;
+}
+
+static void enc_silence(struct enc_out *o, int count)
+{
+	int n;
+
+	for(; count > 0; count -= n)
+	{
+		n = MIN(count, (int)(sizeof(silence)/sizeof(silence[0])));
+		enc_put(o, silence, n);
+	}
+}
+
+static void enc_byte(struct enc_out *o, unsigned char data)
+{
+	short buffer[MAX_SPB * 8];
+	long long start, end;
+	int b, n = 0;
+
+	// bit edges fall on the nearest sample to k * rate / baud, so every
+	// rate keeps the nominal 520.83 baud over the whole burst
+	for(b = 0; b < 8; b++, o->bits++)
+	{
+		start = (long long)(o->bits * o->spb + 0.5);
+		end = (long long)((o->bits + 1) * o->spb + 0.5);
+
+		memcpy(&buffer[n], (data >> b) & 0x01 ? o->mark : o->space, sizeof(short)*(end - start));
+		n += (int)(end - start);
+	}
+
+	enc_put(o, buffer, n);
+}
+
+static void enc_bursts(struct enc_out *o, const unsigned char *data)
+{
+	int i, rep;
+
+	for(rep = 0; rep < 3; rep++)
+	{
+		for(i = 0; data[i]; i++)
+			enc_byte(o, data[i]);
+
+		enc_silence(o, o->rate);
+	}
+}
+
+static void enc_tone(struct enc_out *o, int tone, double seconds)
+{
+	short buffer[4096];
+	double w1, w2, a;
+	long i, n, total;
+	int k;
+
+	switch(tone)
+	{
+	case EAS_TONE_WXR:
+		w1 = w2 = 2.0*3.14159265359*FREQ_WXR/o->rate;
+		break;
+	case EAS_TONE_EAS:
+		w1 = 2.0*3.14159265359*FREQ_EAS_LO/o->rate;
+		w2 = 2.0*3.14159265359*FREQ_EAS_HI/o->rate;
+		break;
+	default:
+		return;
+	}
+
+	total = (long)(seconds * o->rate);
+
+	for(i = 0; i < total; i += n)
+	{
+		n = MIN(total - i, (long)(sizeof(buffer)/sizeof(buffer[0])));
+
+		for(k = 0; k < n; k++)
+		{
+			a = (double)(i + k);
+			buffer[k] = (short)(TONE_AMPL * 0.5 * (sin(w1 * a) + sin(w2 * a)));
+		}
+
+		enc_put(o, buffer, (int)n);
+	}
+
+	//1 second pause
+	enc_silence(o, o->rate);
+}
+
+static void put_le(unsigned char *p, unsigned long v, int bytes)
+{
+	int i;
+
+	for(i = 0; i < bytes; i++)
+		p[i] = (unsigned char)(v >> (8 * i));
+}
+
+// RIFF/WAVE header; sizes are unknown (0xffffffff) until the output is complete
+static void enc_wav_header(struct enc_out *o, int final)
+{
+	unsigned char h[WAV_HEADER];
+	int width = enc_float(o) ? 4 : 2;
+	unsigned long data = final ? (unsigned long)(o->frames * width) : 0xffffffffUL;
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, final ? data + WAV_HEADER - 8 : 0xffffffffUL, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, enc_float(o) ? 3 : 1, 2);   // IEEE float or PCM
+	put_le(h + 22, 1, 2);
+	put_le(h + 24, o->rate, 4);
+	put_le(h + 28, o->rate * width, 4);
+	put_le(h + 32, width, 2);
+	put_le(h + 34, width * 8, 2);
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, data, 4);
+
+	enc_write(o, h, WAV_HEADER);
+}
+
+// copy a raw voice file into the output; returns bytes copied or -1
+static long long enc_voice_copy(int out, int in, long long len)
+{
+	char buffer[8192];
+	long long done = 0, n = 0;
+#ifndef _MSC_VER
+	struct stat st;
+	loff_t off = 0;
+	int pipe_out = !fstat(out, &st) && S_ISFIFO(st.st_mode);
+
+	// let the kernel move the data: splice() into a pipe, copy_file_range()
+	// between files; either may be unsupported for this pair of fds
+	while(done < len)
+	{
+		if(pipe_out)
+			n = splice(in, &off, out, 0, MIN(len - done, VOICE_CHUNK), SPLICE_F_MOVE);
+		else
+			n = copy_file_range(in, &off, out, 0, MIN(len - done, VOICE_CHUNK), 0);
+
+		if(n <= 0)
+			break;
+
+		done += n;
+	}
+
+	if(done == len)
+		return done;
+
+	if(n < 0 && errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP)
+		return -1;
+
+	lseek(in, off, SEEK_SET);
+#endif
+
+	while(done < len && (n = read(in, buffer, (size_t)MIN(len - done, (long long)sizeof(buffer)))) > 0)
+	{
+		if(write(out, buffer, n) != n)
+			return -1;
+
+		done += n;
+	}
+
+	return done;
+}
+
+static int enc_voice(struct enc_out *o, const char *fname)
+{
+	long long len;
+	short buffer[4096];
+	int fd, n;
 
 #ifdef _MSC_VER
-	if ((fd = open(fname, O_WRONLY | O_CREAT | O_BINARY)) < 0) {
+	if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0) {
 #else
-	if ((fd = open(fname, O_WRONLY | O_CREAT)) < 0) {
+	if ((fd = open(fname, O_RDONLY)) < 0) {
 #endif
-		return;
+		return -1;
+	}
+
+	// whole samples only, so the EOM stays sample-aligned
+	len = lseek(fd, 0, SEEK_END) & ~1LL;
+	lseek(fd, 0, SEEK_SET);
+
+	// int16 output takes the file as is; float output is converted
+	if(o->fd >= 0 && !enc_float(o))
+	{
+		o->frames += len / sizeof(short);
+		n = enc_voice_copy(o->fd, fd, len) == len ? 0 : -1;
+		close(fd);
+		return n;
 	}
 
+	while((n = read(fd, buffer, sizeof(buffer))) > 0)
+		enc_put(o, buffer, n / sizeof(short));
+
+	close(fd);
+	return 0;
+}
+
+static int enc_message(struct enc_out *o, const struct eas_tx *tx)
+{
+	unsigned char full_message[268 + 2 + 1];
+	unsigned char footer[7];
+	int ret = 0;
+
 	memset(full_message, 0, 268 + 2 + 1);
 	full_message[0] = PREAMBLE;
 	full_message[1] = PREAMBLE;
-	memcpy(&full_message[2], message, strlen(message));
+	memcpy(&full_message[2], tx->header, MIN(strlen(tx->header), 268));
 
 	footer[0] = PREAMBLE;
 	footer[1] = PREAMBLE;
@@ -70,62 +410,111 @@ void encode(const char *message, const char *fname)
 	footer[5] = 'N';
 	footer[6] = 0x00;
 
-	for(rep = 0; rep < 3; rep++)
-	{
-		for(i = 0; i < strlen(full_message); i++)
-		{
-			generate_byte(full_message[i], buffer);
-			ret = write(fd, buffer, sizeof(short)*CORRLEN*8);
-		}
-
-		write(fd, silence, sizeof(short)*FREQ_SAMP);
-	}
+	enc_bursts(o, full_message);
 
 	//2 second pause
-	write(fd, silence, sizeof(short)*FREQ_SAMP);
-	write(fd, silence, sizeof(short)*FREQ_SAMP);
+	enc_silence(o, 2 * o->rate);
+
+	enc_tone(o, tx->tone, tx->tone_sec);
 
 	//the audio!
+	if(tx->voice)
+		ret = enc_voice(o, tx->voice);
 
 	//2 second pause
-	write(fd, silence, sizeof(short)*FREQ_SAMP);
-	write(fd, silence, sizeof(short)*FREQ_SAMP);
+	enc_silence(o, 2 * o->rate);
 
 	//the footer
-	for(rep = 0; rep < 3; rep++)
+	enc_bursts(o, footer);
+
+	return ret;
+}
+
+int eas_compose(const struct eas_tx *tx, const char *fname)
+{
+	struct enc_out o;
+	int ret;
+
+	memset(&o, 0, sizeof(o));
+
+	if(enc_init(&o, tx->rate ? tx->rate : FREQ_SAMP, tx->format) < 0)
 	{
-		for(i = 0; i < strlen(footer); i++)
-		{
-			generate_byte(footer[i], buffer);
-			write(fd, buffer, sizeof(short)*CORRLEN*8);
-		}
+		errno = EINVAL;
+		return -1;
+	}
 
-		write(fd, silence, sizeof(short)*FREQ_SAMP);
+#ifdef _MSC_VER
+	if ((o.fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644)) < 0) {
+#else
+	if ((o.fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+#endif
+		return -1;
 	}
 
-	close(fd);
+	if(o.format == EAS_FMT_WAV_S16 || o.format == EAS_FMT_WAV_F32)
+		enc_wav_header(&o, 0);
+
+	ret = enc_message(&o, tx);
+
+	// fill in the sizes when the output can be rewound (not on a pipe)
+	if(!o.error && (o.format == EAS_FMT_WAV_S16 || o.format == EAS_FMT_WAV_F32) && lseek(o.fd, 0, SEEK_SET) == 0)
+		enc_wav_header(&o, 1);
+
+	// close() can be the first to see a failed delayed write
+	if(close(o.fd) < 0 && !o.error)
+		o.error = 1;
+
+	return o.error ? -1 : ret;
 }
 
-static void generate_byte(unsigned char data, unsigned short *stream)
+void encode(const char *message, const char *fname)
 {
-	float f;
-	unsigned short *ptr;
-	int offset = 0, i, b, bit;
+	struct eas_tx tx;
 
-	ptr = stream;
+	// headers and EOMs only
+	memset(&tx, 0, sizeof(tx));
+	tx.header = message;
 
-	for(b = 0; b < 8; b++)
-	{
-		bit = (data >> b) & 0x01;
+	eas_compose(&tx, fname);
+}
 
-		for(f = 0, i = 0; i < CORRLEN; i++)
-		{
-			(*ptr++) = (short)(32768.0 * sin(f));
+int encode_samples(const char *message, short **samples)
+{
+	struct enc_out o;
+	struct eas_tx tx;
 
-			if(bit)
-				f += (float)(2.0*3.14159265359*FREQ_MARK/FREQ_SAMP);
-			else
-				f += (float)(2.0*3.14159265359*FREQ_SPACE/FREQ_SAMP);
-		}
-	}
-}
\ No newline at end of file
+	// same transmission as encode(), rendered into a malloc()ed buffer
+	memset(&o, 0, sizeof(o));
+	enc_init(&o, FREQ_SAMP, EAS_FMT_S16);
+	o.fd = -1;
+	memset(&tx, 0, sizeof(tx));
+	tx.header = message;
+
+	enc_message(&o, &tx);
+
+	*samples = o.buf;
+	return o.len;
+}
+
+int eas_render(const char *message, short *buf, int max)
+{
+	struct enc_out o;
+	unsigned char burst[268 + 2 + 1];
+
+	// no allocation: the bursts go straight into the caller's buffer
+	memset(&o, 0, sizeof(o));
+	enc_init(&o, FREQ_SAMP, EAS_FMT_S16);
+	o.fd = -1;
+	o.buf = buf;
+	o.cap = max;
+	o.fixed = 1;
+
+	memset(burst, 0, sizeof(burst));
+	burst[0] = PREAMBLE;
+	burst[1] = PREAMBLE;
+	memcpy(&burst[2], message, MIN(strlen(message), 268));
+
+	enc_bursts(&o, burst);
+
+	return o.overflow ? -1 : o.len;
+}
@@ -0,0 +1,254 @@
+/*
+*      feed.c -- paced in-process input for the live runtime
+*
+*      Load tools generate each stream's audio on demand through a fill
+*      callback and eas_feed_pump() writes it into one pipe per stream at
+*      (a multiple of) real-time pace. The wall time every 20 ms of audio
+*      reached its pipe is kept so decoder events can be turned into
+*      end-to-end latencies.
+*
+*      On a virtual runtime the streams are virtual inputs and pumping
+*      queues the audio with eas_runtime_write() at virtual time instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define FEED_CHUNK 441                    // samples per write-time slot (20 ms)
+#define FEED_SLOTS 4096                   // write-time history per stream
+#define FEED_BUF 4410                     // samples staged per stream
+
+struct feed_stream
+{
+	int fd;                               // write end, -1 on a virtual runtime
+	int open;                             // timeline not over
+	int len;                              // staged samples
+	int pos;                              // staged samples already written
+	double owed;                          // samples due but not yet written
+	unsigned long long written;
+	unsigned long stalls;                 // writes cut short by a full pipe
+	double slot_time[FEED_SLOTS];
+	short buf[FEED_BUF];
+};
+
+struct eas_feed
+{
+	int nstreams;
+	int first_id;                         // runtime id of stream 0
+	eas_runtime *rt;                      // set when the runtime is virtual
+	double speed;
+	double last;
+	eas_feed_fill fill;
+	void *ctx;
+	struct feed_stream *streams;
+};
+
+struct eas_feed *eas_feed_create(eas_runtime *rt, int nstreams, double speed, eas_feed_fill fill, void *ctx)
+{
+	struct eas_feed *f;
+	int i, id, fds[2];
+
+	if(!(f = calloc(1, sizeof(*f))) || !(f->streams = calloc(nstreams, sizeof(f->streams[0]))))
+	{
+		free(f);
+		return 0;
+	}
+
+	f->nstreams = nstreams;
+	f->speed = speed;
+	f->fill = fill;
+	f->ctx = ctx;
+	f->last = -1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i = 0; i < nstreams; i++)
+		f->streams[i].fd = -1;
+
+	if(eas_runtime_is_virtual(rt))
+		f->rt = rt;
+
+	for(i = 0; i < nstreams; i++)
+	{
+		f->streams[i].open = 1;
+
+		if(f->rt)
+		{
+			if((id = eas_runtime_add_virtual(rt, "feed")) < 0)
+			{
+				eas_feed_destroy(f);
+				return 0;
+			}
+		}
+		else
+		{
+			if(pipe(fds) < 0)
+			{
+				perror("pipe");
+				eas_feed_destroy(f);
+				return 0;
+			}
+
+			fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+			f->streams[i].fd = fds[1];
+
+			if((id = eas_runtime_add_fd(rt, fds[0], "feed")) < 0)
+			{
+				close(fds[0]);
+				eas_feed_destroy(f);
+				return 0;
+			}
+		}
+
+		if(!i)
+			f->first_id = id;
+	}
+
+	return f;
+}
+
+// samples taken by the pipe or virtual input, 0 if full, -1 on error
+static int feed_write(struct eas_feed *f, int i, const short *samples, int count)
+{
+	int w;
+
+	if(f->rt)
+		return eas_runtime_write(f->rt, f->first_id + i, samples, count);
+
+	if((w = write(f->streams[i].fd, samples, count * sizeof(short))) < 0)
+		return errno == EAGAIN ? 0 : -1;
+
+	return w / sizeof(short);
+}
+
+static void feed_stream(struct eas_feed *f, int i, double now)
+{
+	struct feed_stream *fs = &f->streams[i];
+	unsigned long long slot;
+	int n, w;
+
+	while(fs->owed >= 1.0)
+	{
+		if(fs->pos == fs->len)
+		{
+			fs->pos = 0;
+			fs->len = f->fill(f->ctx, i, fs->buf, MIN(FEED_BUF, (int)fs->owed));
+
+			if(fs->len <= 0)
+			{
+				// timeline over; the decoder sees EOF
+				if(f->rt)
+					eas_runtime_close_input(f->rt, f->first_id + i);
+				else
+				{
+					close(fs->fd);
+					fs->fd = -1;
+				}
+				fs->open = 0;
+				fs->len = 0;
+				return;
+			}
+		}
+
+		n = MIN(fs->len - fs->pos, (int)fs->owed);
+
+		if((w = feed_write(f, i, fs->buf + fs->pos, n)) <= 0)
+		{
+			if(!w)
+				fs->stalls++;
+			return;
+		}
+
+		for(slot = fs->written / FEED_CHUNK; slot <= (fs->written + w) / FEED_CHUNK; slot++)
+			fs->slot_time[slot % FEED_SLOTS] = now;
+
+		fs->written += w;
+		fs->pos += w;
+		fs->owed -= w;
+
+		if(w < n)
+		{
+			fs->stalls++;
+			return;
+		}
+	}
+}
+
+int eas_feed_pump(struct eas_feed *f, double now)
+{
+	int i, active = 0;
+
+	if(f->last < 0)
+		f->last = now;
+
+	for(i = 0; i < f->nstreams; i++)
+	{
+		if(!f->streams[i].open)
+			continue;
+
+		f->streams[i].owed += (now - f->last) * FREQ_SAMP * f->speed;
+		feed_stream(f, i, now);
+
+		active += f->streams[i].open;
+	}
+
+	f->last = now;
+	return active;
+}
+
+int eas_feed_stream(const struct eas_feed *f, int runtime_id)
+{
+	int i = runtime_id - f->first_id;
+
+	return i >= 0 && i < f->nstreams ? i : -1;
+}
+
+double eas_feed_write_time(const struct eas_feed *f, int stream, unsigned long long offset)
+{
+	const struct feed_stream *fs = &f->streams[stream];
+	unsigned long long slot = offset / FEED_CHUNK;
+
+	if(offset >= fs->written || fs->written / FEED_CHUNK - slot >= FEED_SLOTS)
+		return -1;
+
+	return fs->slot_time[slot % FEED_SLOTS];
+}
+
+unsigned long long eas_feed_written(const struct eas_feed *f, int stream)
+{
+	return f->streams[stream].written;
+}
+
+unsigned long eas_feed_stalls(const struct eas_feed *f, int stream)
+{
+	return f->streams[stream].stalls;
+}
+
+void eas_feed_destroy(struct eas_feed *f)
+{
+	int i;
+
+	if(!f)
+		return;
+
+	for(i = 0; i < f->nstreams; i++)
+	{
+		if(f->streams[i].fd >= 0)
+			close(f->streams[i].fd);
+	}
+
+	free(f->streams);
+	free(f);
+}
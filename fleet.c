@@ -0,0 +1,611 @@
+/*
+*      fleet.c -- simulated receiver fleet under a severe-weather event
+*
+*      Every station monitors its own input and relays a share of a burst
+*      of overlapping alerts, each relay staggered behind the issue time and
+*      carrying the station's own id. Between relays the stations carry
+*      background program audio (a shared voice-like loop with noise).
+*      All stations are decoded at once in the live runtime; at the end
+*      the tool reports alert latency percentiles and how well the active-
+*      alert table collapsed the relays into the alerts actually issued.
+*      -c runs the stations with idle-input coalescing and -d with engine
+*      degradation above the given lag, every fourth station being high
+*      priority (see runtime.c). -e lets every station pick its engine by
+*      signal quality; -q receives every third station's relays through
+*      noise at the given SNR, so weak stations can be told from strong.
+*
+*      -v runs the fleet on a virtual clock (see runtime.c): the decoder
+*      is charged from the cost model instead of timed, so a run is
+*      repeatable and any number of stations fits on one core. -m loads
+*      the model saved by "calibrate -o" instead of calibrating first.
+*      -H records every station's metrics into a history file (rrd.c).
+*
+*      eas-decode fleet [-n stations] [-a alerts] [-w issue_window_s]
+*                       [-s stagger_s] [-p relay_prob] [-x speed] [-r seed]
+*                       [-c budget_ms] [-d lag_ms] [-e] [-q snr_db]
+*                       [-v] [-m model] [-H history.rrd]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <time.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define FLEET_TICK 0.02                   // producer period, seconds
+#define FLEET_LEAD 2.0                    // program audio before the first issue
+#define FLEET_TAIL 3.0                    // program audio after the last relay
+#define FLEET_GUARD 1.0                   // minimum gap between relays on a station
+#define FLEET_BG_LEN (FREQ_SAMP * 8)      // background loop, samples
+#define FLEET_SAMPLE 0.25                 // seconds between lag/engine samples
+#define FLEET_WEAK 3                      // with -q, every third station is weak
+
+static const char *fleet_events[] = { "TOR", "SVR", "FFW", "SVS", "TOA", "SVA" };
+static const int fleet_purges[] = { 30, 100, 130, 200 };
+
+#define FLEET_NEVENTS (sizeof(fleet_events)/sizeof(fleet_events[0]))
+
+struct fleet_alert
+{
+	char body[96];                        // header body after "ZCZC", station id "%s"
+	double issue;                         // audio seconds
+	int len;                              // rendered length, samples
+	double first_heard;                   // audio seconds, < 0 until voted
+	unsigned long relays;                 // relays put on the air
+};
+
+struct fleet_relay
+{
+	unsigned long long start;             // sample position on the station
+	int alert;
+};
+
+struct fleet_station
+{
+	struct fleet_relay *relays;
+	int nrelays;
+	int next;                             // next relay to put on the air
+	unsigned long long pos;               // samples produced
+	unsigned long long end;               // timeline length, samples
+	int bg_off;                           // phase in the background loop
+	short *cur;                           // relay being transmitted
+	int cur_len;
+	int cur_off;
+	char id[9];
+};
+
+struct fleet
+{
+	int nstations;
+	int nalerts;
+	struct fleet_alert *alerts;
+	struct fleet_station *stations;
+	eas_runtime *rt;
+	struct eas_feed *feed;
+	struct eas_alert_table *table;
+	short *bg;
+	double start;
+	int weak;                             // some stations receive through noise
+	double weak_snr;                      // dB, relays on weak stations
+
+	double *lat;                          // per voted relay, seconds
+	unsigned long nlat;
+	unsigned long cap_lat;
+	unsigned long ended;
+
+	double next_sample;
+	double max_lag;
+	int peak_degraded;                    // stations off the full engine at once
+	int peak_degraded_hi;                 // of those, high priority
+	int degraded;                         // at the last sample
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double frand(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = frand();
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_relay(const void *a, const void *b)
+{
+	const struct fleet_relay *x = a, *y = b;
+
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// syllable-rate bursts of a few harmonics below the FSK band, over noise
+static void fleet_background(short *bg, int n)
+{
+	double env, f0, ph = 0;
+	int i, h;
+
+	for(i = 0; i < n; i++)
+	{
+		env = 0.5 + 0.5 * sin(2.0 * M_PI * 4.0 * i / FREQ_SAMP);
+		env *= env * (0.6 + 0.4 * sin(2.0 * M_PI * 0.3 * i / FREQ_SAMP));
+		f0 = 140.0 + 30.0 * sin(2.0 * M_PI * 0.7 * i / FREQ_SAMP);
+		ph += 2.0 * M_PI * f0 / FREQ_SAMP;
+
+		bg[i] = 0;
+		for(h = 1; h <= 5; h++)
+			bg[i] += (short)(env * 3000.0 / h * sin(h * ph));
+
+		bg[i] += (short)((rand() % 1201) - 600);
+	}
+}
+
+static int fleet_encode(const struct fleet_alert *al, const char *id, short **samples)
+{
+	char header[128];
+
+	snprintf(header, sizeof(header), "ZCZC");
+	snprintf(header + 4, sizeof(header) - 4, al->body, id);
+
+	return encode_samples(header, samples);
+}
+
+static void fleet_render(struct fleet *fl, struct fleet_station *st, const struct fleet_relay *r)
+{
+	double power = 0, sd, x;
+	int i;
+
+	st->cur_len = fleet_encode(&fl->alerts[r->alert], st->id, &st->cur);
+	st->cur_off = 0;
+	fl->alerts[r->alert].relays++;
+
+	if(!fl->weak || (st - fl->stations) % FLEET_WEAK != 1)
+		return;
+
+	// a distant transmitter: the relay under white noise
+	for(i = 0; i < st->cur_len; i++)
+		power += (double)st->cur[i] * st->cur[i];
+	sd = sqrt(power / st->cur_len / pow(10.0, fl->weak_snr / 10.0));
+
+	for(i = 0; i < st->cur_len; i++)
+	{
+		x = st->cur[i] + sd * gauss();
+		st->cur[i] = (short)MAX(MIN(x, 32767.0), -32768.0);
+	}
+}
+
+static int fleet_fill(void *ctx, int stream, short *buf, int max)
+{
+	struct fleet *fl = ctx;
+	struct fleet_station *st = &fl->stations[stream];
+	unsigned long long until;
+	int n;
+
+	if(!st->cur && st->next < st->nrelays && st->pos >= st->relays[st->next].start)
+		fleet_render(fl, st, &st->relays[st->next++]);
+
+	if(st->cur)
+	{
+		n = MIN(st->cur_len - st->cur_off, max);
+		memcpy(buf, st->cur + st->cur_off, n * sizeof(short));
+		st->cur_off += n;
+
+		if(st->cur_off >= st->cur_len)
+		{
+			free(st->cur);
+			st->cur = 0;
+		}
+
+		st->pos += n;
+		return n;
+	}
+
+	// program audio up to the next relay or the end of the timeline
+	until = st->next < st->nrelays ? st->relays[st->next].start : st->end;
+	if(st->pos >= until)
+		return 0;
+
+	n = (int)MIN(until - st->pos, (unsigned long long)MIN(max, FLEET_BG_LEN - st->bg_off));
+	memcpy(buf, fl->bg + st->bg_off, n * sizeof(short));
+	st->bg_off = (st->bg_off + n) % FLEET_BG_LEN;
+
+	st->pos += n;
+	return n;
+}
+
+static void fleet_event(const struct eas_event *ev, void *ctx)
+{
+	struct fleet *fl = ctx;
+	const struct eas_alert *a;
+	double t, now;
+	int i, k, is_new;
+
+	if(ev->type == EAS_EVENT_END)
+	{
+		eas_alerts_end(fl->table, ev->message, eas_runtime_now(fl->rt) - fl->start);
+		fl->ended++;
+		return;
+	}
+
+	if(ev->type != EAS_EVENT_START || (i = eas_feed_stream(fl->feed, ev->stream)) < 0)
+		return;
+
+	now = eas_runtime_now(fl->rt);
+
+	// decoder latency: write of the sample that completed the vote to the event
+	if((t = eas_feed_write_time(fl->feed, i, ev->offset)) >= 0 && fl->nlat < fl->cap_lat)
+		fl->lat[fl->nlat++] = now - t;
+
+	a = eas_alerts_observe(fl->table, ev->message, i, now - fl->start, &is_new);
+	if(!a || !is_new)
+		return;
+
+	// air time from issue until the fleet first voted the alert
+	for(k = 0; k < fl->nalerts; k++)
+	{
+		if(!strncmp(fl->alerts[k].body, ev->message, a->key_len))
+		{
+			fl->alerts[k].first_heard = (double)ev->offset / FREQ_SAMP - fl->alerts[k].issue;
+			break;
+		}
+	}
+}
+
+static void fleet_sample(eas_runtime *rt, struct fleet *fl)
+{
+	struct eas_runtime_stream_stats rs;
+	int i, degraded = 0, degraded_hi = 0;
+
+	for(i = 0; i < fl->nstations; i++)
+	{
+		if(eas_runtime_stream_stats(rt, i, &rs) < 0)
+			continue;
+
+		fl->max_lag = MAX(fl->max_lag, rs.lag);
+		if(rs.rung)
+		{
+			degraded++;
+			degraded_hi += !(i % 4);
+		}
+	}
+
+	fl->degraded = degraded;
+	if(degraded > fl->peak_degraded)
+	{
+		fl->peak_degraded = degraded;
+		fl->peak_degraded_hi = degraded_hi;
+	}
+}
+
+static void fleet_tick(eas_runtime *rt, void *ctx)
+{
+	struct fleet *fl = ctx;
+	double now = eas_runtime_now(rt);
+
+	eas_feed_pump(fl->feed, now);
+	eas_alerts_expire(fl->table, now - fl->start);
+
+	if(now >= fl->next_sample)
+	{
+		fl->next_sample = now + FLEET_SAMPLE;
+		fleet_sample(rt, fl);
+	}
+}
+
+// issue times, staggered relays and per-station timelines
+static unsigned long fleet_plan(struct fleet *fl, double window, double stagger, double prob)
+{
+	struct fleet_station *st;
+	struct fleet_alert *al;
+	unsigned long long at, free_at, guard = (unsigned long long)(FLEET_GUARD * FREQ_SAMP);
+	unsigned long total = 0;
+	short *samples;
+	int i, k;
+
+	for(k = 0; k < fl->nalerts; k++)
+	{
+		al = &fl->alerts[k];
+
+		// distinct issue times keep the alerts apart; the id field is per station
+		snprintf(al->body, sizeof(al->body), "-WXR-%s-012%03d-012%03d+%04d-278%02d%02d-%%s-",
+			fleet_events[k % FLEET_NEVENTS], (57 + k) % 1000, (81 + k) % 1000,
+			fleet_purges[k % 4], 14 + k / 60, k % 60);
+
+		al->issue = FLEET_LEAD + frand() * window;
+		al->first_heard = -1;
+
+		// every station id has the same length, so one rendering sizes them all
+		al->len = fleet_encode(al, "STN00000", &samples);
+		free(samples);
+	}
+
+	for(i = 0; i < fl->nstations; i++)
+	{
+		st = &fl->stations[i];
+		snprintf(st->id, sizeof(st->id), "STN%05d", i % 100000);
+		st->bg_off = rand() % FLEET_BG_LEN;
+		st->relays = calloc(fl->nalerts, sizeof(st->relays[0]));
+
+		for(k = 0; k < fl->nalerts; k++)
+		{
+			if(frand() >= prob)
+				continue;
+
+			st->relays[st->nrelays].start = (unsigned long long)((fl->alerts[k].issue + frand() * stagger) * FREQ_SAMP);
+			st->relays[st->nrelays].alert = k;
+			st->nrelays++;
+		}
+
+		qsort(st->relays, st->nrelays, sizeof(st->relays[0]), cmp_relay);
+
+		// a station airs one relay at a time; later ones queue behind it
+		for(free_at = 0, k = 0; k < st->nrelays; k++)
+		{
+			at = MAX(st->relays[k].start, free_at);
+			st->relays[k].start = at;
+			free_at = at + fl->alerts[st->relays[k].alert].len + guard;
+		}
+
+		st->end = MAX(free_at, (unsigned long long)(FLEET_LEAD * FREQ_SAMP)) + (unsigned long long)(FLEET_TAIL * FREQ_SAMP);
+		total += st->nrelays;
+	}
+
+	return total;
+}
+
+// most stations transmitting at the same moment
+static int fleet_peak(const struct fleet *fl, unsigned long total)
+{
+	unsigned long long *starts, *ends;
+	const struct fleet_station *st;
+	unsigned long n = 0, a = 0, b = 0;
+	int i, k, on = 0, peak = 0;
+
+	starts = malloc(MAX(total, 1) * sizeof(*starts));
+	ends = malloc(MAX(total, 1) * sizeof(*ends));
+
+	for(i = 0; i < fl->nstations; i++)
+	{
+		st = &fl->stations[i];
+		for(k = 0; k < st->nrelays; k++, n++)
+		{
+			starts[n] = st->relays[k].start;
+			ends[n] = st->relays[k].start + fl->alerts[st->relays[k].alert].len;
+		}
+	}
+
+	qsort(starts, n, sizeof(*starts), cmp_ull);
+	qsort(ends, n, sizeof(*ends), cmp_ull);
+
+	while(a < n)
+	{
+		if(starts[a] < ends[b])
+		{
+			on++;
+			a++;
+			peak = MAX(peak, on);
+		}
+		else
+		{
+			on--;
+			b++;
+		}
+	}
+
+	free(starts);
+	free(ends);
+	return peak;
+}
+
+static double percentile(const double *v, unsigned long n, double q)
+{
+	return n ? v[(unsigned long)(q * (n - 1) + 0.5)] : 0;
+}
+
+int fleet_main(int argc, char **argv)
+{
+	struct fleet fl;
+	struct eas_alert_stats as;
+	eas_runtime *rt;
+	unsigned long total, stalls = 0;
+	unsigned long long written = 0;
+	struct eas_runtime_stream_stats rs;
+	struct eas_intern_stats is;
+	double window = 10, stagger = 8, prob = 0.8, speed = 1.0, budget = 0, lag = 0, wall, heard_sum = 0, heard_max = 0;
+	int opt, i, w, heard = 0, peak, adaptive = 0, virt = 0, engines[2][EAS_ENGINE_COUNT];
+	unsigned int seed = 1;
+	const char *history = 0;
+	struct eas_rrd *rrd = 0;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.nstations = 100;
+	fl.nalerts = 6;
+
+	while((opt = getopt(argc, argv, "n:a:w:s:p:x:r:c:d:eq:vm:H:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n': fl.nstations = atoi(optarg); break;
+		case 'a': fl.nalerts = atoi(optarg); break;
+		case 'w': window = atof(optarg); break;
+		case 's': stagger = atof(optarg); break;
+		case 'p': prob = atof(optarg); break;
+		case 'x': speed = atof(optarg); break;
+		case 'r': seed = (unsigned int)atoi(optarg); break;
+		case 'c': budget = atof(optarg) / 1000.0; break;
+		case 'd': lag = atof(optarg) / 1000.0; break;
+		case 'e': adaptive = 1; break;
+		case 'q': fl.weak = 1; fl.weak_snr = atof(optarg); break;
+		case 'v': virt = 1; break;
+		case 'H': history = optarg; break;
+		case 'm':
+			if(eas_cost_load(optarg) < 0)
+				perror(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: fleet [-n stations] [-a alerts] [-w issue_window_s] "
+				"[-s stagger_s] [-p relay_prob] [-x speed] [-r seed] [-c budget_ms] [-d lag_ms] [-e] [-q snr_db] "
+				"[-v] [-m model] [-H history.rrd]\n");
+			return 1;
+		}
+	}
+
+	if(fl.nstations < 1 || fl.nalerts < 1 || fl.nalerts > 600 || speed <= 0 || window < 0 || stagger < 0 || budget < 0 || lag < 0)
+	{
+		fprintf(stderr, "fleet: bad arguments\n");
+		return 1;
+	}
+
+	srand(seed);
+
+	fl.alerts = calloc(fl.nalerts, sizeof(*fl.alerts));
+	fl.stations = calloc(fl.nstations, sizeof(*fl.stations));
+	fl.bg = malloc(FLEET_BG_LEN * sizeof(short));
+	fleet_background(fl.bg, FLEET_BG_LEN);
+
+	total = fleet_plan(&fl, window, stagger, prob);
+	peak = fleet_peak(&fl, total);
+
+	fl.cap_lat = total;
+	fl.lat = malloc(MAX(total, 1) * sizeof(double));
+
+	if(!(fl.table = eas_alerts_create(fl.nalerts, window + stagger)))
+		return 1;
+
+	if(!(fl.rt = rt = eas_runtime_create(fl.nstations)))
+		return 1;
+
+	if(virt)
+		eas_runtime_set_virtual(rt);
+
+	if(!(fl.feed = eas_feed_create(rt, fl.nstations, speed, fleet_fill, &fl)))
+		return 1;
+
+	eas_runtime_set_event_handler(rt, fleet_event, &fl);
+	eas_runtime_set_tick(rt, FLEET_TICK, fleet_tick, &fl);
+	eas_runtime_set_coalesce(rt, budget);
+	eas_runtime_set_degrade(rt, lag, lag / 4);
+	eas_runtime_set_adaptive(rt, adaptive);
+
+	if(history && (rrd = eas_rrd_open(history, fl.nstations)))
+		eas_runtime_set_history(rt, rrd);
+
+	for(i = 0; i < fl.nstations; i++)
+		eas_runtime_set_priority(rt, i, !(i % 4));
+
+	printf("fleet: %d stations, %d alerts, %lu relays, peak %d stations on the air\n",
+		fl.nstations, fl.nalerts, total, peak);
+	fflush(stdout);
+
+	fl.start = eas_runtime_now(rt);
+	wall = now_sec();
+	eas_runtime_run(rt);
+	wall = now_sec() - wall;
+
+	for(i = 0; i < fl.nstations; i++)
+	{
+		written += eas_feed_written(fl.feed, i);
+		stalls += eas_feed_stalls(fl.feed, i);
+	}
+
+	qsort(fl.lat, fl.nlat, sizeof(double), cmp_double);
+	printf("audio: %.1f s in %.2f s wall (%.1fx aggregate), %lu writer stalls, %lu wakeups, cpu %.2f s\n",
+		written / (double)FREQ_SAMP, wall, written / (double)FREQ_SAMP / wall, stalls,
+		eas_runtime_wakeups(rt), (double)clock() / CLOCKS_PER_SEC);
+	if(virt)
+		printf("virtual: %.2f s simulated, decoder busy %.2f s (%.1f%% of one core)\n", eas_runtime_now(rt) - fl.start,
+			eas_runtime_busy(rt), 100.0 * eas_runtime_busy(rt) / MAX(eas_runtime_now(rt) - fl.start, 1e-9));
+	printf("latency: p50 %.1f ms  p90 %.1f ms  p99 %.1f ms  max %.1f ms  (%lu relays voted)\n",
+		percentile(fl.lat, fl.nlat, 0.5) * 1000.0, percentile(fl.lat, fl.nlat, 0.9) * 1000.0,
+		percentile(fl.lat, fl.nlat, 0.99) * 1000.0, percentile(fl.lat, fl.nlat, 1.0) * 1000.0, fl.nlat);
+	printf("lag: max %.0f ms; peak %d stations degraded (%d high priority), %d at the end\n",
+		fl.max_lag * 1000.0, fl.peak_degraded, fl.peak_degraded_hi, fl.degraded);
+
+	if(adaptive)
+	{
+		memset(engines, 0, sizeof(engines));
+		for(i = 0; i < fl.nstations; i++)
+		{
+			if(!eas_runtime_stream_stats(rt, i, &rs))
+				engines[fl.weak && i % FLEET_WEAK == 1][rs.engine]++;
+		}
+
+		for(w = 0; w < 1 + fl.weak; w++)
+		{
+			printf("engines at end, %s stations:", w ? "weak" : fl.weak ? "strong" : "all");
+			for(i = 0; i < EAS_ENGINE_COUNT; i++)
+				printf(" %s %d", eas_engine_name(i), engines[w][i]);
+			printf("\n");
+		}
+	}
+
+	for(i = 0; i < fl.nalerts; i++)
+	{
+		if(fl.alerts[i].first_heard < 0)
+			continue;
+
+		heard++;
+		heard_sum += fl.alerts[i].first_heard;
+		heard_max = MAX(heard_max, fl.alerts[i].first_heard);
+	}
+
+	printf("first heard: %d of %d alerts, avg %.2f s max %.2f s after issue\n",
+		heard, fl.nalerts, heard ? heard_sum / heard : 0, heard_max);
+
+	eas_alerts_stats(fl.table, &as);
+	printf("dedup: %lu relays sent, %lu voted, %lu unique (%d issued), %lu duplicates suppressed (%.1f%%), "
+		"%lu ended, %lu dropped\n",
+		total, as.observed, as.inserted, fl.nalerts, as.duplicates,
+		as.observed ? 100.0 * as.duplicates / as.observed : 0, fl.ended, as.overflows);
+
+	eas_intern_stats(&is);
+	printf("intern: %lu voted headers held as %lu shared strings in %lu bytes\n", as.observed, is.strings, is.bytes);
+
+	eas_feed_destroy(fl.feed);
+	eas_runtime_destroy(rt);
+	eas_rrd_close(rrd);
+	eas_alerts_destroy(fl.table);
+
+	for(i = 0; i < fl.nstations; i++)
+	{
+		free(fl.stations[i].relays);
+		free(fl.stations[i].cur);
+	}
+
+	free(fl.stations);
+	free(fl.alerts);
+	free(fl.bg);
+	free(fl.lat);
+
+	return as.inserted == (unsigned long)fl.nalerts && as.observed == total ? 0 : 2;
+}
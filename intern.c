@@ -0,0 +1,215 @@
+/*
+*      intern.c -- shared immutable strings for header bodies and location sets
+*
+*      During an outbreak the same header, and the same long list of
+*      location codes, is voted on stream after stream. Interning hands
+*      every holder one shared, reference-counted, NUL-terminated copy per
+*      distinct string, so equal strings are equal pointers and the bytes
+*      are stored once. Interning a string already held allocates nothing.
+*
+*      The pool is one open-addressing table of record pointers, grown at
+*      half load, with backward-shift deletion when the last reference
+*      goes. Like the rest of the decoder state it is not locked; use it
+*      from one thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <stddef.h>
+#include "easproc.h"
+
+#define INTERN_MIN 64                     // initial slots, a power of 2
+
+struct intern_rec
+{
+	unsigned int hash;
+	int refs;
+	int len;
+	char s[1];
+};
+
+static struct
+{
+	struct intern_rec **slots;
+	unsigned int mask;
+	struct eas_intern_stats stats;
+} pool;
+
+#define REC(s) ((struct intern_rec *)((char *)(s) - offsetof(struct intern_rec, s)))
+
+static unsigned int intern_hash(const char *s, int len)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	// FNV-1a
+	for(i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+
+	return h;
+}
+
+static unsigned int intern_slot(const char *s, int len, unsigned int h)
+{
+	struct intern_rec *r;
+	unsigned int i;
+
+	for(i = h & pool.mask; (r = pool.slots[i]); i = (i + 1) & pool.mask)
+	{
+		if(r->hash == h && r->len == len && !memcmp(r->s, s, len))
+			break;
+	}
+
+	return i;
+}
+
+static int intern_grow(void)
+{
+	struct intern_rec **old = pool.slots, **slots;
+	unsigned int i, j, n = pool.slots ? (pool.mask + 1) * 2 : INTERN_MIN;
+
+	if(!(slots = eas_malloc(NULL, n * sizeof(*slots))))
+		return -1;
+
+	memset(slots, 0, n * sizeof(*slots));
+
+	for(i = 0; old && i <= pool.mask; i++)
+	{
+		if(!old[i])
+			continue;
+
+		for(j = old[i]->hash & (n - 1); slots[j]; j = (j + 1) & (n - 1))
+			;
+		slots[j] = old[i];
+	}
+
+	pool.slots = slots;
+	pool.mask = n - 1;
+	eas_free(NULL, old);
+	return 0;
+}
+
+// the shared copy of s[0..len), with one more reference; 0 if out of memory
+const char *eas_intern(const char *s, int len)
+{
+	struct intern_rec *r;
+	unsigned int h = intern_hash(s, len), i;
+
+	if(!pool.slots && intern_grow() < 0)
+		return 0;
+
+	if((r = pool.slots[i = intern_slot(s, len, h)]))
+	{
+		r->refs++;
+		pool.stats.hits++;
+		pool.stats.saved += len + 1;
+		return r->s;
+	}
+
+	// keep the load factor at or below one half
+	if((pool.stats.strings + 1) * 2 > pool.mask + 1)
+	{
+		if(intern_grow() < 0)
+			return 0;
+		i = intern_slot(s, len, h);
+	}
+
+	if(!(r = eas_malloc(NULL, offsetof(struct intern_rec, s) + len + 1)))
+		return 0;
+
+	r->hash = h;
+	r->refs = 1;
+	r->len = len;
+	memcpy(r->s, s, len);
+	r->s[len] = 0;
+
+	pool.slots[i] = r;
+	pool.stats.strings++;
+	pool.stats.bytes += len + 1;
+	return r->s;
+}
+
+// an interned string, if s[0..len) is held; no reference is taken
+const char *eas_intern_find(const char *s, int len)
+{
+	struct intern_rec *r;
+
+	if(!pool.slots)
+		return 0;
+
+	r = pool.slots[intern_slot(s, len, intern_hash(s, len))];
+	return r ? r->s : 0;
+}
+
+const char *eas_intern_ref(const char *s)
+{
+	if(s)
+	{
+		REC(s)->refs++;
+		pool.stats.hits++;
+		pool.stats.saved += REC(s)->len + 1;
+	}
+
+	return s;
+}
+
+void eas_intern_release(const char *s)
+{
+	struct intern_rec *r;
+	unsigned int i, j, k;
+
+	if(!s || --REC(s)->refs > 0)
+		return;
+
+	r = REC(s);
+	i = intern_slot(r->s, r->len, r->hash);
+
+	// backward-shift deletion, as in alerts.c
+	pool.slots[i] = 0;
+	for(j = (i + 1) & pool.mask; pool.slots[j]; j = (j + 1) & pool.mask)
+	{
+		k = pool.slots[j]->hash & pool.mask;
+
+		if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			pool.slots[i] = pool.slots[j];
+			pool.slots[j] = 0;
+			i = j;
+		}
+	}
+
+	pool.stats.strings--;
+	pool.stats.bytes -= r->len + 1;
+	eas_free(NULL, r);
+}
+
+int eas_intern_len(const char *s)
+{
+	return REC(s)->len;
+}
+
+unsigned int eas_intern_hash(const char *s)
+{
+	return REC(s)->hash;
+}
+
+// the location codes of a body ("-PSSCCC-...-PSSCCC" up to the '+') as an
+// interned set; relays of one alert, and alerts for the same area, share it
+const char *eas_intern_locations(const char *body)
+{
+	const char *p, *q;
+
+	// "-ORG-EEE-PSSCCC-...+TTTT-...": skip originator and event code
+	if(!(p = strchr(body + 1, '-')) || !(p = strchr(p + 1, '-')) || !(q = strchr(p, '+')))
+		return 0;
+
+	return eas_intern(p, (int)(q - p));
+}
+
+void eas_intern_stats(struct eas_intern_stats *st)
+{
+	*st = pool.stats;
+}
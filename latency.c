@@ -0,0 +1,336 @@
+/*
+*      latency.c -- sample-to-alert latency, blocking vs busy-poll input
+*
+*      A forked producer paces repeated alert transmissions into a pipe or
+*      a shared-memory sample ring in fixed blocks and stamps the time each
+*      block landed in a table shared with the decoder. The decoder side
+*      takes input one of three ways:
+*
+*        block  blocking read() on the pipe; the scheduler wakes us
+*        poll   spin on a non-blocking read() of the pipe
+*        ring   spin on the shared-memory ring; no system calls at all
+*
+*      and the time from the landing of the block that completed each
+*      vote to the START event is reported as a distribution. Busy-poll
+*      modes are meant for a dedicated core (-c pins the decoder).
+*
+*      eas-decode latency [-m block|poll|ring|all] [-n alerts] [-b block_samples]
+*                         [-x speed] [-c cpu]
+*/
+
+#define _GNU_SOURCE                       // sched_setaffinity()
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <emmintrin.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define LAT_GAP FREQ_SAMP                 // silence between transmissions, samples
+#define LAT_MAX_BLOCK 4096
+
+enum
+{
+	LAT_BLOCK,
+	LAT_POLL,
+	LAT_RING,
+	LAT_MODES,
+};
+
+static const char *lat_names[LAT_MODES] = { "block", "poll", "ring" };
+
+struct lat_run
+{
+	int mode;
+	int block;
+	double speed;
+	const short *audio;                   // one transmission plus gap
+	int audio_len;
+	int alerts;
+
+	double *landed;                       // per block, shared with the producer
+	unsigned long nblocks;
+	double *lat;                          // per vote
+	int nlat;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void lat_event(const struct eas_event *ev, void *ctx)
+{
+	struct lat_run *lr = ctx;
+	unsigned long blk;
+	double t = now_sec();
+
+	if(ev->type != EAS_EVENT_START || lr->nlat >= lr->alerts)
+		return;
+
+	// the vote completes inside the block just pushed, which has landed
+	blk = (unsigned long)(ev->offset / lr->block);
+	if(blk < lr->nblocks && lr->landed[blk] > 0)
+		lr->lat[lr->nlat++] = t - lr->landed[blk];
+}
+
+static void lat_produce(struct lat_run *lr, int fd, struct eas_ring *ring)
+{
+	struct timespec ts;
+	short buf[LAT_MAX_BLOCK];
+	unsigned long b;
+	double start, due;
+	int i, n, pos = 0, w;
+
+	start = now_sec() + 0.05;
+
+	for(b = 0; b < lr->nblocks; b++)
+	{
+		for(i = 0; i < lr->block; i++)
+		{
+			buf[i] = lr->audio[pos];
+			pos = (pos + 1) % lr->audio_len;
+		}
+
+		// wait for the block to be "captured"
+		due = start + (double)(b + 1) * lr->block / (FREQ_SAMP * lr->speed);
+		ts.tv_sec = (time_t)due;
+		ts.tv_nsec = (long)((due - (time_t)due) * 1e9);
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+			;
+
+		// stamp before handing off so the decoder never sees an unstamped
+		// block; the ring's release store or the pipe write orders it
+		lr->landed[b] = now_sec();
+
+		if(ring)
+		{
+			for(n = 0; n < lr->block; n += w)
+			{
+				if(!(w = eas_ring_write(ring, buf + n, lr->block - n)))
+					_mm_pause();
+			}
+		}
+		else if(write(fd, buf, lr->block * sizeof(short)) < 0)
+			break;
+	}
+
+	if(ring)
+		eas_ring_close_writer(ring);
+}
+
+static void lat_consume(struct lat_run *lr, int fd, struct eas_ring *ring)
+{
+	short buf[LAT_MAX_BLOCK];
+	eas_stream *s;
+	int n, ncarry = 0;
+
+	if(!(s = eas_open(0)))
+		return;
+
+	eas_set_event_handler(s, lat_event, lr);
+
+	if(lr->mode == LAT_POLL)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	for(;;)
+	{
+		if(ring)
+		{
+			if(!(n = eas_ring_read(ring, buf, LAT_MAX_BLOCK)))
+			{
+				_mm_pause();
+				continue;
+			}
+
+			if(n < 0)
+				break;
+
+			eas_push(s, buf, n);
+			continue;
+		}
+
+		n = read(fd, (char *)buf + ncarry, sizeof(buf) - ncarry);
+
+		if(n < 0)
+		{
+			if(errno == EAGAIN)
+				_mm_pause();
+			else if(errno != EINTR)
+				break;
+			continue;
+		}
+
+		if(!n)
+			break;
+
+		n += ncarry;
+		eas_push(s, buf, n / sizeof(short));
+
+		ncarry = n & 1;
+		if(ncarry)
+			((char *)buf)[0] = ((char *)buf)[n - 1];
+	}
+
+	eas_close(s);
+}
+
+static int lat_run(struct lat_run *lr)
+{
+	struct eas_ring *ring = 0;
+	int fds[2] = { -1, -1 };
+	double cpu;
+	pid_t pid;
+
+	memset(lr->landed, 0, lr->nblocks * sizeof(double));
+	lr->nlat = 0;
+
+	if(lr->mode == LAT_RING)
+	{
+		if(!(ring = eas_ring_create(0, FREQ_SAMP)))
+			return -1;
+	}
+	else if(pipe(fds) < 0)
+	{
+		perror("pipe");
+		return -1;
+	}
+
+	if((pid = fork()) < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if(!pid)
+	{
+		if(fds[0] >= 0)
+			close(fds[0]);
+
+		lat_produce(lr, fds[1], ring);
+		_exit(0);
+	}
+
+	if(fds[1] >= 0)
+		close(fds[1]);
+
+	cpu = (double)clock() / CLOCKS_PER_SEC;
+	lat_consume(lr, fds[0], ring);
+	cpu = (double)clock() / CLOCKS_PER_SEC - cpu;
+
+	waitpid(pid, 0, 0);
+	if(fds[0] >= 0)
+		close(fds[0]);
+	eas_ring_destroy(ring);
+
+	qsort(lr->lat, lr->nlat, sizeof(double), cmp_double);
+
+	printf("%-5s  %3d/%d votes  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  max %8.1f us  cpu %.2f s\n",
+		lat_names[lr->mode], lr->nlat, lr->alerts,
+		lr->nlat ? lr->lat[lr->nlat / 2] * 1e6 : 0, lr->nlat ? lr->lat[(int)(0.9 * (lr->nlat - 1) + 0.5)] * 1e6 : 0,
+		lr->nlat ? lr->lat[(int)(0.99 * (lr->nlat - 1) + 0.5)] * 1e6 : 0, lr->nlat ? lr->lat[lr->nlat - 1] * 1e6 : 0, cpu);
+	fflush(stdout);
+
+	return 0;
+}
+
+int latency_main(int argc, char **argv)
+{
+	struct lat_run lr;
+	cpu_set_t set;
+	short *tx;
+	const char *mode = "all";
+	int opt, i, count, cpu = -1;
+
+	memset(&lr, 0, sizeof(lr));
+	lr.alerts = 20;
+	lr.block = FREQ_SAMP / 100;
+	lr.speed = 1.0;
+
+	while((opt = getopt(argc, argv, "m:n:b:x:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'm': mode = optarg; break;
+		case 'n': lr.alerts = atoi(optarg); break;
+		case 'b': lr.block = atoi(optarg); break;
+		case 'x': lr.speed = atof(optarg); break;
+		case 'c': cpu = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: latency [-m block|poll|ring|all] [-n alerts] [-b block_samples] "
+				"[-x speed] [-c cpu]\n");
+			return 1;
+		}
+	}
+
+	if(lr.alerts < 1 || lr.block < 1 || lr.block > LAT_MAX_BLOCK || lr.speed <= 0)
+		return 1;
+
+	if(sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		fprintf(stderr, "latency: one cpu online; busy-poll modes will compete with the producer\n");
+
+	if(cpu >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) < 0)
+			perror("sched_setaffinity");
+	}
+
+	// one transmission and a gap, repeated for every vote we want
+	count = encode_samples("ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-", &tx);
+	lr.audio_len = count + LAT_GAP;
+	lr.audio = tx = realloc(tx, lr.audio_len * sizeof(short));
+	memset(tx + count, 0, LAT_GAP * sizeof(short));
+
+	lr.nblocks = ((unsigned long)lr.audio_len * lr.alerts + lr.block - 1) / lr.block;
+	lr.landed = mmap(0, lr.nblocks * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	lr.lat = malloc(lr.alerts * sizeof(double));
+
+	if(lr.landed == MAP_FAILED || !lr.lat)
+		return 1;
+
+	printf("%d alerts, %d-sample blocks (%.1f ms), %.1fx real time, %.0f s per mode\n",
+		lr.alerts, lr.block, lr.block * 1000.0 / FREQ_SAMP, lr.speed,
+		(double)lr.audio_len * lr.alerts / FREQ_SAMP / lr.speed);
+
+	for(i = 0; i < LAT_MODES; i++)
+	{
+		if(strcmp(mode, "all") && strcmp(mode, lat_names[i]))
+			continue;
+
+		lr.mode = i;
+		if(lat_run(&lr) < 0)
+			return 1;
+	}
+
+	munmap(lr.landed, lr.nblocks * sizeof(double));
+	free(lr.lat);
+	free(tx);
+
+	return 0;
+}
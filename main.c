@@ -11,12 +11,284 @@
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#include "easproc.h"
 
-void decode(const char *fname);
-void encode(const char *fname);
+#ifndef _MSC_VER
+struct live_log
+{
+	struct eas_alertlog *log;
+	unsigned long long *last;             // per stream, latest record + 1
+};
+
+// print as usual, and keep voted headers in the alert log
+static void live_event(const struct eas_event *ev, void *ctx)
+{
+	struct live_log *ll = ctx;
+	struct eas_alert_rec r;
+	struct timespec ts;
+
+	eas_print_event(ev);
+
+	// a new header copy means an EOM from here on is not the logged
+	// alert's, whether or not this header goes on to pass the vote
+	if(ev->type == EAS_EVENT_PART)
+		ll->last[ev->stream] = 0;
+	else if(ev->type == EAS_EVENT_START && ev->message && !eas_header_parse(ev->message, &r))
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		r.time = ts.tv_sec + ts.tv_nsec * 1e-9;
+		r.stream = ev->stream;
+		r.seq = ev->offset;
+		if(!eas_alertlog_append(ll->log, &r, 1))
+			ll->last[ev->stream] = eas_alertlog_count(ll->log);
+	}
+	else if(ev->type == EAS_EVENT_END && ll->last[ev->stream])
+	{
+		// END only follows an EOM whose header voted
+		eas_alertlog_end(ll->log, ll->last[ev->stream] - 1);
+		ll->last[ev->stream] = 0;
+	}
+}
+
+static int live(int argc, char *argv[], double budget, double cpus, int adaptive, const char *history, const char *alerts)
+{
+	struct eas_rrd *rrd = 0;
+	struct live_log ll;
+	eas_runtime *rt;
+	double left;
+	int i, ret, room;
+
+	if(!(rt = eas_runtime_create(argc)))
+		return 1;
+
+	eas_runtime_set_cpu_budget(rt, cpus);
+	eas_runtime_set_adaptive(rt, adaptive);
+
+	for(i = 0; i < argc; i++)
+	{
+		// inputs over the cpu budget are left alone
+		if((ret = eas_runtime_add(rt, argv[i])) == -2)
+			continue;
 
-void main(int argc, char *argv[])
+		if(ret < 0)
+		{
+			eas_runtime_destroy(rt);
+			return 1;
+		}
+	}
+
+	if(cpus > 0)
+	{
+		left = eas_runtime_capacity(rt, &room);
+		fprintf(stderr, "capacity: %.4f cpus left, room for %d more streams\n", left, room);
+	}
+
+	// a history or log asked for and not opened is not run without
+	if(history)
+	{
+		if(!(rrd = eas_rrd_open(history, argc)))
+		{
+			eas_runtime_destroy(rt);
+			return 1;
+		}
+		eas_runtime_set_history(rt, rrd);
+	}
+
+	memset(&ll, 0, sizeof(ll));
+	if(alerts && (!(ll.log = eas_alertlog_create(alerts)) || !(ll.last = calloc(argc, sizeof(*ll.last)))))
+	{
+		if(ll.log)
+			eas_alertlog_close(ll.log);
+		eas_rrd_close(rrd);
+		eas_runtime_destroy(rt);
+		return 1;
+	}
+	if(ll.log)
+		eas_runtime_set_event_handler(rt, live_event, &ll);
+
+	eas_runtime_set_coalesce(rt, budget);
+	ret = eas_runtime_run(rt);
+	eas_runtime_report(rt, stderr);
+	eas_runtime_destroy(rt);
+	eas_rrd_close(rrd);
+	free(ll.last);
+
+	// bring the query index up to date with what this run appended
+	if(ll.log)
+	{
+		eas_alertlog_close(ll.log);
+		eas_alertlog_index(alerts);
+	}
+
+	return ret ? 1 : 0;
+}
+#endif
+
+// encode [-t wxr|eas] [-d tone_s] [-v voice.raw] [-r rate] [-f s16|f32|wav|wavf32] header out
+static int compose(int argc, char *argv[])
 {
+	struct eas_tx tx;
+	int argi = 0;
+
+	memset(&tx, 0, sizeof(tx));
+	tx.tone_sec = 8.0;
+
+	for(; argi + 1 < argc && argv[argi][0] == '-'; argi += 2)
+	{
+		if(!strcmp(argv[argi], "-t"))
+			tx.tone = !strcmp(argv[argi + 1], "wxr") ? EAS_TONE_WXR : !strcmp(argv[argi + 1], "eas") ? EAS_TONE_EAS : EAS_TONE_NONE;
+		else if(!strcmp(argv[argi], "-d"))
+			tx.tone_sec = atof(argv[argi + 1]);
+		else if(!strcmp(argv[argi], "-v"))
+			tx.voice = argv[argi + 1];
+		else if(!strcmp(argv[argi], "-r"))
+			tx.rate = atoi(argv[argi + 1]);
+		else if(!strcmp(argv[argi], "-f"))
+			tx.format = !strcmp(argv[argi + 1], "f32") ? EAS_FMT_F32 : !strcmp(argv[argi + 1], "wav") ? EAS_FMT_WAV_S16 :
+				!strcmp(argv[argi + 1], "wavf32") ? EAS_FMT_WAV_F32 : EAS_FMT_S16;
+		else
+			break;
+	}
+
+	if(argi + 2 != argc)
+	{
+		fprintf(stderr, "usage: encode [-t wxr|eas] [-d tone_s] [-v voice.raw] [-r rate] [-f s16|f32|wav|wavf32] header out\n");
+		return 1;
+	}
+
+	tx.header = argv[argi];
+	if(eas_compose(&tx, argv[argi + 1]) < 0)
+	{
+		perror(argv[argi + 1]);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int argi = 1;
+	double budget = 0, cpus = 0;
+	int adaptive = 0, many = 0, opt;
+	const char *history = 0, *alerts = 0, *model = 0, *spectro = 0, *input;
+
+	if(argc > 1 && !strcmp(argv[1], "encode"))
+		return compose(argc - 2, argv + 2);
+
+#ifndef _MSC_VER
+	if(argc > 1 && !strcmp(argv[1], "replay"))
+		return replay_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "soak"))
+		return soak_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "fleet"))
+		return fleet_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "relay"))
+		return relay_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "latency"))
+		return latency_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "batch"))
+		return batch_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "calibrate"))
+		return calibrate_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "corpus"))
+		return corpus_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "coldstart"))
+		return coldstart_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "shard"))
+		return shard_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "history"))
+		return history_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "alertlog"))
+		return alertlog_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "snr"))
+		return snr_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "burst"))
+		return burst_main(argc - 1, argv + 1);
+	if(argc > 1 && !strcmp(argv[1], "strict"))
+		return strict_main(argc - 1, argv + 1);
+#endif
+
+#ifndef _MSC_VER
+	while((opt = getopt(argc, argv, "sg:c:m:b:ar:j:l")) != -1)
+	{
+		switch(opt)
+		{
+		// -s: abort on any allocation in the steady-state decode path
+		case 's': eas_alloc_strict(1); break;
+		// -g <file>: write a spectrogram of the input to file; "%d" in the
+		// name takes the stream id, otherwise live streams after the first
+		// append it
+		case 'g': spectro = optarg; break;
+		// -c <ms>: coalesce idle live inputs within this latency budget
+		case 'c': budget = atof(optarg) / 1000.0; break;
+		// -m <model>: decoder cost model saved by "calibrate -o"
+		case 'm': model = optarg; break;
+		// -b <cpus>: refuse live inputs beyond this much decoder cpu
+		case 'b': cpus = atof(optarg); break;
+		// -a: each live input picks its decoder engine by signal quality
+		case 'a': adaptive = 1; break;
+		// -r <file>: keep per-stream metric history in this file
+		case 'r': history = optarg; break;
+		// -j <log>: append voted headers to this alert log
+		case 'j': alerts = optarg; break;
+		// -l: decode many live inputs (FIFOs) at once
+		case 'l': many = 1; break;
+		default:
+			goto usage;
+		}
+	}
+	argi = optind;
+
+	// the live options mean nothing to a single file decode
+	if(!many && (budget || cpus || adaptive || model || history || alerts))
+		goto usage;
+	if(many ? argi >= argc : argi + 1 < argc)
+		goto usage;
+#else
+	for(; argi < argc && argv[argi][0] == '-'; argi++)
+	{
+		if(!strcmp(argv[argi], "-s"))
+			eas_alloc_strict(1);
+		else if(!strcmp(argv[argi], "-g") && argi + 1 < argc)
+			spectro = argv[++argi];
+		else
+			goto usage;
+	}
+
+	if(argi + 1 < argc)
+		goto usage;
+#endif
+
+	if(spectro && eas_spectrogram(spectro) < 0)
+	{
+		fprintf(stderr, "-g %s: only one %%d is allowed in the name\n", spectro);
+		return 1;
+	}
+
+#ifndef _MSC_VER
+	if(model && eas_cost_load(model) < 0)
+	{
+		perror(model);
+		return 1;
+	}
+
+	if(many)
+		return live(argc - argi, argv + argi, budget, cpus, adaptive, history, alerts);
+#endif
+
 	//encode("ZCZC-EAS-RWT-012057-012081+0030-2780415-WTSP/TV-", "my-same1.raw");
-	decode("my-same1.raw");
+	input = argi < argc ? argv[argi] : "my-same1.raw";
+	if(decode(input) < 0)
+	{
+		perror(input);
+		return 1;
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: eas-decode [-s] [-g file] [file.raw]\n"
+		"       eas-decode [-s] [-g file] [-c ms] [-m model] [-b cpus] [-a] [-r history] [-j log] -l input ...\n");
+	return 1;
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+/*
+*      probes.h -- USDT/SDT static tracepoints for the EAS decoder
+*
+*      When <sys/sdt.h> (systemtap-sdt-dev) is available each probe compiles
+*      to a single nop plus an ELF note; nothing runs unless a tracer attaches.
+*      Otherwise the probes compile away entirely.
+*
+*      Probes (provider "easproc"), first two args are always
+*      stream id and sample offset:
+*        sync_acquire(id, offset)
+*        sync_lost(id, offset, frame_state)
+*        char(id, offset, char, frame_state)
+*        header_copy(id, offset, copy_no, message)
+*        vote_ok(id, offset, message)
+*        vote_fail(id, offset, char_index)
+*        eom(id, offset, had_message)
+*
+*      e.g.
+*        bpftrace -e 'usdt:./eas-decode:easproc:vote_ok
+*            { printf("%d @%d %s\n", arg0, arg1, str(arg2)); }'
+*/
+
+#ifndef EAS_PROBES_H
+#define EAS_PROBES_H
+
+#if !defined(_MSC_VER) && !defined(EAS_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define EAS_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef EAS_HAVE_SDT
+#define EAS_PROBE2(name, a, b)          DTRACE_PROBE2(easproc, name, a, b)
+#define EAS_PROBE3(name, a, b, c)       DTRACE_PROBE3(easproc, name, a, b, c)
+#define EAS_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(easproc, name, a, b, c, d)
+#else
+#define EAS_PROBE2(name, a, b)          do { } while(0)
+#define EAS_PROBE3(name, a, b, c)       do { } while(0)
+#define EAS_PROBE4(name, a, b, c, d)    do { } while(0)
+#endif
+
+#endif
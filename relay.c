@@ -0,0 +1,313 @@
+/*
+*      relay.c -- decode-and-relay with minimal re-encode latency
+*
+*      Decodes one input and, as soon as a header is voted, re-renders it
+*      with our station id in the originator field and writes it to the
+*      output; the EOM that ends the message is relayed the same way. All
+*      output buffers are allocated up front and the EOM is rendered once
+*      at startup, so the relay path is render + write only.
+*
+*      Receive-to-transmit latency is measured from the read() that
+*      delivered the completing sample to the end of the write().
+*
+*      By default the relay sleeps in read() until the scheduler wakes it.
+*      For a dedicated core, -p spins on a non-blocking read() of the input
+*      instead, and -R spins on a named shared-memory sample ring filled by
+*      the capture process (eas_ring_create), with no system call per
+*      block; -c pins the relay to one cpu. "eas-decode latency" compares
+*      the three on the same machine.
+*
+*      eas-decode relay [-i station_id] [-b block_samples] [-p] [-c cpu] -o output input
+*      eas-decode relay [-i station_id] [-b block_samples] [-c cpu] -o output -R ring
+*/
+
+#define _GNU_SOURCE                       // sched_setaffinity()
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <emmintrin.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define RELAY_ID_LEN 8                    // LLLLLLLL
+#define RELAY_MAX_BLOCK 8192              // max samples per read()
+#define RELAY_MAX_SAMPLES (3 * (FREQ_SAMP + (268 + 2) * 8 * 43)) // three longest bursts
+
+struct relay
+{
+	int out;
+	char id[RELAY_ID_LEN + 1];
+	double t_read;                        // when the current block was read
+	short *hdr;                           // preallocated header rendering
+	short *eom;                           // EOM, rendered once
+	int eom_len;
+	int in_message;
+
+	unsigned long n;
+	unsigned long headers;
+	double lat_sum;
+	double lat_max;
+	double render_sum;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int write_all(int fd, const short *buf, int count)
+{
+	const char *p = (const char *)buf;
+	size_t left = count * sizeof(short);
+	ssize_t n;
+
+	while(left)
+	{
+		if((n = write(fd, p, left)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		p += n;
+		left -= n;
+	}
+
+	return 0;
+}
+
+// "ZCZC" + body with the originator field (the last one) replaced by id
+static void relay_header(const char *body, const char *id, char *out, size_t size)
+{
+	const char *end, *p;
+	int len = (int)strlen(body);
+
+	end = len && body[len - 1] == '-' ? body + len - 1 : body + len;
+	for(p = end; p > body && p[-1] != '-'; p--)
+		;
+
+	snprintf(out, size, "ZCZC%.*s%-*.*s-", (int)(p - body), body, RELAY_ID_LEN, RELAY_ID_LEN, id);
+}
+
+static void relay_done(struct relay *r, const char *what, double t_event, double t_rendered)
+{
+	double t = now_sec(), lat = t - r->t_read;
+
+	r->n++;
+	r->lat_sum += lat;
+	r->lat_max = MAX(r->lat_max, lat);
+
+	fprintf(stderr, "relayed %s: %.0f us from read (detect %.0f us, render %.0f us, write %.0f us)\n",
+		what, lat * 1e6, (t_event - r->t_read) * 1e6, (t_rendered - t_event) * 1e6, (t - t_rendered) * 1e6);
+}
+
+static void relay_event(const struct eas_event *ev, void *ctx)
+{
+	struct relay *r = ctx;
+	char header[300];
+	double t_event = now_sec(), t_rendered;
+	int n;
+
+	if(ev->type == EAS_EVENT_START)
+	{
+		relay_header(ev->message, r->id, header, sizeof(header));
+
+		if((n = eas_render(header, r->hdr, RELAY_MAX_SAMPLES)) < 0)
+			return;
+
+		t_rendered = now_sec();
+		if(write_all(r->out, r->hdr, n) < 0)
+		{
+			perror("relay");
+			return;
+		}
+
+		r->in_message = 1;
+		r->headers++;
+		r->render_sum += t_rendered - t_event;
+		relay_done(r, header, t_event, t_rendered);
+	}
+	else if(ev->type == EAS_EVENT_END && r->in_message)
+	{
+		if(write_all(r->out, r->eom, r->eom_len) < 0)
+		{
+			perror("relay");
+			return;
+		}
+
+		r->in_message = 0;
+		relay_done(r, "NNNN", t_event, t_event);
+	}
+	else if(ev->type == EAS_EVENT_FAULT || ev->type == EAS_EVENT_FAULT_CLEAR)
+		eas_print_event(ev);
+}
+
+static void relay_usage(void)
+{
+	fprintf(stderr, "usage: relay [-i station_id] [-b block_samples] [-p] [-c cpu] -o output input\n"
+		"       relay [-i station_id] [-b block_samples] [-c cpu] -o output -R ring\n");
+}
+
+int relay_main(int argc, char **argv)
+{
+	struct relay r;
+	struct eas_ring *ring = 0;
+	eas_stream *s;
+	cpu_set_t set;
+	short buffer[RELAY_MAX_BLOCK + 1];
+	const char *output = 0, *ring_name = 0, *input;
+	int opt, in = -1, n, ncarry = 0, block = FREQ_SAMP / 50, poll = 0, cpu = -1;
+
+	memset(&r, 0, sizeof(r));
+	strcpy(r.id, "EASRELAY");
+
+	while((opt = getopt(argc, argv, "i:b:o:pR:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'i':
+			// the LLLLLLLL field is exactly 8 characters and holds no '-'
+			if(strlen(optarg) != RELAY_ID_LEN || strchr(optarg, '-'))
+			{
+				fprintf(stderr, "relay: station id \"%s\" is not 8 characters without '-'\n", optarg);
+				return 1;
+			}
+			strcpy(r.id, optarg);
+			break;
+		case 'b': block = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		case 'p': poll = 1; break;
+		case 'R': ring_name = optarg; break;
+		case 'c': cpu = atoi(optarg); break;
+		default:
+			relay_usage();
+			return 1;
+		}
+	}
+
+	// a ring is its own input and is always spun on
+	if(!output || optind + !ring_name != argc || (ring_name && poll) || block < 1 || block > RELAY_MAX_BLOCK)
+	{
+		relay_usage();
+		return 1;
+	}
+
+	r.hdr = malloc(RELAY_MAX_SAMPLES * sizeof(short));
+	r.eom = malloc(RELAY_MAX_SAMPLES * sizeof(short));
+	if(!r.hdr || !r.eom || (r.eom_len = eas_render("NNNN", r.eom, RELAY_MAX_SAMPLES)) < 0)
+		return 1;
+
+	input = ring_name ? ring_name : argv[optind];
+	if(ring_name)
+	{
+		if(!(ring = eas_ring_open(ring_name)))
+			return 1;
+	}
+	else if((in = strcmp(input, "-") ? open(input, O_RDONLY) : 0) < 0)
+	{
+		perror(input);
+		return 1;
+	}
+
+	if(poll && fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK) < 0)
+	{
+		perror(input);
+		return 1;
+	}
+
+	if((r.out = strcmp(output, "-") ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1) < 0)
+	{
+		perror(output);
+		return 1;
+	}
+
+	if(cpu >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if(sched_setaffinity(0, sizeof(set), &set) < 0)
+			perror("sched_setaffinity");
+	}
+
+	if(!(s = eas_open(0)))
+		return 1;
+
+	eas_set_event_handler(s, relay_event, &r);
+
+	for(;;)
+	{
+		if(ring)
+		{
+			// whole samples only; -1 once the writer closed and it drained
+			if(!(n = eas_ring_read(ring, buffer, block)))
+			{
+				_mm_pause();
+				continue;
+			}
+
+			if(n < 0)
+				break;
+
+			r.t_read = now_sec();
+			eas_push(s, buffer, n);
+			continue;
+		}
+
+		// small reads keep the voted header close to the read that completed it
+		n = read(in, (char *)buffer + ncarry, block * sizeof(short));
+
+		if(n < 0 && errno == EINTR)
+			continue;
+
+		if(n < 0 && poll && errno == EAGAIN)
+		{
+			_mm_pause();
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			if(n < 0)
+				perror(input);
+			break;
+		}
+
+		r.t_read = now_sec();
+		n += ncarry;
+		eas_push(s, buffer, n / sizeof(short));
+
+		// keep an odd trailing byte for the next read
+		ncarry = n & 1;
+		if(ncarry)
+			((char *)buffer)[0] = ((char *)buffer)[n - 1];
+	}
+
+	fprintf(stderr, "relay: %lu transmissions, latency avg %.0f us max %.0f us, header render avg %.0f us\n",
+		r.n, r.n ? r.lat_sum / r.n * 1e6 : 0, r.lat_max * 1e6, r.headers ? r.render_sum / r.headers * 1e6 : 0);
+
+	eas_close(s);
+	if(ring)
+		eas_ring_destroy(ring);
+	else
+		close(in);
+	close(r.out);
+	free(r.hdr);
+	free(r.eom);
+
+	return 0;
+}
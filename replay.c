@@ -0,0 +1,356 @@
+/*
+*      replay.c -- real-time paced replay of recordings into FIFOs
+*
+*      Streams archived .raw files, or an encoder rendering of a header,
+*      into many FIFOs at real-time (or N x real-time) pace so the live
+*      multi-stream decoder sees receiver-like arrivals. A single timerfd
+*      paces all streams; each stream writes one chunk per period, offset
+*      by a random stagger and optionally delayed by random jitter.
+*
+*      eas-decode replay [-n streams] [-d dir] [-x speed] [-p period_ms]
+*                        [-j jitter_ms] [-l loops] [-g gap_s]
+*                        (-m message | file.raw|corpus.eac ...)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+struct replay_src
+{
+	const char *data;
+	size_t nbytes;
+};
+
+struct replay_stream
+{
+	int fd;
+	const struct replay_src *src;
+	size_t off;                           // byte offset in source or gap
+	int in_gap;
+	int loop;
+	double due;                           // next chunk deadline, seconds
+	double base;                          // due without jitter
+	size_t owed;                          // bytes due but not yet written
+	unsigned long long written;
+	unsigned long stalls;                 // writes cut short by a full pipe
+	double max_late;
+	char path[256];
+};
+
+static char zeros[8192];
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double frand(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+static int load_raw(const char *fname, struct replay_src *src)
+{
+	struct stat st;
+	char *p;
+	int fd;
+	size_t got = 0;
+	ssize_t n;
+
+	if((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(fname);
+		return -1;
+	}
+
+	if(!(p = malloc(st.st_size ? st.st_size : 1)))
+	{
+		close(fd);
+		return -1;
+	}
+
+	while(got < (size_t)st.st_size && (n = read(fd, p + got, st.st_size - got)) > 0)
+		got += n;
+
+	close(fd);
+
+	src->data = p;
+	src->nbytes = got & ~(size_t)1;
+	return 0;
+}
+
+// write what the stream owes; returns 0 once the stream has finished
+static int replay_write(struct replay_stream *rs, size_t gap_bytes, int loops)
+{
+	const char *p;
+	size_t left, n;
+	ssize_t w;
+
+	while(rs->owed)
+	{
+		if(rs->in_gap)
+		{
+			left = gap_bytes - rs->off;
+			p = zeros;
+			n = MIN(MIN(left, rs->owed), sizeof(zeros));
+		}
+		else
+		{
+			left = rs->src->nbytes - rs->off;
+			p = rs->src->data + rs->off;
+			n = MIN(left, rs->owed);
+		}
+
+		if(n)
+		{
+			if((w = write(rs->fd, p, n)) < 0)
+			{
+				if(errno == EAGAIN)
+				{
+					rs->stalls++;
+					return 1;
+				}
+
+				perror(rs->path);
+				return 0;
+			}
+
+			rs->off += w;
+			rs->owed -= w;
+			rs->written += w;
+
+			if((size_t)w < n)
+			{
+				rs->stalls++;
+				return 1;
+			}
+
+			left -= w;
+		}
+
+		if(left)
+			continue;
+
+		// end of source or gap
+		rs->off = 0;
+		if(!rs->in_gap && gap_bytes)
+		{
+			rs->in_gap = 1;
+			continue;
+		}
+
+		rs->in_gap = 0;
+		if(++rs->loop >= loops)
+			return 0;
+	}
+
+	return 1;
+}
+
+int replay_main(int argc, char **argv)
+{
+	struct replay_src *srcs;
+	struct replay_stream *rs;
+	struct eas_corpus *corpus;
+	struct eas_clip clip;
+	struct itimerspec its;
+	const char *dir = ".";
+	const char *message = 0;
+	int nstreams = 1, loops = 1, nsrc, active, opt, tfd, i, k;
+	double speed = 1.0, period_ms = 20.0, jitter_ms = 0.0, gap_s = 0.0;
+	double period, jitter, start, now, tick;
+	size_t chunk_bytes, gap_bytes;
+	unsigned long long expirations;
+	unsigned long ticks = 0;
+
+	while((opt = getopt(argc, argv, "n:d:x:p:j:l:g:m:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n': nstreams = atoi(optarg); break;
+		case 'd': dir = optarg; break;
+		case 'x': speed = atof(optarg); break;
+		case 'p': period_ms = atof(optarg); break;
+		case 'j': jitter_ms = atof(optarg); break;
+		case 'l': loops = atoi(optarg); break;
+		case 'g': gap_s = atof(optarg); break;
+		case 'm': message = optarg; break;
+		default:
+			fprintf(stderr, "usage: replay [-n streams] [-d dir] [-x speed] [-p period_ms] "
+				"[-j jitter_ms] [-l loops] [-g gap_s] (-m message | file.raw|corpus.eac ...)\n");
+			return 1;
+		}
+	}
+
+	nsrc = message ? 1 : argc - optind;
+	if(nstreams < 1 || nsrc < 1 || speed <= 0 || period_ms <= 0)
+	{
+		fprintf(stderr, "replay: need at least one stream and one source\n");
+		return 1;
+	}
+
+	srcs = calloc(nsrc, sizeof(*srcs));
+	rs = calloc(nstreams, sizeof(*rs));
+
+	if(message)
+	{
+		short *samples;
+		int count = encode_samples(message, &samples);
+
+		srcs[0].data = (const char *)samples;
+		srcs[0].nbytes = count * sizeof(short);
+	}
+	else
+	{
+		for(nsrc = 0, i = optind; i < argc; i++)
+		{
+			if(!eas_corpus_probe(argv[i]))
+			{
+				if(load_raw(argv[i], &srcs[nsrc++]) < 0)
+					return 1;
+				continue;
+			}
+
+			// a corpus stands for all of its clips, replayed from the mapping
+			if(!(corpus = eas_corpus_open(argv[i])) ||
+				!(srcs = realloc(srcs, (argc - i + nsrc + eas_corpus_count(corpus)) * sizeof(*srcs))))
+				return 1;
+
+			for(k = 0; k < eas_corpus_count(corpus); k++, nsrc++)
+			{
+				eas_corpus_clip(corpus, k, &clip);
+				srcs[nsrc].data = (const char *)clip.samples;
+				srcs[nsrc].nbytes = clip.count * sizeof(short);
+			}
+		}
+
+		if(nsrc < 1)
+		{
+			fprintf(stderr, "replay: no clips\n");
+			return 1;
+		}
+	}
+
+	// pacing in wall-clock seconds per chunk
+	period = period_ms / 1000.0 / speed;
+	jitter = jitter_ms / 1000.0 / speed;
+	chunk_bytes = (size_t)(period_ms * FREQ_SAMP / 1000.0) * sizeof(short);
+	gap_bytes = (size_t)(gap_s * FREQ_SAMP) * sizeof(short);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i = 0; i < nstreams; i++)
+	{
+		snprintf(rs[i].path, sizeof(rs[i].path), "%s/eas-%d.fifo", dir, i);
+
+		if(mkfifo(rs[i].path, 0644) < 0 && errno != EEXIST)
+		{
+			perror(rs[i].path);
+			return 1;
+		}
+
+		printf("%s\n", rs[i].path);
+	}
+
+	fflush(stdout);
+
+	// open in order; each open waits for the reader of that FIFO
+	for(i = 0; i < nstreams; i++)
+	{
+		if((rs[i].fd = open(rs[i].path, O_WRONLY)) < 0)
+		{
+			perror(rs[i].path);
+			return 1;
+		}
+
+		fcntl(rs[i].fd, F_SETFL, fcntl(rs[i].fd, F_GETFL) | O_NONBLOCK);
+		rs[i].src = &srcs[i % nsrc];
+	}
+
+	// tick a few times per period so staggered deadlines are honored
+	tick = MAX(period / 4, 0.0005);
+	if((tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0)
+	{
+		perror("timerfd_create");
+		return 1;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = (time_t)tick;
+	its.it_interval.tv_nsec = (long)((tick - (time_t)tick) * 1e9);
+	its.it_value = its.it_interval;
+	timerfd_settime(tfd, 0, &its, 0);
+
+	start = now_sec();
+	for(i = 0; i < nstreams; i++)
+	{
+		rs[i].base = start + frand() * period;
+		rs[i].due = rs[i].base;
+	}
+
+	active = nstreams;
+	while(active > 0)
+	{
+		if(read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EINTR)
+		{
+			perror("timerfd");
+			break;
+		}
+
+		ticks++;
+		now = now_sec();
+
+		for(i = 0; i < nstreams; i++)
+		{
+			if(rs[i].fd < 0)
+				continue;
+
+			while(rs[i].due <= now)
+			{
+				rs[i].max_late = MAX(rs[i].max_late, now - rs[i].due);
+				rs[i].owed += chunk_bytes;
+				rs[i].base += period;
+				rs[i].due = rs[i].base + frand() * jitter;
+			}
+
+			if(!replay_write(&rs[i], gap_bytes, loops))
+			{
+				close(rs[i].fd);
+				rs[i].fd = -1;
+				active--;
+			}
+		}
+	}
+
+	now = now_sec();
+	for(i = 0; i < nstreams; i++)
+	{
+		fprintf(stderr, "%s: %.1f s audio, %lu stalls, max late %.1f ms\n",
+			rs[i].path, rs[i].written / (2.0 * FREQ_SAMP), rs[i].stalls, rs[i].max_late * 1000.0);
+	}
+
+	fprintf(stderr, "replay: %d streams in %.2f s, %lu ticks, target speed %.2fx\n",
+		nstreams, now - start, ticks, speed);
+
+	close(tfd);
+	return 0;
+}
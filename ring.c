@@ -0,0 +1,242 @@
+/*
+*      ring.c -- single-producer single-consumer sample ring in shared memory
+*
+*      A capture process writes int16 samples and a decoder process reads
+*      them without a system call on either side. The ring is a power-of-2
+*      array of samples indexed by free-running head/tail counters; the
+*      producer publishes head with a release store after copying, the
+*      consumer publishes tail the same way, so each side only ever loads
+*      the other's counter.
+*
+*      A named ring lives in POSIX shared memory (/dev/shm); an unnamed
+*      one is an anonymous shared mapping inherited across fork().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "easproc.h"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define RING_MAGIC 0x45415352             // "EASR"
+#define RING_LINE 64                      // keep the counters on separate cache lines
+
+struct ring_shared
+{
+	unsigned int magic;
+	unsigned int size;                    // samples, a power of 2
+	char pad0[RING_LINE - 2 * sizeof(unsigned int)];
+	unsigned long long head;              // samples written, producer only
+	char pad1[RING_LINE - sizeof(unsigned long long)];
+	unsigned long long tail;              // samples read, consumer only
+	char pad2[RING_LINE - sizeof(unsigned long long)];
+	int closed;                           // producer is done
+	char pad3[RING_LINE - sizeof(int)];
+	short samples[1];
+};
+
+struct eas_ring
+{
+	struct ring_shared *sh;
+	size_t map_len;
+	unsigned int mask;
+	char name[64];
+	int owner;                            // created the shared object
+};
+
+static size_t ring_bytes(unsigned int size)
+{
+	return offsetof(struct ring_shared, samples) + size * sizeof(short);
+}
+
+struct eas_ring *eas_ring_create(const char *name, int samples)
+{
+	struct eas_ring *r;
+	unsigned int size = 1024;
+	int fd = -1;
+	void *p;
+
+	while(size < (unsigned int)samples)
+		size <<= 1;
+
+	if(!(r = calloc(1, sizeof(*r))))
+		return 0;
+
+	r->map_len = ring_bytes(size);
+
+	if(name)
+	{
+		if((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 || ftruncate(fd, r->map_len) < 0)
+		{
+			perror(name);
+			if(fd >= 0)
+				close(fd);
+			free(r);
+			return 0;
+		}
+
+		p = mmap(0, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		snprintf(r->name, sizeof(r->name), "%s", name);
+	}
+	else
+		p = mmap(0, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		free(r);
+		return 0;
+	}
+
+	r->sh = p;
+	r->sh->size = size;
+	r->mask = size - 1;
+	r->owner = 1;
+	__atomic_store_n(&r->sh->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+	return r;
+}
+
+struct eas_ring *eas_ring_open(const char *name)
+{
+	struct eas_ring *r;
+	struct ring_shared hdr;
+	int fd;
+	void *p;
+
+	if((fd = shm_open(name, O_RDWR, 0)) < 0)
+	{
+		perror(name);
+		return 0;
+	}
+
+	if(read(fd, &hdr, offsetof(struct ring_shared, samples)) != (ssize_t)offsetof(struct ring_shared, samples) ||
+		hdr.magic != RING_MAGIC || !hdr.size || (hdr.size & (hdr.size - 1)))
+	{
+		fprintf(stderr, "%s: not a sample ring\n", name);
+		close(fd);
+		return 0;
+	}
+
+	if(!(r = calloc(1, sizeof(*r))))
+	{
+		close(fd);
+		return 0;
+	}
+
+	r->map_len = ring_bytes(hdr.size);
+	p = mmap(0, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+	{
+		perror("mmap");
+		free(r);
+		return 0;
+	}
+
+	r->sh = p;
+	r->mask = hdr.size - 1;
+	snprintf(r->name, sizeof(r->name), "%s", name);
+
+	return r;
+}
+
+int eas_ring_write(struct eas_ring *r, const short *samples, int count)
+{
+	unsigned long long head = r->sh->head;
+	unsigned long long tail = __atomic_load_n(&r->sh->tail, __ATOMIC_ACQUIRE);
+	unsigned int pos, n, first;
+
+	n = MIN((unsigned int)count, r->mask + 1 - (unsigned int)(head - tail));
+	pos = (unsigned int)head & r->mask;
+	first = MIN(n, r->mask + 1 - pos);
+
+	memcpy(&r->sh->samples[pos], samples, first * sizeof(short));
+	memcpy(&r->sh->samples[0], samples + first, (n - first) * sizeof(short));
+
+	__atomic_store_n(&r->sh->head, head + n, __ATOMIC_RELEASE);
+	return (int)n;
+}
+
+int eas_ring_read(struct eas_ring *r, short *samples, int max)
+{
+	unsigned long long tail = r->sh->tail;
+	unsigned long long head = __atomic_load_n(&r->sh->head, __ATOMIC_ACQUIRE);
+	unsigned int pos, n, first;
+
+	if(head == tail)
+		return __atomic_load_n(&r->sh->closed, __ATOMIC_ACQUIRE) && head == __atomic_load_n(&r->sh->head, __ATOMIC_ACQUIRE) ? -1 : 0;
+
+	n = MIN((unsigned int)max, (unsigned int)(head - tail));
+	pos = (unsigned int)tail & r->mask;
+	first = MIN(n, r->mask + 1 - pos);
+
+	memcpy(samples, &r->sh->samples[pos], first * sizeof(short));
+	memcpy(samples + first, &r->sh->samples[0], (n - first) * sizeof(short));
+
+	__atomic_store_n(&r->sh->tail, tail + n, __ATOMIC_RELEASE);
+	return (int)n;
+}
+
+// zero-copy access: the largest contiguous span that can be filled (or
+// read) in place, published afterwards with commit (or consume)
+short *eas_ring_write_span(struct eas_ring *r, int *count)
+{
+	unsigned long long head = r->sh->head;
+	unsigned long long tail = __atomic_load_n(&r->sh->tail, __ATOMIC_ACQUIRE);
+	unsigned int pos = (unsigned int)head & r->mask;
+
+	*count = (int)MIN(r->mask + 1 - (unsigned int)(head - tail), r->mask + 1 - pos);
+	return &r->sh->samples[pos];
+}
+
+void eas_ring_commit(struct eas_ring *r, int count)
+{
+	__atomic_store_n(&r->sh->head, r->sh->head + count, __ATOMIC_RELEASE);
+}
+
+// *count is -1 once the writer has closed and everything was consumed
+const short *eas_ring_read_span(struct eas_ring *r, int *count)
+{
+	unsigned long long tail = r->sh->tail;
+	unsigned long long head = __atomic_load_n(&r->sh->head, __ATOMIC_ACQUIRE);
+	unsigned int pos = (unsigned int)tail & r->mask;
+
+	if(head == tail)
+		*count = __atomic_load_n(&r->sh->closed, __ATOMIC_ACQUIRE) && head == __atomic_load_n(&r->sh->head, __ATOMIC_ACQUIRE) ? -1 : 0;
+	else
+		*count = (int)MIN((unsigned int)(head - tail), r->mask + 1 - pos);
+
+	return &r->sh->samples[pos];
+}
+
+void eas_ring_consume(struct eas_ring *r, int count)
+{
+	__atomic_store_n(&r->sh->tail, r->sh->tail + count, __ATOMIC_RELEASE);
+}
+
+void eas_ring_close_writer(struct eas_ring *r)
+{
+	__atomic_store_n(&r->sh->closed, 1, __ATOMIC_RELEASE);
+}
+
+void eas_ring_destroy(struct eas_ring *r)
+{
+	if(!r)
+		return;
+
+	munmap(r->sh, r->map_len);
+	if(r->owner && r->name[0])
+		shm_unlink(r->name);
+
+	free(r);
+}
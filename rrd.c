@@ -0,0 +1,347 @@
+/*
+*      rrd.c -- round-robin per-stream metric history in one mapped file
+*
+*      Each stream keeps a fixed ring of rows in every archive: 1 s rows
+*      for the last 15 minutes, 1 min rows for a day and 1 h rows for 30
+*      days. An update folds the sample into each archive's open interval
+*      and, when the interval is over, writes the consolidated row into
+*      the slot it maps to, so every update costs the same and the file
+*      never grows. The open intervals live in the file too, so a host
+*      that restarts carries on where it left off.
+*
+*      Rows hold the interval start in wall-clock seconds; a slot whose
+*      time is too old for its position is stale and is not returned.
+*
+*      eas-decode history [-s stream] [-a 1s|1m|1h] [-n rows] file.rrd
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "easproc.h"
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+#define RRD_MAGIC "EASRRD1"
+#define RRD_VERSION 1
+
+static const struct
+{
+	const char *name;
+	double step;                          // seconds per row
+	int rows;
+} rrd_archives[EAS_RRD_ARCHIVES] = {
+	{ "1s", 1, 900 },
+	{ "1m", 60, 1440 },
+	{ "1h", 3600, 720 },
+};
+
+struct rrd_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int nstreams;
+	unsigned int narchives;
+	unsigned int rows[EAS_RRD_ARCHIVES];
+	unsigned int pad;
+	double step[EAS_RRD_ARCHIVES];
+};
+
+// an archive's interval being consolidated
+struct rrd_open
+{
+	double bucket;                        // interval index, time / step
+	double rate;                          // sums
+	double lag;
+	double rms;
+	double quality;
+	float lag_max;
+	unsigned int faults;
+	int engine;
+	int count;
+};
+
+struct eas_rrd
+{
+	char *map;
+	size_t size;
+	struct rrd_open *open;                // [stream][archive]
+	struct eas_rrd_row *rows[EAS_RRD_ARCHIVES];  // [stream][row]
+	int nstreams;
+};
+
+static size_t rrd_layout(struct eas_rrd *r, int nstreams)
+{
+	size_t off;
+	int a;
+
+	off = sizeof(struct rrd_header);
+	if(r)
+		r->open = (struct rrd_open *)(r->map + off);
+	off += (size_t)nstreams * EAS_RRD_ARCHIVES * sizeof(struct rrd_open);
+
+	for(a = 0; a < EAS_RRD_ARCHIVES; a++)
+	{
+		if(r)
+			r->rows[a] = (struct eas_rrd_row *)(r->map + off);
+		off += (size_t)nstreams * rrd_archives[a].rows * sizeof(struct eas_rrd_row);
+	}
+
+	return off;
+}
+
+static int rrd_matches(const struct rrd_header *h, int nstreams)
+{
+	int a;
+
+	if(memcmp(h->magic, RRD_MAGIC, sizeof(h->magic)) || h->version != RRD_VERSION ||
+		h->nstreams != (unsigned int)nstreams || h->narchives != EAS_RRD_ARCHIVES)
+		return 0;
+
+	for(a = 0; a < EAS_RRD_ARCHIVES; a++)
+	{
+		if(h->rows[a] != (unsigned int)rrd_archives[a].rows || h->step[a] != rrd_archives[a].step)
+			return 0;
+	}
+
+	return 1;
+}
+
+// nstreams 0 opens an existing file read-only with whatever it holds
+struct eas_rrd *eas_rrd_open(const char *path, int nstreams)
+{
+	struct eas_rrd *r;
+	struct rrd_header hdr, *h;
+	struct stat st;
+	size_t size;
+	int fd, a, create, writable = nstreams > 0;
+
+	if((fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0 || fstat(fd, &st) < 0)
+	{
+		perror(path);
+		if(fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	create = !st.st_size;
+	if(!create && (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || !rrd_matches(&hdr, nstreams ? nstreams : (int)hdr.nstreams)))
+	{
+		// never clobber history we cannot read
+		fprintf(stderr, "%s: not a history file for %d streams\n", path, nstreams);
+		close(fd);
+		return 0;
+	}
+
+	if(!nstreams)
+		nstreams = hdr.nstreams;
+
+	size = rrd_layout(0, nstreams);
+	if((create && ftruncate(fd, size) < 0) || (!create && (size_t)st.st_size != size) || !(r = calloc(1, sizeof(*r))))
+	{
+		fprintf(stderr, "%s: bad size\n", path);
+		close(fd);
+		return 0;
+	}
+
+	r->map = mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(r->map == MAP_FAILED)
+	{
+		perror("mmap");
+		free(r);
+		return 0;
+	}
+
+	r->size = size;
+	r->nstreams = nstreams;
+	rrd_layout(r, nstreams);
+
+	if(create)
+	{
+		h = (struct rrd_header *)r->map;
+		h->version = RRD_VERSION;
+		h->nstreams = nstreams;
+		h->narchives = EAS_RRD_ARCHIVES;
+		for(a = 0; a < EAS_RRD_ARCHIVES; a++)
+		{
+			h->rows[a] = rrd_archives[a].rows;
+			h->step[a] = rrd_archives[a].step;
+		}
+		memcpy(h->magic, RRD_MAGIC, sizeof(h->magic));
+	}
+
+	return r;
+}
+
+int eas_rrd_streams(const struct eas_rrd *r)
+{
+	return r->nstreams;
+}
+
+double eas_rrd_step(int archive)
+{
+	return archive >= 0 && archive < EAS_RRD_ARCHIVES ? rrd_archives[archive].step : -1;
+}
+
+static void rrd_flush(struct eas_rrd *r, int stream, int a)
+{
+	struct rrd_open *o = &r->open[stream * EAS_RRD_ARCHIVES + a];
+	struct eas_rrd_row *row;
+
+	if(!o->count)
+		return;
+
+	row = &r->rows[a][(size_t)stream * rrd_archives[a].rows + (unsigned long long)o->bucket % rrd_archives[a].rows];
+	row->time = o->bucket * rrd_archives[a].step;
+	row->rate = (float)(o->rate / o->count);
+	row->lag = (float)(o->lag / o->count);
+	row->lag_max = o->lag_max;
+	row->rms = (float)(o->rms / o->count);
+	row->quality = (float)(o->quality / o->count);
+	row->faults = o->faults;
+	row->engine = o->engine;
+
+	memset(o, 0, sizeof(*o));
+}
+
+// v->time and v->lag_max are ignored; the sample is for time t
+void eas_rrd_update(struct eas_rrd *r, int stream, double t, const struct eas_rrd_row *v)
+{
+	struct rrd_open *o;
+	double bucket;
+	int a;
+
+	if(stream < 0 || stream >= r->nstreams)
+		return;
+
+	for(a = 0; a < EAS_RRD_ARCHIVES; a++)
+	{
+		o = &r->open[stream * EAS_RRD_ARCHIVES + a];
+		bucket = floor(t / rrd_archives[a].step);
+
+		if(o->count && bucket != o->bucket)
+			rrd_flush(r, stream, a);
+
+		o->bucket = bucket;
+		o->rate += v->rate;
+		o->lag += v->lag;
+		o->rms += v->rms;
+		o->quality += v->quality;
+		o->lag_max = MAX(o->lag_max, v->lag);
+		o->faults |= v->faults;
+		o->engine = v->engine;
+		o->count++;
+	}
+}
+
+// the live rows of one archive, oldest first; returns how many
+int eas_rrd_fetch(const struct eas_rrd *r, int stream, int archive, struct eas_rrd_row *rows, int max)
+{
+	const struct eas_rrd_row *ring;
+	double newest = 0, oldest;
+	int i, n = 0, nrows, start;
+
+	if(stream < 0 || stream >= r->nstreams || archive < 0 || archive >= EAS_RRD_ARCHIVES)
+		return -1;
+
+	nrows = rrd_archives[archive].rows;
+	ring = &r->rows[archive][(size_t)stream * nrows];
+
+	for(i = 0; i < nrows; i++)
+		newest = MAX(newest, ring[i].time);
+
+	if(newest <= 0)
+		return 0;
+
+	// slots older than one lap were not rewritten and are stale
+	oldest = newest - (nrows - 1) * rrd_archives[archive].step;
+	start = (int)((unsigned long long)floor(newest / rrd_archives[archive].step + 0.5) % nrows) + 1;
+
+	for(i = 0; i < nrows && n < max; i++)
+	{
+		if(ring[(start + i) % nrows].time >= oldest && ring[(start + i) % nrows].time > 0)
+			rows[n++] = ring[(start + i) % nrows];
+	}
+
+	return n;
+}
+
+void eas_rrd_close(struct eas_rrd *r)
+{
+	if(!r)
+		return;
+
+	munmap(r->map, r->size);
+	free(r);
+}
+
+int history_main(int argc, char **argv)
+{
+	struct eas_rrd *r;
+	struct eas_rrd_row *rows;
+	char when[32];
+	time_t t;
+	int opt, a, i, n, stream = -1, archive = 0, max = 20, first, last;
+
+	while((opt = getopt(argc, argv, "s:a:n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's': stream = atoi(optarg); break;
+		case 'a':
+			for(archive = 0; archive < EAS_RRD_ARCHIVES && strcmp(optarg, rrd_archives[archive].name); archive++)
+				;
+			break;
+		case 'n': max = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if(optind + 1 != argc || archive >= EAS_RRD_ARCHIVES || max < 1)
+		goto usage;
+
+	if(!(r = eas_rrd_open(argv[optind], 0)))
+		return 1;
+
+	a = archive;
+	rows = malloc(rrd_archives[a].rows * sizeof(*rows));
+	first = stream < 0 ? 0 : stream;
+	last = stream < 0 ? r->nstreams - 1 : stream;
+
+	printf("stream  %-19s  %9s  %8s  %8s  %6s  %7s  %-6s  %s\n",
+		"time", "samples/s", "lag ms", "max ms", "rms", "quality", "faults", "engine");
+
+	for(; first <= last && first < r->nstreams; first++)
+	{
+		n = eas_rrd_fetch(r, first, a, rows, rrd_archives[a].rows);
+
+		// the most recent max rows
+		for(i = MAX(0, n - max); i < n; i++)
+		{
+			t = (time_t)rows[i].time;
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+			printf("%6d  %-19s  %9.0f  %8.1f  %8.1f  %6.3f  %7.3f  0x%-4x  %s\n", first, when, rows[i].rate,
+				rows[i].lag * 1000.0, rows[i].lag_max * 1000.0, rows[i].rms, rows[i].quality, rows[i].faults,
+				eas_engine_name(rows[i].engine));
+		}
+	}
+
+	free(rows);
+	eas_rrd_close(r);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: history [-s stream] [-a 1s|1m|1h] [-n rows] file.rrd\n");
+	return 1;
+}
@@ -0,0 +1,1104 @@
+/*
+*      runtime.c -- multi-stream live decoder
+*
+*      Each input (normally a FIFO fed by a receiver or by the replay tool)
+*      gets its own eas_stream. Pollable inputs are multiplexed with epoll;
+*      regular files cannot be polled and are read round-robin instead.
+*
+*      FIFOs are opened in argument order and each open() waits for its
+*      writer, so a writer must open them in the same order (replay does).
+*
+*      With a coalescing budget set, idle inputs are taken off epoll and
+*      drained together once per budget period, so hundreds of quiet
+*      streams cost one wakeup and one large eas_push() each per period
+*      instead of one per write. A stream whose decoder sees FSK is put
+*      back on epoll at once and read on every write until it goes quiet.
+*
+*      With a CPU budget set, every stream is charged its engine's cost from
+*      the cost model (cost.c) and a stream that would take the committed
+*      load past the budget is refused when it is added.
+*
+*      With degradation enabled, the runtime watches the mean input lag
+*      and, while it is over the high mark, steps the lowest-priority
+*      streams down a ladder of ever cheaper decoder engines (ordered by
+*      the cost model); once lag stays under the low mark it steps the
+*      highest-priority degraded streams back up.
+*
+*      With adaptive engines, each stream picks its own engine from the
+*      quality of the bursts it decodes (see eas_set_adaptive()) along the
+*      same ladder. Degradation overrides that: a degraded stream stays on
+*      the engine it was put on until it is restored.
+*
+*      A virtual runtime runs the same policies against a virtual clock for
+*      deterministic scheduler experiments at any scale. Inputs are queues
+*      filled with eas_runtime_write() (normally by a feed from the tick
+*      hook); every read is charged its engine's cost from the cost model
+*      plus fixed read and wakeup overheads, and the clock only moves by
+*      those charges and by idling until the next timer. Producers cost
+*      nothing, as they would on other cores.
+*
+*      With a history file (rrd.c) the runtime samples every stream's rate,
+*      lag, health and quality once per second into it.
+*/
+
+#define _GNU_SOURCE                       // F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define RT_READ_LEN 4096                  // max samples per read()
+#define RT_MAX_EVENTS 64                  // epoll events per wakeup
+#define RT_DEGRADE_INTERVAL 0.25          // seconds between lag checks
+#define RT_RESTORE_CHECKS 4               // calm checks before stepping back up
+#define RT_VIRT_WAKE 5e-6                 // virtual cost of a wakeup, s
+#define RT_VIRT_READ 2e-6                 // virtual cost of a read() and eas_push() call, s
+#define RT_VQ_MIN 4096                    // virtual input queue, samples; grows to
+#define RT_VQ_MAX 32768                   // the default pipe size
+
+struct rt_stream
+{
+	eas_stream *s;
+	int fd;
+	int polled;                           // registered with epoll
+	int open;                             // input not yet at EOF
+	int hot;                              // FSK present; woken by every write
+	double cost;                          // cpus charged against the budget
+	int priority;                         // higher degrades last
+	int rung;                             // position on the engine ladder
+	int ncarry;                           // odd byte left from the last read
+	unsigned char carry;
+	unsigned long long bytes;
+	unsigned long reads;
+	short *vq;                            // virtual input queue, fd < 0
+	unsigned int vq_size;
+	unsigned int vq_head;
+	unsigned int vq_len;
+	int vq_eof;                           // writer is done
+	unsigned long long hist_bytes;        // bytes at the last history sample
+	char path[256];
+};
+
+struct eas_runtime
+{
+	int epfd;
+	int nstreams;
+	int max_streams;
+	int active;                           // streams not yet at EOF
+	int unpolled;                         // active streams epoll cannot watch
+	int stopping;                         // set by eas_runtime_stop()
+	unsigned long wakeups;
+	unsigned long drains;                 // coalesced wakeups that read idle streams
+	unsigned long switches;               // idle/hot transitions
+	double budget;                        // coalescing latency budget, s; 0 = off
+	double cpu_budget;                    // cpus streams may commit; 0 = unlimited
+	double load;                          // cpus committed by open streams
+	double lag_high;                      // degrade above this lag, s; 0 = off
+	double lag_low;                       // restore below this lag, s
+	double next_degrade;
+	int calm;                             // consecutive checks under lag_low
+	int ladder[EAS_ENGINE_COUNT];         // engines, most to least expensive
+	int adaptive;                         // streams pick engines by signal quality
+	int virt;                             // virtual clock and inputs
+	double vnow;                          // virtual time, s
+	double vbusy;                         // virtual time charged to work, s
+	int vnext;                            // round-robin start of the next virtual wakeup
+	unsigned long degrades;
+	unsigned long restores;
+	double next_drain;
+	struct eas_rrd *history;              // per-stream metric history, or 0
+	double next_history;
+	double hist_last;
+	double wall0;                         // wall clock at rt_now() == 0 of a virtual run
+	struct timespec start;
+	struct timespec stop;
+	struct rt_stream *streams;
+
+	// hooks
+	eas_event_fn event_fn;
+	void *event_ctx;
+	void (*tick_fn)(eas_runtime *rt, void *ctx);
+	void *tick_ctx;
+	double tick_interval;
+	double next_tick;
+
+	short buf[RT_READ_LEN + 1];
+};
+
+static double ts_sec(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+eas_runtime *eas_runtime_create(int max_streams)
+{
+	eas_runtime *rt;
+
+	if(!(rt = eas_malloc(NULL, sizeof(*rt))))
+		return 0;
+
+	memset(rt, 0, sizeof(*rt));
+	rt->max_streams = max_streams;
+
+	if(!(rt->streams = eas_malloc(NULL, max_streams * sizeof(rt->streams[0]))))
+	{
+		eas_free(NULL, rt);
+		return 0;
+	}
+
+	memset(rt->streams, 0, max_streams * sizeof(rt->streams[0]));
+
+	if((rt->epfd = epoll_create1(0)) < 0)
+	{
+		perror("epoll_create1");
+		eas_free(NULL, rt->streams);
+		eas_free(NULL, rt);
+		return 0;
+	}
+
+	return rt;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_sec(&ts);
+}
+
+static double rt_now(const eas_runtime *rt)
+{
+	return rt->virt ? rt->vnow : now_sec();
+}
+
+static void rt_stamp(const eas_runtime *rt, struct timespec *ts)
+{
+	if(!rt->virt)
+	{
+		clock_gettime(CLOCK_MONOTONIC, ts);
+		return;
+	}
+
+	ts->tv_sec = (time_t)rt->vnow;
+	ts->tv_nsec = (long)((rt->vnow - ts->tv_sec) * 1e9);
+}
+
+static void rt_charge(eas_runtime *rt, double sec)
+{
+	rt->vnow += sec;
+	rt->vbusy += sec;
+}
+
+void eas_runtime_set_virtual(eas_runtime *rt)
+{
+	// before any stream or timer is set up
+	rt->virt = 1;
+	rt->vnow = 0;
+
+	if(eas_cost(EAS_ENGINE_FULL, FREQ_SAMP) < 0)
+		eas_cost_calibrate(0);
+}
+
+int eas_runtime_is_virtual(const eas_runtime *rt)
+{
+	return rt->virt;
+}
+
+double eas_runtime_now(const eas_runtime *rt)
+{
+	return rt_now(rt);
+}
+
+double eas_runtime_busy(const eas_runtime *rt)
+{
+	return rt->vbusy;
+}
+
+static double wall_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts_sec(&ts);
+}
+
+void eas_runtime_set_history(eas_runtime *rt, struct eas_rrd *rrd)
+{
+	rt->history = rrd;
+	rt->hist_last = rt_now(rt);
+	rt->next_history = rt->hist_last + eas_rrd_step(0);
+	rt->wall0 = wall_sec() - (rt->virt ? rt->vnow : 0);
+}
+
+// one sample of every stream into the history; streams past the file's
+// count are not recorded
+static void rt_history(eas_runtime *rt)
+{
+	struct eas_runtime_stream_stats rs;
+	struct eas_rrd_row v;
+	struct rt_stream *st;
+	double now = rt_now(rt), t;
+	int i;
+
+	t = rt->virt ? rt->wall0 + now : wall_sec();
+
+	for(i = 0; i < rt->nstreams && i < eas_rrd_streams(rt->history); i++)
+	{
+		st = &rt->streams[i];
+		if(eas_runtime_stream_stats(rt, i, &rs) < 0)
+			continue;
+
+		memset(&v, 0, sizeof(v));
+		v.rate = now > rt->hist_last ? (float)((st->bytes - st->hist_bytes) / sizeof(short) / (now - rt->hist_last)) : 0;
+		v.lag = (float)rs.lag;
+		v.rms = rs.rms;
+		v.quality = rs.quality;
+		v.faults = rs.faults;
+		v.engine = rs.engine;
+		eas_rrd_update(rt->history, i, t, &v);
+
+		st->hist_bytes = st->bytes;
+	}
+
+	rt->hist_last = now;
+}
+
+void eas_runtime_set_event_handler(eas_runtime *rt, eas_event_fn fn, void *ctx)
+{
+	int i;
+
+	rt->event_fn = fn;
+	rt->event_ctx = ctx;
+
+	for(i = 0; i < rt->nstreams; i++)
+		eas_set_event_handler(rt->streams[i].s, fn, ctx);
+}
+
+void eas_runtime_set_tick(eas_runtime *rt, double interval, void (*fn)(eas_runtime *rt, void *ctx), void *ctx)
+{
+	rt->tick_fn = fn;
+	rt->tick_ctx = ctx;
+	rt->tick_interval = interval;
+	rt->next_tick = rt_now(rt) + interval;
+}
+
+void eas_runtime_stop(eas_runtime *rt)
+{
+	rt->stopping = 1;
+}
+
+// the pipe must hold a whole budget of audio or the writer stalls
+static void rt_pipe_size(eas_runtime *rt, struct rt_stream *st)
+{
+	int want = (int)(2 * rt->budget * FREQ_SAMP * sizeof(short));
+
+	if(fcntl(st->fd, F_GETPIPE_SZ) < want)
+		fcntl(st->fd, F_SETPIPE_SZ, want);
+}
+
+void eas_runtime_set_coalesce(eas_runtime *rt, double budget)
+{
+	struct epoll_event ev;
+	struct rt_stream *st;
+	int i;
+
+	rt->budget = budget > 0 ? budget : 0;
+	rt->next_drain = rt_now(rt) + rt->budget;
+
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		st = &rt->streams[i];
+		if(!st->open || !st->polled)
+			continue;
+
+		// idle until the decoder says otherwise
+		st->hot = 0;
+		if(st->fd < 0)
+			continue;
+
+		ev.events = rt->budget ? 0 : EPOLLIN;
+		ev.data.ptr = st;
+		epoll_ctl(rt->epfd, EPOLL_CTL_MOD, st->fd, &ev);
+
+		if(rt->budget)
+			rt_pipe_size(rt, st);
+	}
+}
+
+void eas_runtime_set_cpu_budget(eas_runtime *rt, double cpus)
+{
+	rt->cpu_budget = cpus > 0 ? cpus : 0;
+
+	// an uncalibrated host measures itself now, before streams arrive
+	if(rt->cpu_budget && eas_cost(EAS_ENGINE_FULL, FREQ_SAMP) < 0)
+		eas_cost_calibrate(0);
+}
+
+static int cmp_engine_cost(const void *a, const void *b)
+{
+	double x = eas_cost(*(const int *)a, FREQ_SAMP), y = eas_cost(*(const int *)b, FREQ_SAMP);
+
+	return x > y ? -1 : x < y;
+}
+
+static void rt_ladder(eas_runtime *rt)
+{
+	int i;
+
+	if(eas_cost(EAS_ENGINE_FULL, FREQ_SAMP) < 0)
+		eas_cost_calibrate(0);
+
+	// streams start on the full engine; the rest go by measured cost
+	for(i = 0; i < EAS_ENGINE_COUNT; i++)
+		rt->ladder[i] = i;
+
+	qsort(rt->ladder + 1, EAS_ENGINE_COUNT - 1, sizeof(rt->ladder[0]), cmp_engine_cost);
+}
+
+void eas_runtime_set_degrade(eas_runtime *rt, double lag_high, double lag_low)
+{
+	rt->lag_high = lag_high > 0 ? lag_high : 0;
+	rt->lag_low = lag_low;
+	rt->next_degrade = rt_now(rt) + RT_DEGRADE_INTERVAL;
+
+	if(rt->lag_high)
+		rt_ladder(rt);
+}
+
+void eas_runtime_set_adaptive(eas_runtime *rt, int enable)
+{
+	int i;
+
+	rt->adaptive = enable;
+	if(enable)
+	{
+		rt_ladder(rt);
+		eas_set_adaptive_ladder(rt->ladder);
+	}
+
+	for(i = 0; i < rt->nstreams; i++)
+		eas_set_adaptive(rt->streams[i].s, enable && !rt->streams[i].rung);
+}
+
+int eas_runtime_set_priority(eas_runtime *rt, int id, int priority)
+{
+	if(id < 0 || id >= rt->nstreams)
+		return -1;
+
+	rt->streams[id].priority = priority;
+	return 0;
+}
+
+double eas_runtime_capacity(const eas_runtime *rt, int *streams)
+{
+	double left = rt->cpu_budget - rt->load, cost = eas_cost(EAS_ENGINE_FULL, FREQ_SAMP);
+
+	if(!rt->cpu_budget)
+	{
+		if(streams)
+			*streams = -1;
+		return -1;
+	}
+
+	if(streams)
+		*streams = cost > 0 && left > 0 ? (int)(left / cost) : 0;
+
+	return left;
+}
+
+static int rt_admit(eas_runtime *rt, const char *name)
+{
+	double cost = eas_cost(EAS_ENGINE_FULL, FREQ_SAMP);
+
+	if(!rt->cpu_budget || rt->load + cost <= rt->cpu_budget)
+		return 0;
+
+	fprintf(stderr, "%s: refused, needs %.4f cpus with %.4f of %.4g left\n",
+		name, cost, rt->cpu_budget - rt->load, rt->cpu_budget);
+	return -1;
+}
+
+int eas_runtime_add(eas_runtime *rt, const char *path)
+{
+	int fd, id;
+
+	if(rt->nstreams >= rt->max_streams)
+		return -1;
+
+	if(rt_admit(rt, path) < 0)
+		return -2;
+
+	// a FIFO open blocks here until its writer appears
+	if((fd = open(path, O_RDONLY)) < 0)
+	{
+		perror(path);
+		return -1;
+	}
+
+	if((id = eas_runtime_add_fd(rt, fd, path)) < 0)
+		close(fd);
+
+	return id;
+}
+
+int eas_runtime_add_fd(eas_runtime *rt, int fd, const char *name)
+{
+	struct rt_stream *st;
+	struct epoll_event ev;
+
+	if(rt->nstreams >= rt->max_streams || (fd < 0) != rt->virt)
+		return -1;
+
+	if(rt_admit(rt, name) < 0)
+		return -2;
+
+	if(fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	st = &rt->streams[rt->nstreams];
+	memset(st, 0, sizeof(*st));
+	st->fd = fd;
+	st->open = 1;
+	strncpy(st->path, name, sizeof(st->path) - 1);
+
+	if(!(st->s = eas_open(rt->nstreams)))
+		return -1;
+
+	if(rt->event_fn)
+		eas_set_event_handler(st->s, rt->event_fn, rt->event_ctx);
+	eas_set_adaptive(st->s, rt->adaptive);
+
+	ev.events = rt->budget ? 0 : EPOLLIN;
+	ev.data.ptr = st;
+
+	// a virtual input counts as polled; its queue stands in for the pipe
+	if(fd < 0)
+		st->polled = 1;
+	else if(!epoll_ctl(rt->epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		st->polled = 1;
+		if(rt->budget)
+			rt_pipe_size(rt, st);
+	}
+	else if(errno == EPERM)
+		rt->unpolled++;
+	else
+	{
+		perror("epoll_ctl");
+		eas_close(st->s);
+		return -1;
+	}
+
+	st->cost = MAX(eas_cost(EAS_ENGINE_FULL, FREQ_SAMP), 0);
+	rt->load += st->cost;
+	rt->active++;
+	return rt->nstreams++;
+}
+
+int eas_runtime_add_virtual(eas_runtime *rt, const char *name)
+{
+	return eas_runtime_add_fd(rt, -1, name);
+}
+
+int eas_runtime_write(eas_runtime *rt, int id, const short *samples, int count)
+{
+	struct rt_stream *st;
+	unsigned int size, pos, n, first;
+	short *q;
+
+	if(id < 0 || id >= rt->nstreams || (st = &rt->streams[id])->fd >= 0 || !st->open || st->vq_eof)
+		return -1;
+
+	// grow like a pipe the reader falls behind on, up to its size
+	if(st->vq_len + count > st->vq_size && st->vq_size < RT_VQ_MAX)
+	{
+		for(size = MAX(st->vq_size, RT_VQ_MIN); size < st->vq_len + count && size < RT_VQ_MAX; size <<= 1)
+			;
+
+		if(!(q = eas_malloc(NULL, size * sizeof(short))))
+			return 0;
+
+		for(n = 0; n < st->vq_len; n++)
+			q[n] = st->vq[(st->vq_head + n) % st->vq_size];
+
+		eas_free(NULL, st->vq);
+		st->vq = q;
+		st->vq_size = size;
+		st->vq_head = 0;
+	}
+
+	n = MIN((unsigned int)count, st->vq_size - st->vq_len);
+	pos = (st->vq_head + st->vq_len) % MAX(st->vq_size, 1);
+	first = MIN(n, st->vq_size - pos);
+
+	memcpy(st->vq + pos, samples, first * sizeof(short));
+	memcpy(st->vq, samples + first, (n - first) * sizeof(short));
+	st->vq_len += n;
+
+	return (int)n;
+}
+
+int eas_runtime_close_input(eas_runtime *rt, int id)
+{
+	if(id < 0 || id >= rt->nstreams || rt->streams[id].fd >= 0)
+		return -1;
+
+	rt->streams[id].vq_eof = 1;
+	return 0;
+}
+
+static int rt_vq_take(struct rt_stream *st, short *samples, int max)
+{
+	unsigned int n = MIN((unsigned int)max, st->vq_len), first = MIN(n, st->vq_size - st->vq_head);
+
+	memcpy(samples, st->vq + st->vq_head, first * sizeof(short));
+	memcpy(samples + first, st->vq, (n - first) * sizeof(short));
+
+	st->vq_head = n ? (st->vq_head + n) % st->vq_size : st->vq_head;
+	st->vq_len -= n;
+	return (int)n;
+}
+
+static void rt_finish(eas_runtime *rt, struct rt_stream *st)
+{
+	if(st->fd < 0)
+	{
+		eas_free(NULL, st->vq);
+		st->vq = 0;
+		st->vq_len = 0;
+	}
+	else if(st->polled)
+		epoll_ctl(rt->epfd, EPOLL_CTL_DEL, st->fd, 0);
+	else
+		rt->unpolled--;
+
+	if(st->fd >= 0)
+		close(st->fd);
+	st->open = 0;
+	rt->active--;
+	rt->load -= st->cost;
+}
+
+// returns bytes read, 0 when nothing was available or the input ended
+static int rt_read(eas_runtime *rt, struct rt_stream *st)
+{
+	char *p = (char *)rt->buf;
+	struct epoll_event ev;
+	int n, got;
+
+	if(st->ncarry)
+		p[0] = st->carry;
+
+	if(st->fd < 0)
+	{
+		// a virtual read of whatever is queued, charged at the engine's cost
+		rt_charge(rt, RT_VIRT_READ + MAX(eas_cost(eas_get_engine(st->s), FREQ_SAMP), 0) *
+			MIN(st->vq_len, RT_READ_LEN) / FREQ_SAMP);
+
+		if(!st->vq_len && !st->vq_eof)
+			return 0;
+
+		n = rt_vq_take(st, rt->buf, RT_READ_LEN) * sizeof(short);
+	}
+	else
+		n = read(st->fd, p + st->ncarry, sizeof(short)*RT_READ_LEN);
+
+	if(n < 0)
+	{
+		if(errno == EAGAIN || errno == EINTR)
+			return 0;
+
+		perror(st->path);
+		rt_finish(rt, st);
+		return 0;
+	}
+
+	if(!n)
+	{
+		rt_finish(rt, st);
+		return 0;
+	}
+
+	st->bytes += n;
+	st->reads++;
+	got = n;
+
+	// keep an odd trailing byte for the next read
+	n += st->ncarry;
+	st->ncarry = n & 1;
+	if(st->ncarry)
+		st->carry = p[n - 1];
+
+	eas_push(st->s, rt->buf, n / sizeof(short));
+
+	// FSK starting or ending moves the stream on or off epoll
+	if(rt->budget && st->polled && st->hot != eas_fsk_active(st->s))
+	{
+		st->hot = !st->hot;
+		ev.events = st->hot ? EPOLLIN : 0;
+		ev.data.ptr = st;
+		if(st->fd >= 0)
+			epoll_ctl(rt->epfd, EPOLL_CTL_MOD, st->fd, &ev);
+		rt->switches++;
+	}
+
+	return got;
+}
+
+// read everything the idle streams queued during the last budget period
+static void rt_drain(eas_runtime *rt)
+{
+	struct rt_stream *st;
+	int i;
+
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		st = &rt->streams[i];
+		if(!st->open || !st->polled || st->hot)
+			continue;
+
+		// a short read means the pipe is empty
+		while(st->open && rt_read(rt, st) == (int)(sizeof(short)*RT_READ_LEN))
+			;
+	}
+
+	rt->drains++;
+}
+
+// lag is the audio waiting in the pipe that has not been read yet
+static double rt_lag(const struct rt_stream *st)
+{
+	int queued = 0;
+
+	if(st->open && st->fd < 0)
+		return st->vq_len / (double)FREQ_SAMP;
+
+	if(!st->open || !st->polled || ioctl(st->fd, FIONREAD, &queued) < 0)
+		return 0;
+
+	return queued / (2.0 * FREQ_SAMP);
+}
+
+int eas_runtime_stream_stats(const eas_runtime *rt, int id, struct eas_runtime_stream_stats *rs)
+{
+	const struct rt_stream *st;
+	struct eas_stats es;
+
+	if(id < 0 || id >= rt->nstreams)
+		return -1;
+
+	st = &rt->streams[id];
+	eas_get_stats(st->s, &es);
+	rs->samples = st->bytes / sizeof(short);
+	rs->reads = st->reads;
+	rs->engine = eas_get_engine(st->s);
+	rs->rung = st->rung;
+	rs->lag = rt_lag(st);
+	rs->rms = es.health.rms;
+	rs->faults = es.health.faults;
+	rs->quality = es.quality;
+	return 0;
+}
+
+// an adaptive stream that is not degraded may already be further down
+// the ladder than its rung says
+static int rt_rung(const eas_runtime *rt, const struct rt_stream *st)
+{
+	int i;
+
+	if(rt->adaptive && !st->rung)
+	{
+		for(i = 0; i < EAS_ENGINE_COUNT; i++)
+		{
+			if(rt->ladder[i] == eas_get_engine(st->s))
+				return i;
+		}
+	}
+
+	return st->rung;
+}
+
+static void rt_set_rung(eas_runtime *rt, struct rt_stream *st, int rung)
+{
+	double cost;
+
+	st->rung = rung;
+	eas_set_adaptive(st->s, 0);
+	eas_set_engine(st->s, rt->ladder[rung]);
+	eas_set_adaptive(st->s, rt->adaptive && !rung);
+
+	if((cost = eas_cost(rt->ladder[rung], FREQ_SAMP)) > 0)
+	{
+		rt->load += cost - st->cost;
+		st->cost = cost;
+	}
+}
+
+// shedding order: lowest priority first, quiet before busy, then the
+// stream degraded least so far; restoring goes the other way
+static int rt_sheds_before(const struct rt_stream *a, int a_hot, const struct rt_stream *b, int b_hot)
+{
+	if(a->priority != b->priority)
+		return a->priority < b->priority;
+	if(a_hot != b_hot)
+		return a_hot < b_hot;
+	return a->rung < b->rung;
+}
+
+static struct rt_stream *rt_pick(eas_runtime *rt, int down)
+{
+	struct rt_stream *st, *best = 0;
+	int i, hot, best_hot = 0;
+
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		st = &rt->streams[i];
+		if(!st->open || (down ? rt_rung(rt, st) == EAS_ENGINE_COUNT - 1 : !st->rung))
+			continue;
+
+		hot = eas_fsk_active(st->s);
+
+		if(!best || (down ? rt_sheds_before(st, hot, best, best_hot) : rt_sheds_before(best, best_hot, st, hot)))
+		{
+			best = st;
+			best_hot = hot;
+		}
+	}
+
+	return best;
+}
+
+static void rt_degrade(eas_runtime *rt)
+{
+	struct rt_stream *st;
+	double lag = 0;
+	int i, n = 0, steps;
+
+	// overload shows as every stream falling behind, so go by the mean;
+	// one input arriving in bursts should not shed the others
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		if(rt->streams[i].open && rt->streams[i].polled)
+		{
+			lag += rt_lag(&rt->streams[i]);
+			n++;
+		}
+	}
+
+	lag = n ? lag / n : 0;
+
+	if(lag > rt->lag_high)
+	{
+		// shed in proportion to the fleet so a storm is absorbed quickly
+		rt->calm = 0;
+		for(steps = MAX(rt->active / 8, 1); steps > 0 && (st = rt_pick(rt, 1)); steps--)
+		{
+			rt_set_rung(rt, st, rt_rung(rt, st) + 1);
+			rt->degrades++;
+		}
+	}
+	else if(lag < rt->lag_low && ++rt->calm >= RT_RESTORE_CHECKS)
+	{
+		// restore more gently than we shed
+		rt->calm = 0;
+		for(steps = MAX(rt->active / 16, 1); steps > 0 && (st = rt_pick(rt, 0)); steps--)
+		{
+			rt_set_rung(rt, st, st->rung - 1);
+			rt->restores++;
+		}
+	}
+	else if(lag >= rt->lag_low)
+		rt->calm = 0;
+}
+
+// a virtual input is readable when epoll would say so: data on a watched
+// input, or the writer gone
+static int rt_ready(const eas_runtime *rt, const struct rt_stream *st)
+{
+	return st->open && ((st->vq_len && (!rt->budget || st->hot)) || (st->vq_eof && !st->vq_len));
+}
+
+static int rt_run_virtual(eas_runtime *rt)
+{
+	struct rt_stream *ready[RT_MAX_EVENTS];
+	double next;
+	int i, k, n, first;
+
+	rt_stamp(rt, &rt->start);
+
+	while(rt->active > 0 && !rt->stopping)
+	{
+		if(rt->lag_high && rt->vnow >= rt->next_degrade)
+		{
+			rt->next_degrade = rt->vnow + RT_DEGRADE_INTERVAL;
+			rt_degrade(rt);
+		}
+
+		if(rt->budget && rt->vnow >= rt->next_drain)
+		{
+			rt->next_drain += rt->budget;
+			if(rt->next_drain < rt->vnow)
+				rt->next_drain = rt->vnow + rt->budget;
+
+			rt_charge(rt, RT_VIRT_WAKE);
+			rt_drain(rt);
+			continue;
+		}
+
+		if(rt->history && rt->vnow >= rt->next_history)
+		{
+			rt->next_history += eas_rrd_step(0);
+			if(rt->next_history < rt->vnow)
+				rt->next_history = rt->vnow + eas_rrd_step(0);
+
+			rt_history(rt);
+			continue;
+		}
+
+		if(rt->tick_fn && rt->vnow >= rt->next_tick)
+		{
+			rt->next_tick += rt->tick_interval;
+			if(rt->next_tick < rt->vnow)
+				rt->next_tick = rt->vnow + rt->tick_interval;
+
+			rt->tick_fn(rt, rt->tick_ctx);
+			continue;
+		}
+
+		// one epoll_wait(): the ready inputs, round-robin, up to the limit
+		for(first = rt->vnext, n = 0, k = 0; k < rt->nstreams && n < RT_MAX_EVENTS; k++)
+		{
+			i = (first + k) % rt->nstreams;
+			if(rt_ready(rt, &rt->streams[i]))
+			{
+				ready[n++] = &rt->streams[i];
+				rt->vnext = i + 1;
+			}
+		}
+
+		if(n)
+		{
+			rt->wakeups++;
+			rt_charge(rt, RT_VIRT_WAKE);
+
+			for(i = 0; i < n; i++)
+				rt_read(rt, ready[i]);
+			continue;
+		}
+
+		// idle until the next timer; without one nothing can arrive
+		next = rt->tick_fn ? rt->next_tick : -1;
+		if(rt->budget && (next < 0 || rt->next_drain < next))
+			next = rt->next_drain;
+		if(rt->lag_high && (next < 0 || rt->next_degrade < next))
+			next = rt->next_degrade;
+		if(rt->history && (next < 0 || rt->next_history < next))
+			next = rt->next_history;
+
+		if(next < 0)
+			break;
+
+		rt->vnow = MAX(rt->vnow, next);
+	}
+
+	rt_stamp(rt, &rt->stop);
+	return 0;
+}
+
+int eas_runtime_run(eas_runtime *rt)
+{
+	struct epoll_event ev[RT_MAX_EVENTS];
+	int i, n, timeout;
+	double now;
+
+	if(rt->virt)
+		return rt_run_virtual(rt);
+
+	clock_gettime(CLOCK_MONOTONIC, &rt->start);
+
+	while(rt->active > 0 && !rt->stopping)
+	{
+		for(i = 0; i < rt->nstreams; i++)
+		{
+			if(rt->streams[i].open && !rt->streams[i].polled)
+				rt_read(rt, &rt->streams[i]);
+		}
+
+		timeout = rt->unpolled ? 0 : -1;
+		now = now_sec();
+
+		if(rt->lag_high && now >= rt->next_degrade)
+		{
+			rt->next_degrade = now + RT_DEGRADE_INTERVAL;
+			rt_degrade(rt);
+		}
+
+		if(rt->budget && rt->active > rt->unpolled)
+		{
+			if(now >= rt->next_drain)
+			{
+				rt->next_drain += rt->budget;
+				if(rt->next_drain < now)
+					rt->next_drain = now + rt->budget;
+
+				rt_drain(rt);
+				continue;
+			}
+
+			if(timeout)
+				timeout = (int)((rt->next_drain - now) * 1000.0) + 1;
+		}
+
+		if(rt->history)
+		{
+			if(now >= rt->next_history)
+			{
+				rt->next_history += eas_rrd_step(0);
+				if(rt->next_history < now)
+					rt->next_history = now + eas_rrd_step(0);
+
+				rt_history(rt);
+				continue;
+			}
+
+			if(timeout)
+				timeout = MIN((unsigned int)timeout, (unsigned int)((rt->next_history - now) * 1000.0) + 1);
+		}
+
+		if(rt->tick_fn)
+		{
+			if(now >= rt->next_tick)
+			{
+				rt->next_tick += rt->tick_interval;
+				if(rt->next_tick < now)
+					rt->next_tick = now + rt->tick_interval;
+
+				rt->tick_fn(rt, rt->tick_ctx);
+				continue;
+			}
+
+			if(timeout)
+				timeout = MIN((unsigned int)timeout, (unsigned int)((rt->next_tick - now) * 1000.0) + 1);
+		}
+
+		if(rt->active == rt->unpolled)
+			continue;
+
+		n = epoll_wait(rt->epfd, ev, RT_MAX_EVENTS, timeout);
+
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			perror("epoll_wait");
+			return -1;
+		}
+
+		if(n)
+			rt->wakeups++;
+
+		for(i = 0; i < n; i++)
+			rt_read(rt, ev[i].data.ptr);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &rt->stop);
+	return 0;
+}
+
+unsigned long eas_runtime_wakeups(const eas_runtime *rt)
+{
+	return rt->wakeups + rt->drains;
+}
+
+void eas_runtime_report(const eas_runtime *rt, FILE *fp)
+{
+	const struct rt_stream *st;
+	unsigned long long bytes = 0;
+	unsigned long reads = 0;
+	double wall, audio, committed, cost;
+	int i, engines[EAS_ENGINE_COUNT];
+
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		st = &rt->streams[i];
+		fprintf(fp, "stream %d: %s: %.1f s audio, %lu reads, %.0f samples/read\n",
+			i, st->path, st->bytes / (2.0 * FREQ_SAMP), st->reads,
+			st->reads ? st->bytes / (2.0 * st->reads) : 0.0);
+
+		bytes += st->bytes;
+		reads += st->reads;
+	}
+
+	wall = ts_sec(&rt->stop) - ts_sec(&rt->start);
+	audio = bytes / (2.0 * FREQ_SAMP);
+
+	fprintf(fp, "total: %d streams, %.1f s audio in %.2f s %s, %lu reads, %lu wakeups, cpu %.2f s\n",
+		rt->nstreams, audio, wall, rt->virt ? "virtual" : "wall", reads, rt->wakeups + rt->drains, (double)clock() / CLOCKS_PER_SEC);
+
+	if(rt->virt)
+		fprintf(fp, "virtual: decoder busy %.2f s (%.1f%%)\n", rt->vbusy, wall > 0 ? 100.0 * rt->vbusy / wall : 0);
+
+	if(rt->cpu_budget)
+	{
+		// what the streams were admitted against, open or not
+		for(committed = 0, i = 0; i < rt->nstreams; i++)
+			committed += rt->streams[i].cost;
+
+		cost = eas_cost(EAS_ENGINE_FULL, FREQ_SAMP);
+		fprintf(fp, "capacity: %.4f of %.4g cpus committed, room for %d more streams\n",
+			committed, rt->cpu_budget, cost > 0 ? (int)((rt->cpu_budget - committed) / cost) : 0);
+	}
+
+	if(rt->lag_high || rt->adaptive)
+	{
+		memset(engines, 0, sizeof(engines));
+		for(i = 0; i < rt->nstreams; i++)
+			engines[eas_get_engine(rt->streams[i].s)]++;
+
+		if(rt->lag_high)
+			fprintf(fp, "degradation: %lu steps down, %lu up; ", rt->degrades, rt->restores);
+		fprintf(fp, "engines at end%s:", rt->adaptive ? " (adaptive)" : "");
+		for(i = 0; i < EAS_ENGINE_COUNT; i++)
+			fprintf(fp, " %s %d", eas_engine_name(i), engines[i]);
+		fprintf(fp, "\n");
+	}
+
+	if(rt->budget)
+		fprintf(fp, "coalescing: %.0f ms budget, %lu idle drains, %lu idle/hot switches\n",
+			rt->budget * 1000.0, rt->drains, rt->switches);
+}
+
+void eas_runtime_destroy(eas_runtime *rt)
+{
+	int i;
+
+	if(!rt)
+		return;
+
+	for(i = 0; i < rt->nstreams; i++)
+	{
+		if(rt->streams[i].open)
+			rt_finish(rt, &rt->streams[i]);
+
+		eas_close(rt->streams[i].s);
+	}
+
+	close(rt->epfd);
+	eas_free(NULL, rt->streams);
+	eas_free(NULL, rt);
+}
@@ -0,0 +1,444 @@
+/*
+*      shard.c -- process-per-core sharded live decoding
+*
+*      A supervisor forks one worker process per core (or -w), and stream i
+*      belongs to worker i % workers. The supervisor reads every input
+*      straight into that stream's shared-memory sample ring (ring.c) and
+*      the owning worker decodes from the ring in place, so samples are
+*      never copied between processes. Events come back through a
+*      per-worker shared event ring and are printed by the supervisor.
+*
+*      Rings, positions and counters live in mappings made before the
+*      fork, so a worker that crashes, or stops beating its heartbeat for
+*      the stall time, is killed and re-forked while the other shards keep
+*      running. The new worker picks up at the ring tail its predecessor
+*      left; a message it was halfway through is lost, nothing else is.
+*      -k kills a random worker every so often to exercise this.
+*
+*      eas-decode shard [-w workers] [-t stall_ms] [-k kill_every_s] input ...
+*/
+
+#define _GNU_SOURCE                       // sched_setaffinity()
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define SHARD_RING FREQ_SAMP              // samples of input buffered per stream
+#define SHARD_PUSH 4096                   // most samples pushed per stream per pass
+#define SHARD_EVENTS 256                  // event ring slots per worker, a power of 2
+#define SHARD_MSG 272
+#define SHARD_IDLE_NS 1000000             // worker sleep when no stream had input
+#define SHARD_POLL_MS 5
+
+struct shard_event
+{
+	int type;
+	int stream;
+	int fault;
+	int has_message;
+	unsigned long long offset;
+	char message[SHARD_MSG];
+};
+
+// one per worker, shared; the worker writes everything but restarts
+struct shard_shared
+{
+	unsigned long long beat;              // bumped every pass
+	unsigned long long samples;
+	unsigned long long ev_head;           // events published, worker only
+	char pad0[64];
+	unsigned long long ev_tail;           // events printed, supervisor only
+	unsigned long dropped;                // events lost to a full ring
+	struct shard_event events[SHARD_EVENTS];
+};
+
+struct shard_input
+{
+	int fd;
+	int carry;                            // odd byte pending
+	char carry_byte;
+	struct eas_ring *ring;
+	const char *name;
+};
+
+struct shard_worker
+{
+	pid_t pid;
+	int restarts;
+	unsigned long long beat;              // last heartbeat seen
+	double beat_time;
+	int done;
+};
+
+struct shard
+{
+	int nworkers;
+	int ninputs;
+	struct shard_input *inputs;
+	struct shard_worker *workers;
+	struct shard_shared *shared;          // nworkers, one mapping
+	double stall;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void shard_event(const struct eas_event *ev, void *ctx)
+{
+	struct shard_shared *sh = ctx;
+	struct shard_event *e;
+	unsigned long long head = sh->ev_head;
+
+	if(head - __atomic_load_n(&sh->ev_tail, __ATOMIC_ACQUIRE) >= SHARD_EVENTS)
+	{
+		sh->dropped++;
+		return;
+	}
+
+	e = &sh->events[head & (SHARD_EVENTS - 1)];
+	e->type = ev->type;
+	e->stream = ev->stream;
+	e->fault = ev->fault;
+	e->offset = ev->offset;
+	e->has_message = ev->message != 0;
+	if(ev->message)
+		snprintf(e->message, sizeof(e->message), "%s", ev->message);
+
+	__atomic_store_n(&sh->ev_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// the worker: decode every owned stream straight out of its ring
+static void shard_work(struct shard *sd, int w)
+{
+	struct shard_shared *sh = &sd->shared[w];
+	const short *p;
+	eas_stream **s;
+	struct timespec idle = { 0, SHARD_IDLE_NS };
+	cpu_set_t set;
+	int i, n, busy, open;
+
+	CPU_ZERO(&set);
+	CPU_SET(w % sysconf(_SC_NPROCESSORS_ONLN), &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	if(!(s = calloc(sd->ninputs, sizeof(*s))))
+		_exit(1);
+
+	for(i = w; i < sd->ninputs; i += sd->nworkers)
+	{
+		if(!(s[i] = eas_open(i)))
+			_exit(1);
+		eas_set_event_handler(s[i], shard_event, sh);
+	}
+
+	do
+	{
+		__atomic_store_n(&sh->beat, sh->beat + 1, __ATOMIC_RELEASE);
+
+		for(busy = open = 0, i = w; i < sd->ninputs; i += sd->nworkers)
+		{
+			p = eas_ring_read_span(sd->inputs[i].ring, &n);
+			if(n < 0)
+				continue;
+
+			open = 1;
+			if(!n)
+				continue;
+
+			n = MIN(n, SHARD_PUSH);
+			eas_push(s[i], p, n);
+			eas_ring_consume(sd->inputs[i].ring, n);
+			__atomic_store_n(&sh->samples, sh->samples + n, __ATOMIC_RELAXED);
+			busy = 1;
+		}
+
+		if(open && !busy)
+			nanosleep(&idle, 0);
+	} while(open);
+
+	_exit(0);
+}
+
+static int shard_spawn(struct shard *sd, int w)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if((pid = fork()) < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if(!pid)
+		shard_work(sd, w);
+
+	sd->workers[w].pid = pid;
+	sd->workers[w].beat = __atomic_load_n(&sd->shared[w].beat, __ATOMIC_ACQUIRE);
+	sd->workers[w].beat_time = now_sec();
+	return 0;
+}
+
+static void shard_print(struct shard *sd)
+{
+	struct shard_shared *sh;
+	struct shard_event *e;
+	struct eas_event ev;
+	unsigned long long tail;
+	int w;
+
+	for(w = 0; w < sd->nworkers; w++)
+	{
+		sh = &sd->shared[w];
+
+		for(tail = sh->ev_tail; tail != __atomic_load_n(&sh->ev_head, __ATOMIC_ACQUIRE); tail++)
+		{
+			e = &sh->events[tail & (SHARD_EVENTS - 1)];
+			ev.type = e->type;
+			ev.stream = e->stream;
+			ev.fault = e->fault;
+			ev.offset = e->offset;
+			ev.message = e->has_message ? e->message : 0;
+			eas_print_event(&ev);
+		}
+
+		__atomic_store_n(&sh->ev_tail, tail, __ATOMIC_RELEASE);
+	}
+
+	fflush(stdout);
+}
+
+// reap exits, restart crashed workers and kill stuck ones; returns workers left
+static int shard_watch(struct shard *sd, double now)
+{
+	struct shard_worker *wk;
+	unsigned long long beat;
+	int w, status, left = 0;
+
+	for(w = 0; w < sd->nworkers; w++)
+	{
+		wk = &sd->workers[w];
+		if(wk->done)
+			continue;
+
+		if(waitpid(wk->pid, &status, WNOHANG) == wk->pid)
+		{
+			if(WIFEXITED(status) && !WEXITSTATUS(status))
+			{
+				wk->done = 1;
+				continue;
+			}
+
+			fprintf(stderr, "shard %d: worker %d %s %d, restarting\n", w, (int)wk->pid,
+				WIFSIGNALED(status) ? "killed by signal" : "exited with", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+			wk->restarts++;
+			if(shard_spawn(sd, w) < 0)
+				return -1;
+		}
+		else if((beat = __atomic_load_n(&sd->shared[w].beat, __ATOMIC_ACQUIRE)) != wk->beat)
+		{
+			wk->beat = beat;
+			wk->beat_time = now;
+		}
+		else if(now - wk->beat_time > sd->stall)
+		{
+			// reaped, and restarted, on the next pass
+			fprintf(stderr, "shard %d: worker %d stalled for %.1f s\n", w, (int)wk->pid, now - wk->beat_time);
+			kill(wk->pid, SIGKILL);
+			wk->beat_time = now;
+		}
+
+		left++;
+	}
+
+	return left;
+}
+
+// read every input into its ring; full rings are not polled (backpressure)
+static void shard_feed(struct shard *sd, struct pollfd *pfd)
+{
+	struct shard_input *in;
+	char *p;
+	int i, n, room;
+
+	for(i = 0; i < sd->ninputs; i++)
+	{
+		in = &sd->inputs[i];
+		pfd[i].fd = in->fd;
+		pfd[i].events = 0;
+		if(in->fd >= 0)
+		{
+			eas_ring_write_span(in->ring, &room);
+			pfd[i].events = room ? POLLIN : 0;
+		}
+	}
+
+	if(poll(pfd, sd->ninputs, SHARD_POLL_MS) <= 0)
+		return;
+
+	for(i = 0; i < sd->ninputs; i++)
+	{
+		in = &sd->inputs[i];
+		if(in->fd < 0 || !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		p = (char *)eas_ring_write_span(in->ring, &room);
+		if(!room)
+			continue;
+
+		// an odd byte left over from the last read starts this sample
+		if(in->carry)
+			p[0] = in->carry_byte;
+
+		if((n = read(in->fd, p + in->carry, room * sizeof(short) - in->carry)) < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		if(n <= 0)
+		{
+			close(in->fd);
+			in->fd = -1;
+			eas_ring_close_writer(in->ring);
+			continue;
+		}
+
+		n += in->carry;
+		eas_ring_commit(in->ring, n / sizeof(short));
+		in->carry = n & 1;
+		if(in->carry)
+			in->carry_byte = p[n - 1];
+	}
+}
+
+int shard_main(int argc, char **argv)
+{
+	struct shard sd;
+	struct pollfd *pfd;
+	double stall_ms = 2000, kill_every = 0, next_kill, start, now;
+	unsigned long long samples = 0;
+	int opt, i, w, left;
+
+	memset(&sd, 0, sizeof(sd));
+	sd.nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	while((opt = getopt(argc, argv, "w:t:k:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'w': sd.nworkers = atoi(optarg); break;
+		case 't': stall_ms = atof(optarg); break;
+		case 'k': kill_every = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: shard [-w workers] [-t stall_ms] [-k kill_every_s] input ...\n");
+			return 1;
+		}
+	}
+
+	sd.ninputs = argc - optind;
+	if(sd.ninputs < 1 || sd.nworkers < 1 || stall_ms <= 0)
+	{
+		fprintf(stderr, "shard: need at least one input and one worker\n");
+		return 1;
+	}
+
+	sd.nworkers = MIN(sd.nworkers, sd.ninputs);
+	sd.stall = stall_ms / 1000.0;
+
+	sd.inputs = calloc(sd.ninputs, sizeof(*sd.inputs));
+	sd.workers = calloc(sd.nworkers, sizeof(*sd.workers));
+	pfd = calloc(sd.ninputs, sizeof(*pfd));
+	sd.shared = mmap(0, sd.nworkers * sizeof(*sd.shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(!sd.inputs || !sd.workers || !pfd || sd.shared == MAP_FAILED)
+		return 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i = 0; i < sd.ninputs; i++)
+	{
+		sd.inputs[i].name = argv[optind + i];
+		// a FIFO open blocks here until its writer appears
+		if((sd.inputs[i].fd = open(sd.inputs[i].name, O_RDONLY)) < 0)
+		{
+			perror(sd.inputs[i].name);
+			return 1;
+		}
+		fcntl(sd.inputs[i].fd, F_SETFL, fcntl(sd.inputs[i].fd, F_GETFL) | O_NONBLOCK);
+
+		if(!(sd.inputs[i].ring = eas_ring_create(0, SHARD_RING)))
+			return 1;
+	}
+
+	for(w = 0; w < sd.nworkers; w++)
+	{
+		if(shard_spawn(&sd, w) < 0)
+			return 1;
+	}
+
+	fprintf(stderr, "shard: %d inputs on %d workers\n", sd.ninputs, sd.nworkers);
+
+	start = now_sec();
+	next_kill = start + kill_every;
+	srand((unsigned int)start);
+
+	do
+	{
+		shard_feed(&sd, pfd);
+		shard_print(&sd);
+
+		now = now_sec();
+		if(kill_every > 0 && now >= next_kill)
+		{
+			w = rand() % sd.nworkers;
+			if(!sd.workers[w].done)
+				kill(sd.workers[w].pid, SIGKILL);
+			next_kill = now + kill_every;
+		}
+
+		if((left = shard_watch(&sd, now)) < 0)
+			return 1;
+	} while(left);
+
+	shard_print(&sd);
+
+	for(w = 0; w < sd.nworkers; w++)
+	{
+		fprintf(stderr, "shard %d: %d streams, %.1f s audio, %d restarts, %lu events dropped\n", w,
+			(sd.ninputs - w + sd.nworkers - 1) / sd.nworkers, sd.shared[w].samples / (double)FREQ_SAMP,
+			sd.workers[w].restarts, sd.shared[w].dropped);
+		samples += sd.shared[w].samples;
+	}
+
+	fprintf(stderr, "shard: %.1f s audio in %.2f s\n", samples / (double)FREQ_SAMP, now_sec() - start);
+
+	for(i = 0; i < sd.ninputs; i++)
+		eas_ring_destroy(sd.inputs[i].ring);
+
+	munmap(sd.shared, sd.nworkers * sizeof(*sd.shared));
+	free(sd.inputs);
+	free(sd.workers);
+	free(pfd);
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+*      snr.c -- low-SNR header copy reception check
+*
+*      A run of alerts is rendered under white noise at each SNR (signal
+*      power over the whole transmission, as fleet -q measures it) and
+*      decoded three ways on the full engine: every header copy alone on a
+*      fresh stream, the whole run on one stream, and the whole run on one
+*      stream that picks its own engine (eas_set_adaptive). A fresh stream
+*      has no state to lose a copy by, so the streamed decodes must frame
+*      at least as many header copies as the lone ones, and the adaptive
+*      decode as many EOM copies as the fixed one. The cheaper engines are
+*      left out: their idle stride and decimation phase depend on where a
+*      block starts, so a lone copy is not a fair reference for them.
+*
+*      Exits 2 if any SNR and seed lost a copy.
+*
+*      eas-decode snr [-s snr_db,...] [-r seeds] [-n alerts]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define SNR_BLOCK (FREQ_SAMP / 50)        // samples per push, as a live read
+#define SNR_GAP FREQ_SAMP                 // noise between transmissions, samples
+#define SNR_MAX_LEVELS 16
+#define SNR_PAD (FREQ_SAMP / 10)         // decoded on each side of a lone copy
+#define SNR_BAUD 520.83                   // encoder symbol rate, in Hz
+#define SNR_HEADER "ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-"
+
+struct snr_count
+{
+	int headers;                          // header copies framed
+	int eoms;                             // EOM copies
+};
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = rand() / (RAND_MAX + 1.0);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static void snr_event(const struct eas_event *ev, void *ctx)
+{
+	struct snr_count *c = ctx;
+
+	if(ev->type == EAS_EVENT_PART)
+		c->headers++;
+	else if(ev->type == EAS_EVENT_EOM)
+		c->eoms++;
+}
+
+// alerts transmissions back to back under noise at snr dB
+static short *snr_render(const short *tx, int len, int alerts, double snr, int *count)
+{
+	short *audio;
+	double power = 0, sd, x;
+	int i, n = alerts * (len + SNR_GAP);
+
+	if(!(audio = calloc(n, sizeof(short))))
+		return 0;
+
+	for(i = 0; i < alerts; i++)
+		memcpy(audio + i * (len + SNR_GAP), tx, len * sizeof(short));
+
+	for(i = 0; i < len; i++)
+		power += (double)tx[i] * tx[i];
+	sd = sqrt(power / len / pow(10.0, snr / 10.0));
+
+	for(i = 0; i < n; i++)
+	{
+		x = audio[i] + sd * gauss();
+		audio[i] = (short)MAX(MIN(x, 32767.0), -32768.0);
+	}
+
+	*count = n;
+	return audio;
+}
+
+static void snr_decode(const short *audio, int count, int adaptive, struct snr_count *c)
+{
+	eas_stream *s;
+	int i;
+
+	if(!(s = eas_open(0)))
+		return;
+
+	eas_set_engine(s, EAS_ENGINE_FULL);
+	eas_set_adaptive(s, adaptive);
+	eas_set_event_handler(s, snr_event, c);
+
+	for(i = 0; i < count; i += SNR_BLOCK)
+		eas_push(s, audio + i, MIN(SNR_BLOCK, count - i));
+
+	eas_close(s);
+}
+
+int snr_main(int argc, char **argv)
+{
+	struct snr_count alone, fixed, adapt;
+	double levels[SNR_MAX_LEVELS] = { -11, -10, -9, -8, -7, -6 };
+	short *tx, *audio;
+	char *p, *q;
+	int opt, len, copy, count, l, seed, a, k, from, to, nlevels = 6, seeds = 5, alerts = 3, failed = 0;
+
+	while((opt = getopt(argc, argv, "s:r:n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's':
+			for(nlevels = 0, p = optarg; *p && nlevels < SNR_MAX_LEVELS; p = q + (*q == ','))
+			{
+				levels[nlevels++] = strtod(p, &q);
+				if(q == p)
+					goto usage;
+			}
+			break;
+		case 'r': seeds = atoi(optarg); break;
+		case 'n': alerts = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if(optind != argc || !nlevels || seeds < 1 || alerts < 1)
+		goto usage;
+
+	if((len = encode_samples(SNR_HEADER, &tx)) <= 0)
+		return 1;
+
+	// two preamble bytes and the header, then a second of silence
+	copy = (int)((2 + strlen(SNR_HEADER)) * 8 * FREQ_SAMP / SNR_BAUD + 0.5);
+
+	printf("%6s  %4s  %4s  %5s  %8s  %8s\n", "snr dB", "seed", "sent", "alone", "streamed", "adaptive");
+
+	for(l = 0; l < nlevels; l++)
+	{
+		for(seed = 1; seed <= seeds; seed++)
+		{
+			// every decode sees the same noise
+			srand(seed);
+			if(!(audio = snr_render(tx, len, alerts, levels[l], &count)))
+				return 1;
+
+			memset(&alone, 0, sizeof(alone));
+			memset(&fixed, 0, sizeof(fixed));
+			memset(&adapt, 0, sizeof(adapt));
+
+			// each header copy on a stream of its own, with no history to
+			// lose it by
+			for(a = 0; a < alerts; a++)
+			{
+				for(k = 0; k < 3; k++)
+				{
+					from = a * (len + SNR_GAP) + k * (copy + FREQ_SAMP);
+					to = MIN(from + copy + SNR_PAD, count);
+					from = MAX(from - SNR_PAD, 0);
+					snr_decode(audio + from, to - from, 0, &alone);
+				}
+			}
+
+			snr_decode(audio, count, 0, &fixed);
+			snr_decode(audio, count, 1, &adapt);
+			free(audio);
+
+			printf("%6.1f  %4d  %4d  %5d  %8d  %8d", levels[l], seed, 3 * alerts, alone.headers, fixed.headers, adapt.headers);
+
+			if(fixed.headers < alone.headers || adapt.headers < alone.headers || adapt.eoms < fixed.eoms)
+			{
+				printf("  LOST COPIES");
+				failed = 1;
+			}
+
+			printf("\n");
+		}
+	}
+
+	free(tx);
+	return failed ? 2 : 0;
+
+usage:
+	fprintf(stderr, "usage: snr [-s snr_db,...] [-r seeds] [-n alerts]\n");
+	return 1;
+}
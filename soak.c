@@ -0,0 +1,433 @@
+/*
+*      soak.c -- long-running soak test with drift detection
+*
+*      Runs many decoder streams in the live runtime for hours or days on
+*      synthetic alerts and replayed recordings, written into pipes at
+*      (a multiple of) real-time pace. Every sample interval it records
+*      RSS, per-stream lag, alert latency and decode rate, and at the end
+*      flags metrics that grew steadily over the run.
+*
+*      eas-decode soak [-n streams] [-t seconds] [-i interval] [-x speed]
+*                      [-a alert_gap_s] [file.raw ...]
+*
+*      Exits with 2 when drift was detected.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define SOAK_TICK 0.02                    // producer period, seconds
+#define SOAK_WARMUP 0.1                   // fraction of samples ignored by drift checks
+
+static const char *soak_messages[] = {
+	"ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-",
+	"ZCZC-WXR-SVR-012103+0100-2780430-KTBW/NWS-",
+	"ZCZC-EAS-RWT-012057-012081+0030-2780415-WTSP/TV-",
+	"ZCZC-WXR-FFW-012101-012103-012115+0300-2780500-KTBW/NWS-",
+};
+
+#define SOAK_NMESSAGES (sizeof(soak_messages)/sizeof(soak_messages[0]))
+
+struct soak_src
+{
+	short *samples;
+	int count;
+	int alert;                            // carries a header that must be voted
+};
+
+struct soak_stream
+{
+	int src;
+	int pos;
+	int idle;                             // filler samples left before next source
+	unsigned long expected;               // alert transmissions fully written
+	unsigned long received;               // alerts voted by the decoder
+};
+
+struct soak_series
+{
+	const char *name;
+	double *v;
+	int n;
+	int cap;
+	double min_growth;                    // absolute growth worth reporting
+};
+
+enum
+{
+	SERIES_RSS,
+	SERIES_LAG,
+	SERIES_LATENCY,
+	SERIES_COST,
+	SERIES_COUNT,
+};
+
+struct soak
+{
+	int nstreams;
+	int nsrc;
+	struct soak_src *srcs;
+	struct soak_stream *streams;
+	struct eas_feed *feed;
+	short *filler;
+	int filler_len;
+	double speed;
+	double alert_gap;
+	double duration;
+	double interval;
+	double start;
+	double last_sample;
+	double last_cpu;
+	unsigned long long last_written;
+
+	// per interval
+	double lat_sum;
+	double lat_max;
+	unsigned long lat_n;
+
+	struct soak_series series[SERIES_COUNT];
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double rss_mb(void)
+{
+	FILE *fp;
+	long pages = 0, resident = 0;
+
+	if(!(fp = fopen("/proc/self/statm", "r")))
+		return 0;
+
+	if(fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+
+	fclose(fp);
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static void series_add(struct soak_series *ss, double v)
+{
+	double *p;
+
+	if(ss->n == ss->cap)
+	{
+		ss->cap = ss->cap ? ss->cap * 2 : 256;
+		if(!(p = realloc(ss->v, ss->cap * sizeof(double))))
+			return;
+
+		ss->v = p;
+	}
+
+	ss->v[ss->n++] = v;
+}
+
+// returns 1 if the series shows sustained growth after warmup
+static int series_drift(const struct soak_series *ss, FILE *fp)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, slope, growth, mean;
+	int i, n, first, ups = 0, downs = 0;
+
+	first = (int)(ss->n * SOAK_WARMUP);
+	n = ss->n - first;
+	if(n < 8)
+		return 0;
+
+	for(i = first; i < ss->n; i++)
+	{
+		sx += i;
+		sy += ss->v[i];
+		sxx += (double)i * i;
+		sxy += i * ss->v[i];
+
+		if(i > first && ss->v[i] > ss->v[i - 1])
+			ups++;
+		else if(i > first && ss->v[i] < ss->v[i - 1])
+			downs++;
+	}
+
+	slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	growth = slope * (n - 1);
+	mean = sy / n;
+
+	// least-squares growth over the run must be material, and the series
+	// must mostly move upward rather than just wander
+	if(growth > ss->min_growth && growth > 0.05 * fabs(mean) && ups > 2 * downs)
+	{
+		fprintf(fp, "DRIFT: %s grew %.3f over the run (mean %.3f, %d up / %d down)\n",
+			ss->name, growth, mean, ups, downs);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void soak_event(const struct eas_event *ev, void *ctx)
+{
+	struct soak *sk = ctx;
+	double t;
+	int i;
+
+	if(ev->type != EAS_EVENT_START)
+	{
+		if(ev->type == EAS_EVENT_FAULT || ev->type == EAS_EVENT_FAULT_CLEAR)
+			eas_print_event(ev);
+		return;
+	}
+
+	if((i = eas_feed_stream(sk->feed, ev->stream)) < 0)
+		return;
+
+	sk->streams[i].received++;
+
+	// latency from the write of the sample that completed the vote
+	if((t = eas_feed_write_time(sk->feed, i, ev->offset)) < 0)
+		return;
+
+	t = now_sec() - t;
+	sk->lat_sum += t;
+	sk->lat_max = MAX(sk->lat_max, t);
+	sk->lat_n++;
+}
+
+static int soak_fill(void *ctx, int stream, short *buf, int max)
+{
+	struct soak *sk = ctx;
+	struct soak_stream *st = &sk->streams[stream];
+	const struct soak_src *src;
+	int n;
+
+	if(st->idle > 0)
+	{
+		n = MIN(MIN(st->idle, sk->filler_len), max);
+		memcpy(buf, sk->filler, n * sizeof(short));
+		st->idle -= n;
+		return n;
+	}
+
+	src = &sk->srcs[st->src];
+	n = MIN(src->count - st->pos, max);
+	memcpy(buf, src->samples + st->pos, n * sizeof(short));
+	st->pos += n;
+
+	if(st->pos >= src->count)
+	{
+		// source finished; idle a while, then move to the next one
+		if(src->alert)
+			st->expected++;
+
+		st->pos = 0;
+		st->src = (st->src + 1) % sk->nsrc;
+		st->idle = (int)(sk->alert_gap * FREQ_SAMP * (0.5 + rand() / (RAND_MAX + 1.0)));
+	}
+
+	return n;
+}
+
+static void soak_sample(eas_runtime *rt, struct soak *sk, double now)
+{
+	struct eas_runtime_stream_stats rs;
+	unsigned long long written = 0;
+	unsigned long expected = 0, received = 0;
+	double lag_max = 0, lag_sum = 0, cpu, rss, audio, lat;
+	int i;
+
+	for(i = 0; i < sk->nstreams; i++)
+	{
+		eas_runtime_stream_stats(rt, i, &rs);
+		lag_max = MAX(lag_max, rs.lag);
+		lag_sum += rs.lag;
+		written += eas_feed_written(sk->feed, i);
+		expected += sk->streams[i].expected;
+		received += sk->streams[i].received;
+	}
+
+	cpu = cpu_sec();
+	rss = rss_mb();
+	audio = (written - sk->last_written) / (double)FREQ_SAMP;
+	lat = sk->lat_n ? sk->lat_sum / sk->lat_n : 0;
+
+	printf("%8.0f s  rss %7.2f MB  lag avg %6.3f max %6.3f s  latency avg %6.3f max %6.3f s  "
+		"rate %7.1fx  cpu/audio %.4f  voted %lu sent %lu\n",
+		now - sk->start, rss, lag_sum / sk->nstreams, lag_max, lat, sk->lat_max,
+		audio / (now - sk->last_sample), audio > 0 ? (cpu - sk->last_cpu) / audio : 0,
+		received, expected);
+	fflush(stdout);
+
+	series_add(&sk->series[SERIES_RSS], rss);
+	series_add(&sk->series[SERIES_LAG], lag_max);
+	if(sk->lat_n)
+		series_add(&sk->series[SERIES_LATENCY], lat);
+	if(audio > 0)
+		series_add(&sk->series[SERIES_COST], (cpu - sk->last_cpu) / audio);
+
+	sk->last_sample = now;
+	sk->last_cpu = cpu;
+	sk->last_written = written;
+	sk->lat_sum = 0;
+	sk->lat_max = 0;
+	sk->lat_n = 0;
+}
+
+static void soak_tick(eas_runtime *rt, void *ctx)
+{
+	struct soak *sk = ctx;
+	double now = now_sec();
+
+	// sample before producing so lag shows what the decoder left unread
+	if(now - sk->last_sample >= sk->interval)
+		soak_sample(rt, sk, now);
+
+	eas_feed_pump(sk->feed, now);
+
+	if(now - sk->start >= sk->duration)
+		eas_runtime_stop(rt);
+}
+
+static int soak_load(const char *fname, struct soak_src *src)
+{
+	FILE *fp;
+	long len;
+
+	if(!(fp = fopen(fname, "rb")))
+	{
+		perror(fname);
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp) / sizeof(short);
+	fseek(fp, 0, SEEK_SET);
+
+	src->samples = malloc(MAX(len, 1) * sizeof(short));
+	src->count = (int)fread(src->samples, sizeof(short), len, fp);
+	src->alert = 0;
+
+	fclose(fp);
+	return 0;
+}
+
+int soak_main(int argc, char **argv)
+{
+	struct soak sk;
+	eas_runtime *rt;
+	int opt, i, drift = 0;
+	unsigned int seed = 1;
+
+	memset(&sk, 0, sizeof(sk));
+	sk.nstreams = 16;
+	sk.duration = 3600;
+	sk.interval = 10;
+	sk.speed = 1.0;
+	sk.alert_gap = 30;
+
+	while((opt = getopt(argc, argv, "n:t:i:x:a:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n': sk.nstreams = atoi(optarg); break;
+		case 't': sk.duration = atof(optarg); break;
+		case 'i': sk.interval = atof(optarg); break;
+		case 'x': sk.speed = atof(optarg); break;
+		case 'a': sk.alert_gap = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: soak [-n streams] [-t seconds] [-i interval] [-x speed] "
+				"[-a alert_gap_s] [file.raw ...]\n");
+			return 1;
+		}
+	}
+
+	if(sk.nstreams < 1 || sk.speed <= 0 || sk.interval <= 0)
+		return 1;
+
+	srand(seed);
+
+	// synthetic alerts followed by any recordings given
+	sk.nsrc = SOAK_NMESSAGES + argc - optind;
+	sk.srcs = calloc(sk.nsrc, sizeof(*sk.srcs));
+
+	for(i = 0; i < (int)SOAK_NMESSAGES; i++)
+	{
+		sk.srcs[i].count = encode_samples(soak_messages[i], &sk.srcs[i].samples);
+		sk.srcs[i].alert = 1;
+	}
+
+	for(; i < sk.nsrc; i++)
+	{
+		if(soak_load(argv[optind + i - SOAK_NMESSAGES], &sk.srcs[i]) < 0)
+			return 1;
+	}
+
+	// low-level noise between transmissions, a stand-in for program audio
+	sk.filler_len = FREQ_SAMP;
+	sk.filler = malloc(sk.filler_len * sizeof(short));
+	for(i = 0; i < sk.filler_len; i++)
+		sk.filler[i] = (short)((rand() % 2001) - 1000);
+
+	sk.series[SERIES_RSS].name = "rss (MB)";
+	sk.series[SERIES_RSS].min_growth = 1.0;
+	sk.series[SERIES_LAG].name = "max lag (s)";
+	sk.series[SERIES_LAG].min_growth = 0.25;
+	sk.series[SERIES_LATENCY].name = "alert latency (s)";
+	sk.series[SERIES_LATENCY].min_growth = 0.05;
+	sk.series[SERIES_COST].name = "cpu per audio second";
+	sk.series[SERIES_COST].min_growth = 0.0005;
+
+	if(!(rt = eas_runtime_create(sk.nstreams)))
+		return 1;
+
+	sk.streams = calloc(sk.nstreams, sizeof(*sk.streams));
+
+	for(i = 0; i < sk.nstreams; i++)
+	{
+		sk.streams[i].src = i % sk.nsrc;
+		sk.streams[i].idle = rand() % (int)(sk.alert_gap * FREQ_SAMP + 1);
+	}
+
+	if(!(sk.feed = eas_feed_create(rt, sk.nstreams, sk.speed, soak_fill, &sk)))
+		return 1;
+
+	eas_runtime_set_event_handler(rt, soak_event, &sk);
+	eas_runtime_set_tick(rt, SOAK_TICK, soak_tick, &sk);
+
+	sk.start = sk.last_sample = now_sec();
+	sk.last_cpu = cpu_sec();
+
+	eas_runtime_run(rt);
+
+	for(i = 0; i < SERIES_COUNT; i++)
+		drift |= series_drift(&sk.series[i], stdout);
+
+	if(!drift)
+		printf("no drift detected over %d samples\n", sk.series[SERIES_RSS].n);
+
+	eas_feed_destroy(sk.feed);
+	eas_runtime_destroy(rt);
+	return drift ? 2 : 0;
+}
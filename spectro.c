@@ -0,0 +1,247 @@
+/*
+*      spectro.c -- downsampled spectrogram side output for the EAS decoder
+*
+*      Every SPEC_INTERVAL samples a Goertzel bank of SPEC_BINS filters
+*      spanning SPEC_LOW..SPEC_HIGH is run over the first SPEC_WINLEN
+*      samples of the interval, so the cost is a small fraction of the
+*      demodulator's per-sample correlators.
+*
+*      File layout (host byte order):
+*        struct spec_header
+*        float bin_freq[bins]
+*        unsigned char frame[bins] ...   one per interval, 0.5 dB steps
+*                                        from SPEC_FLOOR dBFS
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#include "easproc.h"
+#include "spectro.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define SPEC_BINS 16                      // Goertzel filters, multiple of 4
+#define SPEC_LOW 1000.0                   // lowest bin, in Hz
+#define SPEC_HIGH 3000.0                  // highest bin, in Hz
+#define SPEC_INTERVAL (FREQ_SAMP/10)      // one frame every 100 ms
+#define SPEC_WINLEN 256                   // samples analyzed per frame
+#define SPEC_FLOOR -120.0                 // dBFS of output value 0
+#define SPEC_FLUSH 10                     // frames buffered per write()
+
+struct spec_header
+{
+	char magic[4];                        // "EASG"
+	unsigned short version;
+	unsigned short bins;
+	unsigned int rate;
+	unsigned int interval;
+	unsigned int window;
+};
+
+struct eas_spectro
+{
+	int fd;
+	int phase;                            // samples into the current interval
+	float coeff[SPEC_BINS];
+	float s1[SPEC_BINS];
+	float s2[SPEC_BINS];
+	float window[SPEC_WINLEN];
+	unsigned char out[SPEC_BINS * SPEC_FLUSH];
+	int nout;
+	int failed;                           // a write failed; frames are dropped
+};
+
+static int spectro_write(struct eas_spectro *sp, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while(len > 0)
+	{
+		if((n = write(sp->fd, p, len)) < 0 && errno == EINTR)
+			continue;
+
+		if(n <= 0)
+		{
+			if(!n)
+				errno = ENOSPC;
+			perror("spectrogram");
+			sp->failed = 1;
+			return -1;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+struct eas_spectro *spectro_open(eas_stream *s, const char *fname)
+{
+	struct eas_spectro *sp;
+	struct spec_header hdr;
+	float freq[SPEC_BINS];
+	int i;
+
+	if(!(sp = eas_malloc(s, sizeof(*sp))))
+		return 0;
+
+	memset(sp, 0, sizeof(*sp));
+
+#ifdef _MSC_VER
+	if ((sp->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644)) < 0) {
+#else
+	if ((sp->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+#endif
+		perror(fname);
+		eas_free(s, sp);
+		return 0;
+	}
+
+	for(i = 0; i < SPEC_BINS; i++)
+	{
+		freq[i] = (float)(SPEC_LOW + i * (SPEC_HIGH - SPEC_LOW) / (SPEC_BINS - 1));
+		sp->coeff[i] = (float)(2.0 * cos(2.0*3.14159265359*freq[i]/FREQ_SAMP));
+	}
+
+	// Hann window keeps the mark/space tones from smearing across the bank
+	for(i = 0; i < SPEC_WINLEN; i++)
+		sp->window[i] = (float)(0.5 - 0.5 * cos(2.0*3.14159265359*i/(SPEC_WINLEN - 1)));
+
+	memcpy(hdr.magic, "EASG", 4);
+	hdr.version = 1;
+	hdr.bins = SPEC_BINS;
+	hdr.rate = FREQ_SAMP;
+	hdr.interval = SPEC_INTERVAL;
+	hdr.window = SPEC_WINLEN;
+
+	if(spectro_write(sp, &hdr, sizeof(hdr)) < 0 || spectro_write(sp, freq, sizeof(freq)) < 0)
+	{
+		close(sp->fd);
+		eas_free(s, sp);
+		return 0;
+	}
+
+	return sp;
+}
+
+static void spectro_flush(struct eas_spectro *sp)
+{
+	// after a failure the decode goes on without its side output
+	if(sp->nout && !sp->failed)
+		spectro_write(sp, sp->out, sp->nout);
+
+	sp->nout = 0;
+}
+
+void spectro_close(eas_stream *s, struct eas_spectro *sp)
+{
+	if(!sp)
+		return;
+
+	spectro_flush(sp);
+	if(close(sp->fd) < 0 && !sp->failed)
+		perror("spectrogram");
+	eas_free(s, sp);
+}
+
+static void spectro_frame(struct eas_spectro *sp)
+{
+	unsigned char *out = &sp->out[sp->nout];
+	float p, db;
+	int i;
+
+	for(i = 0; i < SPEC_BINS; i++)
+	{
+		p = sp->s1[i]*sp->s1[i] + sp->s2[i]*sp->s2[i] - sp->coeff[i]*sp->s1[i]*sp->s2[i];
+
+		// a full scale tone under the Hann window peaks at (N/4)^2
+		db = (float)(10.0 * log10(p * (16.0f/(SPEC_WINLEN*SPEC_WINLEN)) + 1e-20));
+		db = (db - (float)SPEC_FLOOR) * 2.0f;
+
+		out[i] = (unsigned char)(db < 0 ? 0 : db > 255 ? 255 : db);
+		sp->s1[i] = sp->s2[i] = 0.0f;
+	}
+
+	sp->nout += SPEC_BINS;
+	if(sp->nout >= (int)sizeof(sp->out))
+		spectro_flush(sp);
+}
+
+static void goertzel(struct eas_spectro *sp, const float *x, const float *w, int n)
+{
+	__m128 c[SPEC_BINS/4], s1[SPEC_BINS/4], s2[SPEC_BINS/4], v, s0;
+	int i, b;
+
+	for(b = 0; b < SPEC_BINS/4; b++)
+	{
+		c[b] = _mm_loadu_ps(&sp->coeff[4*b]);
+		s1[b] = _mm_loadu_ps(&sp->s1[4*b]);
+		s2[b] = _mm_loadu_ps(&sp->s2[4*b]);
+	}
+
+	// one sample feeds four filters per lane
+	for(i = 0; i < n; i++)
+	{
+		v = _mm_set1_ps(x[i] * w[i]);
+
+		for(b = 0; b < SPEC_BINS/4; b++)
+		{
+			s0 = _mm_sub_ps(_mm_add_ps(v, _mm_mul_ps(c[b], s1[b])), s2[b]);
+			s2[b] = s1[b];
+			s1[b] = s0;
+		}
+	}
+
+	for(b = 0; b < SPEC_BINS/4; b++)
+	{
+		_mm_storeu_ps(&sp->s1[4*b], s1[b]);
+		_mm_storeu_ps(&sp->s2[4*b], s2[b]);
+	}
+}
+
+void spectro_feed(struct eas_spectro *sp, const float *x, int n)
+{
+	int k;
+
+	while(n > 0)
+	{
+		if(sp->phase < SPEC_WINLEN)
+		{
+			k = SPEC_WINLEN - sp->phase;
+			if(k > n)
+				k = n;
+
+			goertzel(sp, x, &sp->window[sp->phase], k);
+			sp->phase += k;
+
+			if(sp->phase == SPEC_WINLEN)
+				spectro_frame(sp);
+		}
+		else
+		{
+			// rest of the interval is skipped
+			k = SPEC_INTERVAL - sp->phase;
+			if(k > n)
+				k = n;
+
+			sp->phase += k;
+			if(sp->phase == SPEC_INTERVAL)
+				sp->phase = 0;
+		}
+
+		x += k;
+		n -= k;
+	}
+}
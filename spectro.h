@@ -0,0 +1,16 @@
+/*
+*      spectro.h -- spectrogram side output, used by the decoder ingestion stage
+*/
+
+#ifndef EAS_SPECTRO_H
+#define EAS_SPECTRO_H
+
+#include "easproc.h"
+
+struct eas_spectro;
+
+struct eas_spectro *spectro_open(eas_stream *s, const char *fname);
+void spectro_close(eas_stream *s, struct eas_spectro *sp);
+void spectro_feed(struct eas_spectro *sp, const float *x, int n);
+
+#endif
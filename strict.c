@@ -0,0 +1,174 @@
+/*
+*      strict.c -- steady-state allocation check
+*
+*      Decodes an alert, or a clip, on a warmed stream in strict mode (the
+*      decoder's -s) three times, each in a child so an abort is observed
+*      rather than suffered:
+*
+*        clean   events printed as usual; the child must finish with no
+*                allocation charged to ingest, demod, framing or event
+*        count   not strict, with a handler that allocates on every event;
+*                the calls must be charged to the event stage
+*        trap    strict, with the same handler; the child must abort
+*
+*      The handler calls plain malloc(), not eas_malloc(), so the last two
+*      only pass if the decoder sees the process's own allocator.
+*
+*      Exits 2 if any of the three fails.
+*
+*      eas-decode strict [file.raw]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "easproc.h"
+
+#define FREQ_SAMP  22050                  // req'd input sampling rate, in Hz
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define STRICT_BLOCK (FREQ_SAMP / 50)     // samples per push, as a live read
+#define STRICT_HEADER "ZCZC-WXR-TOR-012057-012081+0030-2780415-WTSP/TV-"
+
+enum
+{
+	STRICT_CLEAN = 0,
+	STRICT_COUNT = 1,
+	STRICT_TRAP = 2,
+};
+
+// kept where the compiler cannot prove the allocation unused
+static void *volatile strict_leak;
+
+static void strict_event(const struct eas_event *ev, void *ctx)
+{
+	(void)ev;
+	(void)ctx;
+
+	strict_leak = malloc(64);
+	free(strict_leak);
+}
+
+// in a child: 0 if the decode ran as the mode expects, 3 if not
+static int strict_run(const short *audio, int count, int mode)
+{
+	eas_stream *s;
+	unsigned long steady = 0;
+	int i, stage;
+
+	if(mode != STRICT_COUNT)
+		eas_alloc_strict(1);
+
+	if(!(s = eas_open(0)))
+		return 3;
+
+	if(mode != STRICT_CLEAN)
+		eas_set_event_handler(s, strict_event, 0);
+
+	for(i = 0; i < count; i += STRICT_BLOCK)
+		eas_push(s, audio + i, MIN(STRICT_BLOCK, count - i));
+
+	for(stage = EAS_STAGE_INGEST; stage < EAS_STAGE_COUNT; stage++)
+		steady += eas_alloc_count(s, stage);
+
+	if(mode == STRICT_COUNT)
+		fprintf(stderr, "count: %lu allocations charged to the event stage\n", eas_alloc_count(s, EAS_STAGE_EVENT));
+
+	i = mode == STRICT_CLEAN ? !steady : eas_alloc_count(s, EAS_STAGE_EVENT) > 0;
+	eas_close(s);
+	fflush(stdout);
+
+	return i ? 0 : 3;
+}
+
+static int strict_child(const short *audio, int count, int mode)
+{
+	pid_t pid;
+	int status, null;
+
+	fflush(stdout);
+	if((pid = fork()) < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if(!pid)
+	{
+		// the events printed are not the point
+		if((null = open("/dev/null", O_WRONLY)) >= 0)
+			dup2(null, 1);
+		_exit(strict_run(audio, count, mode));
+	}
+
+	if(waitpid(pid, &status, 0) < 0)
+		return -1;
+
+	return status;
+}
+
+int strict_main(int argc, char **argv)
+{
+	static const char *names[] = { "clean", "count", "trap" };
+	short *audio;
+	struct stat st;
+	size_t mapped = 0;
+	int fd, count, mode, status, ok, failed = 0;
+
+	if(argc > 2)
+	{
+		fprintf(stderr, "usage: strict [file.raw]\n");
+		return 1;
+	}
+
+	if(argc == 2)
+	{
+		if((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(short))
+		{
+			perror(argv[1]);
+			return 1;
+		}
+
+		audio = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(audio == MAP_FAILED)
+		{
+			perror(argv[1]);
+			return 1;
+		}
+		mapped = st.st_size;
+		count = (int)MIN(st.st_size / (off_t)sizeof(short), 0x7fffffff);
+	}
+	else if((count = encode_samples(STRICT_HEADER, &audio)) <= 0)
+		return 1;
+
+	for(mode = STRICT_CLEAN; mode <= STRICT_TRAP; mode++)
+	{
+		if((status = strict_child(audio, count, mode)) < 0)
+			break;
+
+		if(mode == STRICT_TRAP)
+			ok = WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+		else
+			ok = WIFEXITED(status) && !WEXITSTATUS(status);
+
+		printf("%-6s %s\n", names[mode], ok ? "ok" : "FAILED");
+		failed |= !ok;
+	}
+
+	if(mapped)
+		munmap(audio, mapped);
+	else
+		free(audio);
+
+	return status < 0 ? 1 : failed ? 2 : 0;
+}